@@ -50,7 +50,9 @@ void fat_shell(void) {
             vga_print_color("  touch <name>    - Create empty file\n", 0x0F);
             vga_print_color("  rm <name>       - Remove file/directory\n", 0x0F);
             vga_print_color("  write <f> <txt> - Write text to file\n", 0x0F);
+            vga_print_color("  append <f> <t>  - Append text to file\n", 0x0F);
             vga_print_color("  exec <file>     - Execute ELF program\n", 0x0F);
+            vga_print_color("  sync            - Flush write-back data\n", 0x0F);
             vga_print_color("  info            - Filesystem info\n", 0x0F);
             vga_print_color("  clear           - Clear screen\n", 0x0F);
             vga_print_color("  exit            - Exit FAT shell\n", 0x0F);
@@ -93,6 +95,16 @@ void fat_shell(void) {
                 vga_print_color("Usage: write <file> <text>\n", LIGHT_RED);
             }
         }
+        else if (strcmp(cmd, "append") == 0) {
+            char* text = strchr(args, ' ');
+            if (text) {
+                *text = '\0';
+                text++;
+                fat_append(args, text, strlen(text));
+            } else {
+                vga_print_color("Usage: append <file> <text>\n", LIGHT_RED);
+            }
+        }
         else if (strcmp(cmd, "exec") == 0 || strcmp(cmd, "run") == 0 || strcmp(cmd, "./") == 0) {
             if (args[0]) {
                 elf_exec(args);
@@ -103,6 +115,9 @@ void fat_shell(void) {
         else if (strcmp(cmd, "info") == 0) {
             fat_info();
         }
+        else if (strcmp(cmd, "sync") == 0) {
+            if (fat_flush() < 0) vga_print_color("Sync failed\n", LIGHT_RED);
+        }
         else if (strcmp(cmd, "clear") == 0) {
             vga_clear();
         }
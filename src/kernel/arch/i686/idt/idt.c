@@ -9,6 +9,20 @@ extern void idt_flush(uint32_t idt_ptr_addr);
 
 extern void irq0(void);
 extern void irq1(void);
+extern void irq2(void);
+extern void irq3(void);
+extern void irq4(void);
+extern void irq5(void);
+extern void irq6(void);
+extern void irq7(void);
+extern void irq8(void);
+extern void irq9(void);
+extern void irq10(void);
+extern void irq11(void);
+extern void irq12(void);
+extern void irq13(void);
+extern void irq14(void);
+extern void irq15(void);
 
 void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags) {
     idt[num].base_lo = base & 0xFFFF;
@@ -64,6 +78,20 @@ void init_idt(void) {
 
     idt_set_gate(32, (uint32_t)(uintptr_t)irq0, 0x08, 0x8E);
     idt_set_gate(33, (uint32_t)(uintptr_t)irq1, 0x08, 0x8E);
+    idt_set_gate(34, (uint32_t)(uintptr_t)irq2, 0x08, 0x8E);
+    idt_set_gate(35, (uint32_t)(uintptr_t)irq3, 0x08, 0x8E);
+    idt_set_gate(36, (uint32_t)(uintptr_t)irq4, 0x08, 0x8E);
+    idt_set_gate(37, (uint32_t)(uintptr_t)irq5, 0x08, 0x8E);
+    idt_set_gate(38, (uint32_t)(uintptr_t)irq6, 0x08, 0x8E);
+    idt_set_gate(39, (uint32_t)(uintptr_t)irq7, 0x08, 0x8E);
+    idt_set_gate(40, (uint32_t)(uintptr_t)irq8, 0x08, 0x8E);
+    idt_set_gate(41, (uint32_t)(uintptr_t)irq9, 0x08, 0x8E);
+    idt_set_gate(42, (uint32_t)(uintptr_t)irq10, 0x08, 0x8E);
+    idt_set_gate(43, (uint32_t)(uintptr_t)irq11, 0x08, 0x8E);
+    idt_set_gate(44, (uint32_t)(uintptr_t)irq12, 0x08, 0x8E);
+    idt_set_gate(45, (uint32_t)(uintptr_t)irq13, 0x08, 0x8E);
+    idt_set_gate(46, (uint32_t)(uintptr_t)irq14, 0x08, 0x8E);
+    idt_set_gate(47, (uint32_t)(uintptr_t)irq15, 0x08, 0x8E);
 
     idt_flush((uint32_t)(uintptr_t)&idt_ptr);
 }
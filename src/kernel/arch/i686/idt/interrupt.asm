@@ -116,6 +116,25 @@ irq%1:
 IRQ 0, 32   ; irq0
 IRQ 1, 33   ; irq1
 
+; Остальные линии PIC: на них BIOS разводит INTx PCI-устройств
+; (virtio-blk, NVMe). IRQ2 - каскад, но заглушка не помешает
+IRQ 2, 34   ; irq2
+IRQ 3, 35   ; irq3
+IRQ 4, 36   ; irq4
+IRQ 5, 37   ; irq5
+IRQ 6, 38   ; irq6
+IRQ 7, 39   ; irq7
+IRQ 8, 40   ; irq8
+IRQ 9, 41   ; irq9
+IRQ 10, 42  ; irq10
+IRQ 11, 43  ; irq11
+IRQ 12, 44  ; irq12
+IRQ 13, 45  ; irq13
+
+; Контроллеры ATA (Primary и Secondary IDE)
+IRQ 14, 46  ; irq14
+IRQ 15, 47  ; irq15
+
 extern irq_handler
 
 irq_common_stub:
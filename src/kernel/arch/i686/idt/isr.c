@@ -2,6 +2,9 @@
 #include "../pic/pic.h"
 #include "../../../sys/panic.h"
 #include "../../../drivers/keyboard/keyboard.h"
+#include "../../../drivers/ata/ata.h"
+#include "../../../drivers/virtio/virtio_blk.h"
+#include "../../../drivers/nvme/nvme.h"
 
 
 extern void timer_handler(void);
@@ -52,7 +55,16 @@ void irq_handler(registers_t regs) {
         case IRQ_KEYBOARD:
             keyboard_handler();
             break;
+        case IRQ_ATA1:
+            ata_irq_handler(0);
+            break;
+        case IRQ_ATA2:
+            ata_irq_handler(1);
+            break;
         default:
+            // Линии PCI-устройств (virtio-blk и NVMe могут делить их с другими)
+            virtio_blk_irq_handler(irq_no);
+            nvme_irq_handler(irq_no);
             break;
     }
 
@@ -36,13 +36,14 @@ void pic_remap(int offset1, int offset2) {
 
 
     // Жестко задаем маски безопасности:
-    // Master PIC: 0xfc (11111100b) -> Разрешены только IRQ0 (таймер) и IRQ1 (клавиатура)
-    // Если в будущем понадобятся прерывания диска (IRQ14), надо будет записать 0xf8 (открыть еще и IRQ2 каскад)
-    outb(PIC1_DATA, 0xFC);
+    // Master PIC: 0xf8 (11111000b) -> Разрешены IRQ0 (таймер), IRQ1 (клавиатура)
+    // и IRQ2 (каскад), без которого не дойдут прерывания ведомого контроллера
+    outb(PIC1_DATA, 0xF8);
     io_wait();
 
-    // Slave PIC: 0xff (11111111b) -> Глушим вообще все прерывания на ведомом контроллере
-    outb(PIC2_DATA, 0xFF);
+    // Slave PIC: 0x3f (00111111b) -> Открыты только IRQ14 и IRQ15 (ATA),
+    // остальные прерывания на ведомом контроллере заглушены
+    outb(PIC2_DATA, 0x3F);
     io_wait();
 }
 
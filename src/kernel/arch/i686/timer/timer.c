@@ -5,6 +5,9 @@
 static volatile uint32_t timer_ticks = 0;
 static uint32_t system_frequency = 0;
 
+// Частота TSC в МГц; 0 - ещё не откалибрована, 0xFFFFFFFF - TSC нет
+static uint32_t tsc_mhz = 0;
+
 // Эта функция будет вызываться из нашего irq_handler при каждом IRQ0
 void timer_handler(void) {
     timer_ticks++;
@@ -31,12 +34,84 @@ uint32_t get_ticks(void) {
     return timer_ticks;
 }
 
+uint32_t get_timer_frequency(void) {
+    return system_frequency;
+}
+
 // Функция задержки в миллисекундах
 void sleep(uint32_t ms) {
     uint32_t ticks_to_wait = (ms * system_frequency) / 1000;
     uint32_t eticks = get_ticks() + ticks_to_wait;
 
     while(get_ticks() < eticks) {
+        timer_idle();
         __asm__ __volatile__("hlt"); // Теперь это будет работать идеально!
     }
 }
+
+// Отложенная работа, которой не место в обработчике IRQ0 (например, сброс
+// кэшей ФС на диск): её запускают циклы ожидания через timer_idle()
+static void (*idle_hook)(void) = 0;
+
+void timer_set_idle_hook(void (*hook)(void)) {
+    idle_hook = hook;
+}
+
+void timer_idle(void) {
+    if (idle_hook) idle_hook();
+}
+
+static int tsc_present(void) {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return (edx & (1 << 4)) != 0;
+}
+
+// Калибруем TSC по PIT один раз, при первом обращении
+static void tsc_calibrate(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+
+    if (!tsc_present() || system_frequency == 0 || !(flags & 0x200)) {
+        tsc_mhz = 0xFFFFFFFF;
+        return;
+    }
+
+    // Ждём фронт тика, затем меряем 5 тиков
+    uint32_t start = get_ticks();
+    while (get_ticks() == start) __asm__ volatile ("hlt");
+    start = get_ticks();
+    uint64_t t0 = rdtsc();
+    while (get_ticks() - start < 5) __asm__ volatile ("hlt");
+    uint64_t cycles = rdtsc() - t0;
+
+    // Тактов за тик / микросекунд в тике = МГц (50 мс влезают в 32 бита до ~85 ГГц)
+    uint32_t per_tick = (uint32_t)cycles / 5;
+    uint32_t mhz = per_tick / (1000000 / system_frequency);
+    tsc_mhz = mhz ? mhz : 0xFFFFFFFF;
+}
+
+uint64_t timer_stamp(void) {
+    if (tsc_mhz == 0) tsc_calibrate();
+    if (tsc_mhz == 0xFFFFFFFF) return get_ticks();
+    return rdtsc();
+}
+
+uint32_t timer_elapsed_us(uint64_t stamp) {
+    if (tsc_mhz == 0xFFFFFFFF || tsc_mhz == 0) {
+        return (get_ticks() - (uint32_t)stamp) * (1000000 / system_frequency);
+    }
+
+    uint64_t cycles = rdtsc() - stamp;
+    if (cycles >> 32) return 0xFFFFFFFF;
+    return (uint32_t)cycles / tsc_mhz;
+}
+
+// Без 64-битного деления (libgcc нет): сначала делим, если произведение не влезает
+uint32_t timer_per_second(uint32_t value, uint32_t ticks) {
+    uint32_t hz = system_frequency;
+    if (ticks == 0 || hz == 0) return 0;
+    if (value <= 0xFFFFFFFFu / hz) return value * hz / ticks;
+    value /= ticks;
+    return (value <= 0xFFFFFFFFu / hz) ? value * hz : 0xFFFFFFFFu;
+}
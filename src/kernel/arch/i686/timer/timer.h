@@ -10,5 +10,24 @@
 void init_timer(uint32_t frequency);
 void sleep(uint32_t ms);
 uint32_t get_ticks(void);
+uint32_t get_timer_frequency(void);
+
+// Хук для циклов ожидания: вызывается вне прерывания, можно делать I/O
+void timer_set_idle_hook(void (*hook)(void));
+void timer_idle(void);
+
+// Счётчик тактов процессора (TSC)
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Метка времени для timer_elapsed_us(): TSC, либо тики PIT, если TSC нет
+uint64_t timer_stamp(void);
+uint32_t timer_elapsed_us(uint64_t stamp);
+
+// value за ticks тиков PIT, пересчитанное в секунду, без переполнения 32 бит
+uint32_t timer_per_second(uint32_t value, uint32_t ticks);
 
 #endif
@@ -21,6 +21,15 @@ void uptime_cmd();
 void meminfo_cmd();
 void cmd_history();
 void cmd_disks();
+void cmd_diskbench(const char* args);
+void cmd_ramdisk(const char* args);
+void cmd_mkfs(const char* args);
+void cmd_sync(void);
+void cmd_df(void);
+void cmd_bcstat(const char* args);
+void cmd_iostat(const char* args);
+void cmd_blkcopy(const char* args);
+void cmd_blkpoll(const char* args);
 void cmd_fatwrite();
 void cmd_crash();
 void cmd_mkrootfs(const char* args);
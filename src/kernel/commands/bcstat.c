@@ -0,0 +1,39 @@
+#include "all_commands.h"
+#include "../drivers/block/bcache.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../utils/string.h"
+
+static void print_stat(const char* label, uint32_t value) {
+    char buf[16];
+    vga_print_color(label, 0x0F);
+    itoa((int)value, buf, 10);
+    vga_print_color(buf, 0x0A);
+    vga_putc('\n');
+}
+
+/* bcstat [reset] - show buffer cache counters */
+void cmd_bcstat(const char* args) {
+    if (args && strcmp(args, "reset") == 0) {
+        bcache_reset_stats();
+        vga_print_color("Counters reset\n", 0x0A);
+        return;
+    }
+
+    bcache_stats_t st;
+    bcache_get_stats(&st);
+
+    vga_print_color("=== Buffer Cache ===\n", YELLOW);
+    print_stat("Blocks:     ", BCACHE_BLOCKS);
+    print_stat("In use:     ", st.used);
+    print_stat("Dirty:      ", st.dirty);
+    print_stat("Hits:       ", st.hits);
+    print_stat("Misses:     ", st.misses);
+    print_stat("Evictions:  ", st.evictions);
+    print_stat("Writebacks: ", st.writebacks);
+
+    uint32_t total = st.hits + st.misses;
+    if (total) {
+        print_stat("Hit rate %: ", (st.hits / total) * 100 + ((st.hits % total) * 100) / total);
+    }
+}
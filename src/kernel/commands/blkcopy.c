@@ -0,0 +1,159 @@
+#include "all_commands.h"
+#include "../drivers/block/blkdev.h"
+#include "../drivers/block/bcache.h"
+#include "../fs/fat/fat.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../arch/i686/timer/timer.h"
+#include "../utils/string.h"
+
+#define BLKCOPY_CHUNK_SECTORS   256
+
+/* Two buffers: one is being written to dst while the next chunk is read into the other */
+static uint8_t copy_buf[2][BLKCOPY_CHUNK_SECTORS * 512] __attribute__((aligned(4096)));
+
+/* Pull the next space-separated word out of *args */
+static const char* next_word(const char** args, char* out, int size) {
+    const char* p = *args;
+    while (*p == ' ') p++;
+    int i = 0;
+    while (*p && *p != ' ' && i < size - 1) out[i++] = *p++;
+    out[i] = '\0';
+    *args = p;
+    return i ? out : NULL;
+}
+
+static void print_num(uint32_t value, uint8_t color) {
+    char buf[16];
+    itoa((int)value, buf, 10);
+    vga_print_color(buf, color);
+}
+
+/* blkcopy <src> <dst> [start] [count] - copy a sector range between block devices */
+void cmd_blkcopy(const char* args) {
+    char src_name[BLKDEV_NAME_LEN], dst_name[BLKDEV_NAME_LEN], num[16];
+
+    if (!args || !next_word(&args, src_name, sizeof(src_name)) ||
+        !next_word(&args, dst_name, sizeof(dst_name))) {
+        vga_print_color("Usage: blkcopy <src> <dst> [start] [count]\n", LIGHT_RED);
+        return;
+    }
+
+    blkdev_init();
+    blkdev_t* src = blkdev_find(src_name);
+    blkdev_t* dst = blkdev_find(dst_name);
+    if (!src || !dst) {
+        vga_print_color("Drive not found\n", LIGHT_RED);
+        return;
+    }
+    if (src == dst) {
+        vga_print_color("Source and destination must differ\n", LIGHT_RED);
+        return;
+    }
+    if (src->sector_size != dst->sector_size || src->sector_size > 512) {
+        vga_print_color("Sector sizes must match (512 bytes)\n", LIGHT_RED);
+        return;
+    }
+    if (fat_is_mounted() && fat_get_device() == dst) {
+        vga_print_color("Destination is mounted; umount it first\n", LIGHT_RED);
+        return;
+    }
+
+    /* Without a count, copy from start to the end of the smaller device */
+    uint64_t end = (src->sector_count < dst->sector_count) ? src->sector_count : dst->sector_count;
+    uint64_t start = 0;
+    if (next_word(&args, num, sizeof(num))) start = (uint32_t)atoi(num);
+    if (start >= end) {
+        vga_print_color("Start is past the end of the device\n", LIGHT_RED);
+        return;
+    }
+    uint64_t count = end - start;
+    if (next_word(&args, num, sizeof(num))) count = (uint32_t)atoi(num);
+    if (start + count > end) {
+        vga_print_color("Range exceeds device size\n", LIGHT_RED);
+        return;
+    }
+    if (count == 0) return;
+
+    uint32_t chunk = BLKCOPY_CHUNK_SECTORS;
+    if (src->max_transfer && chunk > src->max_transfer) chunk = src->max_transfer;
+    if (dst->max_transfer && chunk > dst->max_transfer) chunk = dst->max_transfer;
+
+    /*
+     * Push dirty cached blocks of src out first, and drop stale ones of dst
+     * afterwards. A mounted src also holds staged files and FAT sectors
+     * outside the buffer cache; flush those so the copy is consistent.
+     */
+    if (fat_is_mounted() && fat_get_device() == src && fat_flush() < 0) {
+        vga_print_color("Could not flush the mounted source\n", LIGHT_RED);
+        return;
+    }
+    if (bcache_sync(src) < 0) {
+        vga_print_color("Could not write back cached blocks of the source\n", LIGHT_RED);
+        return;
+    }
+
+    vga_print_color("Copying ", YELLOW);
+    print_num((uint32_t)count, YELLOW);
+    vga_print_color(" sectors ", YELLOW);
+    vga_print_color(src->name, YELLOW);
+    vga_print_color(" -> ", YELLOW);
+    vga_print_color(dst->name, YELLOW);
+    vga_putc('\n');
+
+    uint32_t t0 = get_ticks();
+    int failed = 0;
+
+    uint32_t n = (count < chunk) ? (uint32_t)count : chunk;
+    if (blkdev_start(src, start, n, copy_buf[0], 0) < 0 || blkdev_finish(src) < 0) {
+        failed = 1;
+    }
+
+    uint64_t done = 0;
+    int cur = 0;
+    while (!failed && done < count) {
+        n = (count - done < chunk) ? (uint32_t)(count - done) : chunk;
+        uint64_t next = done + n;
+
+        if (blkdev_start(dst, start + done, n, copy_buf[cur], 1) < 0) {
+            failed = 1;
+            break;
+        }
+
+        /* Read the following chunk while the write is in flight */
+        int reading = 0;
+        if (next < count) {
+            uint32_t nn = (count - next < chunk) ? (uint32_t)(count - next) : chunk;
+            if (blkdev_start(src, start + next, nn, copy_buf[cur ^ 1], 0) == 0) reading = 1;
+            else failed = 1;
+        }
+
+        if (reading && blkdev_finish(src) < 0) failed = 1;
+        if (blkdev_finish(dst) < 0) failed = 1;
+
+        done = next;
+        cur ^= 1;
+    }
+
+    blkdev_flush(dst);
+    bcache_invalidate(dst);
+
+    if (failed) {
+        vga_print_color("I/O error after ", LIGHT_RED);
+        print_num((uint32_t)done, LIGHT_RED);
+        vga_print_color(" sectors\n", LIGHT_RED);
+        return;
+    }
+
+    uint32_t ticks = get_ticks() - t0;
+    if (ticks == 0) ticks = 1;
+    uint32_t hz = get_timer_frequency();
+    uint32_t kb = (uint32_t)(count >> 1);
+
+    print_num(kb, 0x0A);
+    vga_print_color(" KB in ", 0x0A);
+    print_num(ticks * 1000 / hz, 0x0A);
+    vga_print_color(" ms, ", 0x0A);
+    print_num((kb <= 0xFFFFFFFFu / hz) ? kb * hz / ticks : kb / ticks * hz, 0x0A);
+    vga_print_color(" KB/s\n", 0x0A);
+}
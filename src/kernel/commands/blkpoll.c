@@ -0,0 +1,46 @@
+#include "all_commands.h"
+#include "../drivers/block/blkdev.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../utils/string.h"
+
+/*
+ * blkpoll <dev> on|off - spin on the completion ring for the lowest latency,
+ * or sleep with hlt until the device raises its IRQ
+ */
+void cmd_blkpoll(const char* args) {
+    char name[BLKDEV_NAME_LEN];
+    int i = 0;
+
+    while (args && *args == ' ') args++;
+    while (args && *args && *args != ' ' && i < BLKDEV_NAME_LEN - 1) name[i++] = *args++;
+    name[i] = '\0';
+    while (args && *args == ' ') args++;
+
+    int polling;
+    if (i > 0 && args && strcmp(args, "on") == 0) polling = 1;
+    else if (i > 0 && args && strcmp(args, "off") == 0) polling = 0;
+    else {
+        vga_print_color("Usage: blkpoll <dev> on|off\n", LIGHT_RED);
+        return;
+    }
+
+    blkdev_init();
+    blkdev_t* dev = blkdev_find(name);
+    if (!dev) {
+        vga_print_color("Drive not found\n", LIGHT_RED);
+        return;
+    }
+    if (!dev->ops->set_polling) {
+        vga_print_color("Device has no polling mode\n", LIGHT_RED);
+        return;
+    }
+    if (blkdev_set_polling(dev, polling) < 0) {
+        vga_print_color(polling ? "Could not switch to polling\n"
+                                : "Device has no usable IRQ line\n", LIGHT_RED);
+        return;
+    }
+
+    vga_print_color(dev->name, 0x0A);
+    vga_print_color(polling ? ": polling for completions\n" : ": completions by IRQ\n", 0x0A);
+}
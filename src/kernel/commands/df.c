@@ -0,0 +1,40 @@
+#include "all_commands.h"
+#include "../fs/fat/fat.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../utils/string.h"
+
+/* df - size, used and free space of the mounted FAT volume */
+void cmd_df(void) {
+    if (!fat_is_mounted()) {
+        vga_print_color("No filesystem mounted\n", LIGHT_RED);
+        return;
+    }
+
+    uint32_t total = fat_total_space();
+    uint32_t free = fat_free_space();
+    uint32_t used = total - free;
+    char buf[16];
+
+    vga_print_color("Device   Type    Size KB    Used KB    Free KB  Use%\n", YELLOW);
+
+    vga_print_color(fat_get_device()->name, 0x0F);
+    for (int i = strlen(fat_get_device()->name); i < 9; i++) vga_putc(' ');
+    vga_print_color(fat_get_type_str(), 0x0F);
+    for (int i = strlen(fat_get_type_str()); i < 6; i++) vga_putc(' ');
+
+    uint32_t values[3] = { total, used, free };
+    for (int v = 0; v < 3; v++) {
+        itoa((int)values[v], buf, 10);
+        for (int i = strlen(buf); i < 11; i++) vga_putc(' ');
+        vga_print(buf);
+    }
+
+    /* Percent without overflowing on multi-GB volumes */
+    uint32_t pct = total ? (used / (total / 100 ? total / 100 : 1)) : 0;
+    if (pct > 100) pct = 100;
+    itoa((int)pct, buf, 10);
+    for (int i = strlen(buf); i < 5; i++) vga_putc(' ');
+    vga_print(buf);
+    vga_print("%\n");
+}
@@ -0,0 +1,100 @@
+#include "all_commands.h"
+#include "../drivers/ata/ata.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../arch/i686/timer/timer.h"
+#include "../utils/string.h"
+
+#define BENCH_CHUNK_SECTORS 128
+
+static uint8_t bench_buf[BENCH_CHUNK_SECTORS * ATA_SECTOR_SIZE] __attribute__((aligned(4)));
+
+/* Read `total` sectors from LBA 0 and return elapsed PIT ticks, -1 on error */
+static int bench_read(uint8_t drive, uint32_t total) {
+    uint32_t start = get_ticks();
+    /* Align to a tick edge so the measurement is not off by a whole tick */
+    while (get_ticks() == start) __asm__ volatile ("hlt");
+    start = get_ticks();
+
+    for (uint32_t done = 0; done < total; done += BENCH_CHUNK_SECTORS) {
+        uint32_t n = total - done;
+        if (n > BENCH_CHUNK_SECTORS) n = BENCH_CHUNK_SECTORS;
+        if (ata_read_sectors(drive, done, n, bench_buf) < 0) return -1;
+    }
+
+    return (int)(get_ticks() - start);
+}
+
+static void bench_report(const char* label, uint32_t total, int ticks) {
+    char buf[16];
+
+    vga_print_color(label, 0x0F);
+    if (ticks < 0) {
+        vga_print_color("read error\n", LIGHT_RED);
+        return;
+    }
+    if (ticks == 0) ticks = 1;
+
+    uint32_t rate = timer_per_second(total, (uint32_t)ticks);
+    itoa((int)rate, buf, 10);
+    vga_print_color(buf, 0x0A);
+    vga_print_color(" sectors/s  (", 0x08);
+    itoa(ticks, buf, 10);
+    vga_print(buf);
+    vga_print_color(" ticks)\n", 0x08);
+}
+
+/* diskbench [drive] [sectors] - compare PIO data-port methods (and DMA) */
+void cmd_diskbench(const char* args) {
+    uint8_t drive = 0;
+    uint32_t total = 4096;
+
+    if (args && args[0]) {
+        drive = (uint8_t)(args[0] - '0');
+        const char* rest = strchr(args, ' ');
+        if (rest) {
+            int n = atoi(rest + 1);
+            if (n > 0) total = (uint32_t)n;
+        }
+    }
+
+    ata_init();
+    ata_device_t* dev = ata_get_device(drive);
+    if (!dev) {
+        vga_print_color("Drive not found\n", LIGHT_RED);
+        return;
+    }
+    if (total > dev->size) total = (uint32_t)dev->size;
+
+    char buf[16];
+    vga_print_color("Reading ", YELLOW);
+    itoa((int)total, buf, 10);
+    vga_print_color(buf, YELLOW);
+    vga_print_color(" sectors from drive ", YELLOW);
+    itoa(drive, buf, 10);
+    vga_print_color(buf, YELLOW);
+    vga_putc('\n');
+
+    uint8_t saved_dma = dev->dma;
+    uint8_t saved_mode = dev->pio_mode;
+    dev->dma = 0;
+
+    ata_set_pio_mode(drive, ATA_PIO_WORD);
+    bench_report("  PIO inw loop:   ", total, bench_read(drive, total));
+
+    ata_set_pio_mode(drive, ATA_PIO_STRING16);
+    bench_report("  PIO rep insw:   ", total, bench_read(drive, total));
+
+    if (ata_set_pio_mode(drive, ATA_PIO_STRING32) == 0) {
+        bench_report("  PIO rep insl:   ", total, bench_read(drive, total));
+    } else {
+        vga_print_color("  PIO rep insl:   not supported by controller\n", 0x08);
+    }
+
+    dev->pio_mode = saved_mode;
+    dev->dma = saved_dma;
+
+    if (dev->dma) {
+        bench_report("  Bus master DMA: ", total, bench_read(drive, total));
+    }
+}
@@ -118,20 +118,45 @@ static int execute_cmd_nano(char* args) {
 
 // Команды диска и FAT
 static int execute_cmd_disks(char* args)    { (void)args; cmd_disks(); return 0; }
-static int execute_cmd_umount(char* args)   { (void)args; fat_unmount(); vga_print_color("Unmounted\n", 0x0A); return 0; }
+static int execute_cmd_diskbench(char* args) { cmd_diskbench(args); return 0; }
+static int execute_cmd_umount(char* args) {
+    (void)args;
+    if (fat_unmount() < 0) vga_print_color("Unmounted, but some data could not be written\n", LIGHT_RED);
+    else vga_print_color("Unmounted\n", 0x0A);
+    return 0;
+}
 static int execute_cmd_fatls(char* args)    { fat_ls(args[0] ? args : NULL); return 0; }
 static int execute_cmd_fatpwd(char* args)   { (void)args; fat_pwd(); return 0; }
 static int execute_cmd_fatwrite(char* args) { (void)args; cmd_fatwrite(); return 0; }
 static int execute_cmd_fatinfo(char* args)  { (void)args; fat_info(); return 0; }
 static int execute_cmd_fat(char* args)      { (void)args; fat_shell(); return 0; }
 
+static int execute_cmd_ramdisk(char* args) { cmd_ramdisk(args); return 0; }
+static int execute_cmd_mkfs(char* args)    { cmd_mkfs(args); return 0; }
+static int execute_cmd_sync(char* args)    { (void)args; cmd_sync(); return 0; }
+static int execute_cmd_df(char* args)      { (void)args; cmd_df(); return 0; }
+static int execute_cmd_bcstat(char* args)  { cmd_bcstat(args); return 0; }
+static int execute_cmd_iostat(char* args)  { cmd_iostat(args); return 0; }
+static int execute_cmd_blkcopy(char* args) { cmd_blkcopy(args); return 0; }
+static int execute_cmd_blkpoll(char* args) { cmd_blkpoll(args); return 0; }
+
+// mount [dev] [wb] - wb включает write-back режим FAT
 static int execute_cmd_mount(char* args) {
-    int drive = 0;
-    if (args[0]) drive = args[0] - '0';
-    if (fat_mount(drive) == 0) {
+    char* opt = strchr(args, ' ');
+    if (opt) {
+        *opt++ = '\0';
+        while (*opt == ' ') opt++;
+    }
+
+    blkdev_init();
+    if (fat_mount(blkdev_find(args[0] ? args : "hd0")) == 0) {
         vga_print_color("Mounted ", 0x0A);
         vga_print_color(fat_get_type_str(), YELLOW);
-        vga_print_color(" filesystem\n", 0x0A);
+        vga_print_color(" filesystem", 0x0A);
+        if (opt && strcmp(opt, "wb") == 0 && fat_set_writeback(1) == 0) {
+            vga_print_color(" (write-back)", 0x0A);
+        }
+        vga_putc('\n');
     }
     return 0;
 }
@@ -242,6 +267,15 @@ static const command_t commands[] = {
 
     // Диски и FAT
     {"disks",       execute_cmd_disks},
+    {"diskbench",   execute_cmd_diskbench},
+    {"ramdisk",     execute_cmd_ramdisk},
+    {"mkfs",        execute_cmd_mkfs},
+    {"sync",        execute_cmd_sync},
+    {"df",          execute_cmd_df},
+    {"bcstat",      execute_cmd_bcstat},
+    {"iostat",      execute_cmd_iostat},
+    {"blkcopy",     execute_cmd_blkcopy},
+    {"blkpoll",     execute_cmd_blkpoll},
     {"mount",       execute_cmd_mount},
     {"umount",      execute_cmd_umount},
     {"fatls",       execute_cmd_fatls},
@@ -40,7 +40,7 @@ const struct { const char* cmd; const char* desc; } help_table[] = {
     {"panic", "Trigger kernel panic"},
     {"fm", "Launch file manager"},
     {"screensaver", "Launch screensaver"},
-    {"mount", "Mount FAT disk (mount 0)"},
+    {"mount", "Mount FAT disk (mount 0, mount ram0 wb)"},
     {"umount", "Unmount FAT disk"},
     {"fatls", "List FAT directory"},
     {"fatcd", "Change FAT directory"},
@@ -52,6 +52,15 @@ const struct { const char* cmd; const char* desc; } help_table[] = {
     {"fatwrite", "Write to FAT file"},
     {"fatinfo", "Show FAT info"},
     {"disks", "Show detected disks"},
+    {"diskbench", "Disk read speed: diskbench [drive] [sectors]"},
+    {"ramdisk", "Create RAM disk ram0: ramdisk [KB]"},
+    {"mkfs", "Format FAT volume: mkfs <dev> [label]"},
+    {"sync", "Flush FAT write-back data and cached disk blocks"},
+    {"df", "Free space on the mounted FAT volume"},
+    {"bcstat", "Buffer cache stats: bcstat [reset]"},
+    {"iostat", "Disk I/O since last call: iostat [reset]"},
+    {"blkcopy", "Copy sectors: blkcopy <src> <dst> [start] [count]"},
+    {"blkpoll", "Poll for completions or use the IRQ: blkpoll <dev> on|off"},
     {"fat", "Enter FAT shell mode"},
     {"mkrootfs", "Create folders and files on a disk"},
     {"pci", "Scaning bus"},
@@ -0,0 +1,107 @@
+#include "all_commands.h"
+#include "../drivers/block/blkdev.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../arch/i686/timer/timer.h"
+#include "../utils/string.h"
+
+/* Counters at the previous 'iostat', so each call reports the interval since then */
+static blkdev_stats_t last[BLKDEV_MAX];
+static uint32_t last_ticks = 0;
+
+static void print_num(uint32_t value, uint8_t color) {
+    char buf[16];
+    itoa((int)value, buf, 10);
+    vga_print_color(buf, color);
+}
+
+static void print_histogram(const blkdev_stats_t* st) {
+    vga_print_color("    latency:", 0x08);
+    for (int b = 0; b < BLKDEV_LAT_BUCKETS; b++) {
+        if (!st->lat_hist[b]) continue;
+        vga_print_color(" <", 0x08);
+        if (b == BLKDEV_LAT_BUCKETS - 1) {
+            vga_print_color("inf", 0x08);
+        } else {
+            uint32_t limit = 32u << b;
+            if (limit >= 1024) {
+                print_num(limit >> 10, 0x08);
+                vga_print_color("ms", 0x08);
+            } else {
+                print_num(limit, 0x08);
+                vga_print_color("us", 0x08);
+            }
+        }
+        vga_putc(':');
+        print_num(st->lat_hist[b], 0x0F);
+    }
+    vga_putc('\n');
+}
+
+/* iostat [reset] - per-device I/O since the previous call, plus latency histograms */
+void cmd_iostat(const char* args) {
+    blkdev_init();
+
+    uint32_t now = get_ticks();
+    uint32_t ticks = now - last_ticks;
+
+    if (args && strcmp(args, "reset") == 0) {
+        for (int i = 0; i < blkdev_count(); i++) {
+            blkdev_t* dev = blkdev_get((uint8_t)i);
+            if (dev->stats) memset(dev->stats, 0, sizeof(blkdev_stats_t));
+            memset(&last[i], 0, sizeof(blkdev_stats_t));
+        }
+        last_ticks = now;
+        vga_print_color("Counters reset\n", 0x0A);
+        return;
+    }
+
+    vga_print_color("Interval: ", YELLOW);
+    print_num(ticks * 1000 / (get_timer_frequency() ? get_timer_frequency() : 1), YELLOW);
+    vga_print_color(" ms\n", YELLOW);
+    vga_print_color("dev      r/s    w/s    rKB/s  wKB/s  avg_us max_us flush err tmo\n", 0x0F);
+
+    for (int i = 0; i < blkdev_count(); i++) {
+        blkdev_t* dev = blkdev_get((uint8_t)i);
+        if (!dev->stats) continue;
+
+        blkdev_stats_t* st = dev->stats;
+        blkdev_stats_t* prev = &last[i];
+
+        uint32_t r = st->read_ops - prev->read_ops;
+        uint32_t w = st->write_ops - prev->write_ops;
+        uint32_t rkb = (st->read_sectors - prev->read_sectors) * (dev->sector_size / 512) / 2;
+        uint32_t wkb = (st->write_sectors - prev->write_sectors) * (dev->sector_size / 512) / 2;
+        uint32_t ops = r + w + (st->flushes - prev->flushes);
+        uint32_t busy = st->busy_us - prev->busy_us;
+
+        uint32_t cols[] = {
+            timer_per_second(r, ticks), timer_per_second(w, ticks),
+            timer_per_second(rkb, ticks), timer_per_second(wkb, ticks),
+            ops ? busy / ops : 0, st->max_us,
+            st->flushes - prev->flushes, st->errors - prev->errors, st->timeouts - prev->timeouts,
+        };
+        const uint8_t widths[] = { 7, 7, 7, 7, 7, 7, 6, 4, 4 };
+
+        vga_print_color(dev->name, YELLOW);
+        for (int c = (int)strlen(dev->name); c < 6; c++) vga_putc(' ');
+
+        for (int c = 0; c < (int)(sizeof(cols) / sizeof(cols[0])); c++) {
+            char buf[16];
+            itoa((int)cols[c], buf, 10);
+            for (int pad = (int)strlen(buf); pad < widths[c]; pad++) vga_putc(' ');
+            vga_print_color(buf, 0x0A);
+        }
+        vga_putc('\n');
+
+        /* Every column covers the interval: histogram as a delta, max by restarting it */
+        blkdev_stats_t delta;
+        for (int b = 0; b < BLKDEV_LAT_BUCKETS; b++) delta.lat_hist[b] = st->lat_hist[b] - prev->lat_hist[b];
+        print_histogram(&delta);
+
+        st->max_us = 0;
+        memcpy(prev, st, sizeof(blkdev_stats_t));
+    }
+
+    last_ticks = now;
+}
@@ -0,0 +1,38 @@
+#include "all_commands.h"
+#include "../drivers/block/blkdev.h"
+#include "../fs/fat/fat.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../utils/string.h"
+
+/* mkfs <dev> [label] - write an empty FAT12/FAT16 volume */
+void cmd_mkfs(const char* args) {
+    if (!args || !args[0]) {
+        vga_print_color("Usage: mkfs <dev> [label]\n", LIGHT_RED);
+        return;
+    }
+
+    char name[BLKDEV_NAME_LEN];
+    int i = 0;
+    while (args[i] && args[i] != ' ' && i < BLKDEV_NAME_LEN - 1) {
+        name[i] = args[i];
+        i++;
+    }
+    name[i] = '\0';
+
+    const char* label = strchr(args, ' ');
+    if (label) label++;
+
+    blkdev_init();
+    blkdev_t* dev = blkdev_find(name);
+    if (!dev) {
+        vga_print_color("Drive not found\n", LIGHT_RED);
+        return;
+    }
+
+    if (fat_format(dev, label) == 0) {
+        vga_print_color("Formatted ", 0x0A);
+        vga_print_color(dev->name, YELLOW);
+        vga_putc('\n');
+    }
+}
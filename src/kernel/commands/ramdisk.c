@@ -0,0 +1,32 @@
+#include "all_commands.h"
+#include "../drivers/block/ramdisk.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../utils/string.h"
+
+/* ramdisk [KB] - create ram0 (the size is fixed once created) */
+void cmd_ramdisk(const char* args) {
+    uint32_t size = RAMDISK_DEFAULT_SIZE;
+
+    if (args && args[0]) {
+        int kb = atoi(args);
+        if (kb <= 0) {
+            vga_print_color("Usage: ramdisk [KB]\n", LIGHT_RED);
+            return;
+        }
+        size = (uint32_t)kb * 1024;
+    }
+
+    blkdev_t* dev = ramdisk_create(size);
+    if (!dev) {
+        vga_print_color("Failed to create RAM disk\n", LIGHT_RED);
+        return;
+    }
+
+    char buf[16];
+    vga_print_color(dev->name, YELLOW);
+    vga_print_color(": ", 0x0F);
+    itoa((int)(dev->sector_count >> 1), buf, 10);
+    vga_print_color(buf, 0x0A);
+    vga_print_color(" KB\n", 0x0A);
+}
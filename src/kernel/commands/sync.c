@@ -0,0 +1,27 @@
+#include "all_commands.h"
+#include "../drivers/block/bcache.h"
+#include "../fs/fat/fat.h"
+#include "../drivers/vga/vga.h"
+#include "../drivers/vga/colors.h"
+#include "../utils/string.h"
+
+/* sync - flush FAT write-back state, then every dirty cached block, and flush the drives */
+void cmd_sync(void) {
+    bcache_stats_t st;
+    bcache_get_stats(&st);
+    uint32_t before = st.writebacks;
+
+    int result = 0;
+    if (fat_is_mounted() && fat_flush() < 0) result = -1;
+    if (bcache_sync(NULL) < 0) result = -1;
+
+    bcache_get_stats(&st);
+    char buf[16];
+    itoa((int)(st.writebacks - before), buf, 10);
+    vga_print_color(buf, 0x0A);
+    vga_print_color(" blocks written\n", 0x0A);
+
+    if (result < 0) {
+        vga_print_color("Some blocks could not be written\n", LIGHT_RED);
+    }
+}
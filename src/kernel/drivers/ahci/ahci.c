@@ -0,0 +1,516 @@
+#include "ahci.h"
+#include "../pci/pci.h"
+#include "../../utils/string.h"
+#include "../../arch/i686/timer/timer.h"
+
+/* Command timeout; measured in PIT ticks like the IDE driver */
+#define AHCI_TIMEOUT_MS     3000
+/* Spin cap used only when interrupts are off and the PIT cannot tick */
+#define AHCI_SPIN_LIMIT     10000000
+
+typedef struct __attribute__((packed)) {
+    uint32_t            flags;      /* CFL, W, C, ..., PRDTL in bits 31:16 */
+    volatile uint32_t   prdbc;      /* Bytes transferred, written by the HBA */
+    uint32_t            ctba;
+    uint32_t            ctbau;
+    uint32_t            reserved[4];
+} ahci_cmd_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t    dba;
+    uint32_t    dbau;
+    uint32_t    reserved;
+    uint32_t    dbc;                /* Byte count - 1 (bit 0 always set) */
+} ahci_prd_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t     cfis[64];
+    uint8_t     acmd[16];
+    uint8_t     reserved[48];
+    ahci_prd_t  prdt[AHCI_PRDT_ENTRIES];
+} ahci_cmd_table_t;
+
+/*
+ * Per-port DMA structures: command list 1K aligned, FIS area 256 aligned,
+ * tables 128 aligned. The block is padded to 1K so every port's list is too.
+ */
+typedef struct {
+    ahci_cmd_header_t   headers[AHCI_SLOTS];
+    uint8_t             fis[256];
+    ahci_cmd_table_t    tables[AHCI_SLOTS];
+} __attribute__((aligned(1024))) ahci_port_mem_t;
+
+_Static_assert(sizeof(ahci_port_mem_t) % 1024 == 0, "PxCLB needs every command list 1K aligned");
+
+/* What a slot is doing, so completions can be accounted */
+typedef struct {
+    int8_t      write;              /* 1 write, 0 read, -1 not accounted here */
+    uint32_t    sectors;
+    uint64_t    start;
+} ahci_slot_t;
+
+typedef struct {
+    ahci_device_t   info;
+    uint32_t        busy;           /* Slots issued and not yet reaped */
+    uint32_t        failed;         /* Reaped slots that completed with an error */
+    uint32_t        async;          /* Slots owned by blkdev_start() */
+    ahci_slot_t     slots[AHCI_SLOTS];
+} ahci_port_t;
+
+static ahci_port_mem_t ahci_mem[AHCI_MAX_DEVICES];
+static ahci_port_t ahci_ports[AHCI_MAX_DEVICES];
+static int ahci_count = 0;
+static int ahci_initialized = 0;
+
+static uintptr_t ahci_abar = 0;
+static uint32_t ahci_cmd_slots = 1;     /* CAP.NCS + 1 */
+
+static uint8_t identify_buf[512] __attribute__((aligned(4)));
+
+static uint32_t reg_read(uint32_t offset) {
+    return *(volatile uint32_t*)(ahci_abar + offset);
+}
+
+static void reg_write(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(ahci_abar + offset) = value;
+}
+
+static uint32_t port_read(ahci_port_t* p, uint32_t reg) {
+    return reg_read(AHCI_PORT_BASE + p->info.port * AHCI_PORT_SIZE + reg);
+}
+
+static void port_write(ahci_port_t* p, uint32_t reg, uint32_t value) {
+    reg_write(AHCI_PORT_BASE + p->info.port * AHCI_PORT_SIZE + reg, value);
+}
+
+static int ahci_interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+static uint32_t ahci_deadline(void) {
+    return get_ticks() + (AHCI_TIMEOUT_MS * get_timer_frequency()) / 1000 + 1;
+}
+
+static int ahci_expired(uint32_t deadline, uint32_t* spins) {
+    if ((int32_t)(get_ticks() - deadline) >= 0) return 1;
+    if (!ahci_interrupts_enabled() && ++(*spins) > AHCI_SPIN_LIMIT) return 1;
+    return 0;
+}
+
+/* Wait until (reg & mask) == 0 */
+static int port_wait_clear(ahci_port_t* p, uint32_t reg, uint32_t mask) {
+    uint32_t deadline = ahci_deadline();
+    uint32_t spins = 0;
+    while (port_read(p, reg) & mask) {
+        if (ahci_expired(deadline, &spins)) return -1;
+    }
+    return 0;
+}
+
+static int ahci_port_stop(ahci_port_t* p) {
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    if (port_wait_clear(p, AHCI_PxCMD, AHCI_PxCMD_CR) < 0) return -1;
+
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    return port_wait_clear(p, AHCI_PxCMD, AHCI_PxCMD_FR);
+}
+
+static int ahci_port_start(ahci_port_t* p) {
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+
+    /* The device must be idle before the command list engine starts */
+    if (port_wait_clear(p, AHCI_PxTFD, 0x88) < 0) return -1;   /* BSY | DRQ */
+
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_ST);
+    return 0;
+}
+
+static int ahci_port_setup(ahci_port_t* p, ahci_port_mem_t* mem) {
+    if (ahci_port_stop(p) < 0) return -1;
+
+    memset(mem, 0, sizeof(ahci_port_mem_t));
+    for (int i = 0; i < AHCI_SLOTS; i++) {
+        mem->headers[i].ctba = (uint32_t)(uintptr_t)&mem->tables[i];
+        mem->headers[i].ctbau = 0;
+    }
+
+    port_write(p, AHCI_PxCLB, (uint32_t)(uintptr_t)mem->headers);
+    port_write(p, AHCI_PxCLBU, 0);
+    port_write(p, AHCI_PxFB, (uint32_t)(uintptr_t)mem->fis);
+    port_write(p, AHCI_PxFBU, 0);
+
+    /* Completion is polled from PxCI/PxSACT; no port interrupts */
+    port_write(p, AHCI_PxIE, 0);
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_SUD | AHCI_PxCMD_POD);
+    return ahci_port_start(p);
+}
+
+/* After a task file error the port stops; clear the error and restart it */
+static void ahci_port_recover(ahci_port_t* p) {
+    ahci_port_stop(p);
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    ahci_port_start(p);
+}
+
+static uint32_t ahci_active(ahci_port_t* p) {
+    uint32_t active = port_read(p, AHCI_PxCI);
+    if (p->info.ncq) active |= port_read(p, AHCI_PxSACT);
+    return active;
+}
+
+static void ahci_complete_slot(ahci_port_t* p, int slot, int result, int timed_out) {
+    ahci_slot_t* s = &p->slots[slot];
+    uint32_t bit = 1u << slot;
+
+    if (s->write >= 0) {
+        blkdev_account(&p->info.stats, s->write, s->sectors, timer_elapsed_us(s->start), result);
+    }
+    if (timed_out) p->info.stats.timeouts++;
+
+    p->busy &= ~bit;
+    if (result < 0) p->failed |= bit;
+    else p->failed &= ~bit;
+}
+
+/*
+ * Retire slots the HBA has finished. A task file error aborts everything in
+ * flight (NCQ has no per-command error status without READ LOG EXT), so all
+ * outstanding slots fail and the port is restarted.
+ */
+static void ahci_reap(ahci_port_t* p) {
+    uint32_t is = port_read(p, AHCI_PxIS);
+
+    if (is & AHCI_PxIS_ERRORS) {
+        for (int i = 0; i < AHCI_SLOTS; i++) {
+            if (p->busy & (1u << i)) ahci_complete_slot(p, i, -1, 0);
+        }
+        ahci_port_recover(p);
+        return;
+    }
+
+    uint32_t done = p->busy & ~ahci_active(p);
+    for (int i = 0; done; i++) {
+        if (done & (1u << i)) {
+            ahci_complete_slot(p, i, 0, 0);
+            done &= ~(1u << i);
+        }
+    }
+}
+
+/* Poll until no slot in mask is outstanding, failing everything on timeout */
+static void ahci_drain(ahci_port_t* p, uint32_t mask) {
+    uint32_t deadline = ahci_deadline();
+    uint32_t spins = 0;
+
+    ahci_reap(p);
+    while (p->busy & mask) {
+        if (ahci_expired(deadline, &spins)) {
+            for (int i = 0; i < AHCI_SLOTS; i++) {
+                if (p->busy & (1u << i)) ahci_complete_slot(p, i, -1, 1);
+            }
+            ahci_port_recover(p);
+            return;
+        }
+        ahci_reap(p);
+    }
+}
+
+/* Wait for every slot in mask; returns -1 if any of them failed */
+static int ahci_wait(ahci_port_t* p, uint32_t mask) {
+    ahci_drain(p, mask);
+
+    int result = (p->failed & mask) ? -1 : 0;
+    p->failed &= ~mask;
+    return result;
+}
+
+/*
+ * Pick a free slot. Non-queued commands need the port to themselves; the
+ * failure bits of anything drained here stay set for their owner's wait.
+ */
+static int ahci_alloc_slot(ahci_port_t* p, int queued) {
+    if (!queued || !p->info.ncq) ahci_drain(p, p->busy);
+
+    while (1) {
+        for (int i = 0; i < p->info.queue_depth; i++) {
+            if (!(p->busy & (1u << i))) return i;
+        }
+        /* Queue full: wait for the lowest busy slot (bounded by the timeout) */
+        ahci_drain(p, p->busy & (~p->busy + 1));
+    }
+}
+
+static void ahci_build_fis(uint8_t* fis, uint8_t command, uint64_t lba, uint16_t count,
+                           uint16_t features, uint8_t tag_count) {
+    memset(fis, 0, 20);
+    fis[0] = AHCI_FIS_REG_H2D;
+    fis[1] = 0x80;                          /* Command, not control */
+    fis[2] = command;
+    fis[3] = (uint8_t)features;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = 0x40;                          /* LBA mode */
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+    fis[11] = (uint8_t)(features >> 8);
+    fis[12] = tag_count ? tag_count : (uint8_t)count;
+    fis[13] = tag_count ? 0 : (uint8_t)(count >> 8);
+}
+
+/* Fill and issue one slot; prds already written to the slot's table */
+static void ahci_issue(ahci_port_t* p, int slot, int nprd, int write, int queued) {
+    ahci_cmd_header_t* h = &ahci_mem[p - ahci_ports].headers[slot];
+    h->flags = AHCI_CMD_FIS_LEN | (write ? AHCI_CMD_WRITE : 0) |
+               ((uint32_t)nprd << 16);
+    h->prdbc = 0;
+
+    p->busy |= 1u << slot;
+    p->slots[slot].start = timer_stamp();
+
+    if (queued) port_write(p, AHCI_PxSACT, 1u << slot);
+    port_write(p, AHCI_PxCI, 1u << slot);
+}
+
+/*
+ * Issue reads or writes over the segments, as many NCQ commands as needed,
+ * without waiting. Returns the mask of slots used, 0 on failure to issue.
+ */
+static uint32_t ahci_issue_rw(ahci_port_t* p, uint64_t lba, const blkdev_seg_t* segs,
+                              int nsegs, int write) {
+    uint32_t mask = 0;
+    int seg = 0;
+    uint32_t seg_off = 0;               /* Bytes of segs[seg] already described */
+
+    while (seg < nsegs) {
+        int queued = p->info.ncq;
+        int slot = ahci_alloc_slot(p, queued);
+        ahci_cmd_table_t* t = &ahci_mem[p - ahci_ports].tables[slot];
+
+        int nprd = 0;
+        uint32_t sectors = 0;
+        while (seg < nsegs && nprd < AHCI_PRDT_ENTRIES && sectors < AHCI_MAX_SECTORS) {
+            uint32_t seg_bytes = segs[seg].count * AHCI_SECTOR_SIZE;
+            uint32_t bytes = seg_bytes - seg_off;
+            if (bytes > AHCI_PRD_MAX_BYTES) bytes = AHCI_PRD_MAX_BYTES;
+            if (bytes > (AHCI_MAX_SECTORS - sectors) * AHCI_SECTOR_SIZE) {
+                bytes = (AHCI_MAX_SECTORS - sectors) * AHCI_SECTOR_SIZE;
+            }
+
+            t->prdt[nprd].dba = (uint32_t)(uintptr_t)segs[seg].buf + seg_off;
+            t->prdt[nprd].dbau = 0;
+            t->prdt[nprd].reserved = 0;
+            t->prdt[nprd].dbc = bytes - 1;
+            nprd++;
+
+            sectors += bytes / AHCI_SECTOR_SIZE;
+            seg_off += bytes;
+            if (seg_off == seg_bytes) {
+                seg++;
+                seg_off = 0;
+            }
+        }
+
+        if (queued) {
+            ahci_build_fis(t->cfis, write ? AHCI_ATA_WRITE_FPDMA : AHCI_ATA_READ_FPDMA,
+                           lba, 0, (uint16_t)sectors, (uint8_t)(slot << 3));
+        } else {
+            ahci_build_fis(t->cfis, write ? AHCI_ATA_WRITE_DMA_EXT : AHCI_ATA_READ_DMA_EXT,
+                           lba, (uint16_t)sectors, 0, 0);
+        }
+
+        p->slots[slot].write = (int8_t)(write ? 1 : 0);
+        p->slots[slot].sectors = sectors;
+        ahci_issue(p, slot, nprd, write, queued);
+
+        mask |= 1u << slot;
+        lba += sectors;
+    }
+
+    return mask;
+}
+
+/* Non-data or PIO-in command with the port to itself (IDENTIFY, FLUSH) */
+static int ahci_simple_command(ahci_port_t* p, uint8_t command, void* buffer, uint32_t bytes) {
+    int slot = ahci_alloc_slot(p, 0);
+    ahci_cmd_table_t* t = &ahci_mem[p - ahci_ports].tables[slot];
+
+    int nprd = 0;
+    if (buffer) {
+        t->prdt[0].dba = (uint32_t)(uintptr_t)buffer;
+        t->prdt[0].dbau = 0;
+        t->prdt[0].reserved = 0;
+        t->prdt[0].dbc = bytes - 1;
+        nprd = 1;
+    }
+
+    ahci_build_fis(t->cfis, command, 0, 0, 0, 0);
+    if (command == AHCI_ATA_IDENTIFY) t->cfis[7] = 0;
+
+    p->slots[slot].write = -1;
+    p->slots[slot].sectors = 0;
+    ahci_issue(p, slot, nprd, 0, 0);
+
+    int result = ahci_wait(p, 1u << slot);
+    if (command == AHCI_ATA_FLUSH_EXT) {
+        blkdev_account(&p->info.stats, -1, 0, timer_elapsed_us(p->slots[slot].start), result);
+    }
+    return result;
+}
+
+static int ahci_identify(ahci_port_t* p) {
+    if (ahci_simple_command(p, AHCI_ATA_IDENTIFY, identify_buf, 512) < 0) return -1;
+
+    uint16_t* id = (uint16_t*)identify_buf;
+
+    if (id[83] & (1 << 10)) {
+        p->info.size = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                       ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+    } else {
+        p->info.size = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+    }
+
+    for (int i = 0; i < 20; i++) {
+        p->info.model[i * 2] = (char)(id[27 + i] >> 8);
+        p->info.model[i * 2 + 1] = (char)(id[27 + i] & 0xFF);
+    }
+    p->info.model[40] = '\0';
+    for (int i = 39; i >= 0 && p->info.model[i] == ' '; i--) p->info.model[i] = '\0';
+
+    /* Word 76 bit 8: NCQ; word 75: queue depth - 1 */
+    uint32_t depth = 1;
+    if ((reg_read(AHCI_CAP) & AHCI_CAP_NCQ) && (id[76] & (1 << 8))) {
+        p->info.ncq = 1;
+        depth = (id[75] & 0x1F) + 1u;
+        if (depth > ahci_cmd_slots) depth = ahci_cmd_slots;
+    }
+    p->info.queue_depth = (uint8_t)depth;
+
+    return (p->info.size > 0) ? 0 : -1;
+}
+
+static ahci_port_t* ahci_port_of(blkdev_t* dev) {
+    return &ahci_ports[(uintptr_t)dev->priv];
+}
+
+static int ahci_blk_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    ahci_port_t* p = ahci_port_of(dev);
+    blkdev_seg_t seg = { buffer, count };
+    return ahci_wait(p, ahci_issue_rw(p, lba, &seg, 1, 0));
+}
+
+static int ahci_blk_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    ahci_port_t* p = ahci_port_of(dev);
+    blkdev_seg_t seg = { (void*)buffer, count };
+    return ahci_wait(p, ahci_issue_rw(p, lba, &seg, 1, 1));
+}
+
+static int ahci_blk_flush(blkdev_t* dev) {
+    return ahci_simple_command(ahci_port_of(dev), AHCI_ATA_FLUSH_EXT, NULL, 0);
+}
+
+static int ahci_blk_submit(blkdev_t* dev, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    ahci_port_t* p = ahci_port_of(dev);
+    return ahci_wait(p, ahci_issue_rw(p, lba, segs, nsegs, write));
+}
+
+static int ahci_blk_start(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    ahci_port_t* p = ahci_port_of(dev);
+    if (p->async) return -1;
+
+    blkdev_seg_t seg = { buffer, count };
+    p->async = ahci_issue_rw(p, lba, &seg, 1, write);
+    return 0;
+}
+
+static int ahci_blk_finish(blkdev_t* dev) {
+    ahci_port_t* p = ahci_port_of(dev);
+    if (!p->async) return -1;
+
+    int result = ahci_wait(p, p->async);
+    p->async = 0;
+    return result;
+}
+
+static const blkdev_ops_t ahci_blk_ops = {
+    .read = ahci_blk_read,
+    .write = ahci_blk_write,
+    .flush = ahci_blk_flush,
+    .submit = ahci_blk_submit,
+    .start = ahci_blk_start,
+    .finish = ahci_blk_finish,
+};
+
+static int ahci_find_controller(pci_device_t* out) {
+    for (int i = 0; pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, i, out) == 0; i++) {
+        if (out->prog_if == PCI_PROG_IF_AHCI) return 0;
+    }
+    return -1;
+}
+
+int ahci_init(void) {
+    if (ahci_initialized) return ahci_count;
+    ahci_initialized = 1;
+
+    pci_device_t hba;
+    if (ahci_find_controller(&hba) < 0) return 0;
+
+    uint32_t bar5 = pci_read_bar(&hba, 5);
+    if (bar5 & 0x01) return 0;              /* ABAR must be memory space */
+    bar5 &= ~0x0Fu;
+    if (bar5 == 0) return 0;
+
+    pci_enable_bus_master(&hba);
+    ahci_abar = bar5;
+
+    reg_write(AHCI_GHC, reg_read(AHCI_GHC) | AHCI_GHC_AE);
+
+    uint32_t cap = reg_read(AHCI_CAP);
+    ahci_cmd_slots = ((cap >> 8) & 0x1F) + 1;
+    uint32_t pi = reg_read(AHCI_PI);
+
+    for (int port = 0; port < 32 && ahci_count < AHCI_MAX_DEVICES; port++) {
+        if (!(pi & (1u << port))) continue;
+
+        ahci_port_t* p = &ahci_ports[ahci_count];
+        memset(p, 0, sizeof(ahci_port_t));
+        p->info.port = (uint8_t)port;
+
+        uint32_t ssts = port_read(p, AHCI_PxSSTS);
+        if ((ssts & 0x0F) != AHCI_SSTS_DET_PRESENT) continue;
+        if (((ssts >> 8) & 0x0F) != 1) continue;            /* Interface not active */
+        if (port_read(p, AHCI_PxSIG) != AHCI_SIG_ATA) continue;  /* ATAPI, port multiplier, ... */
+
+        p->info.queue_depth = 1;
+        if (ahci_port_setup(p, &ahci_mem[ahci_count]) < 0) continue;
+        if (ahci_identify(p) < 0) continue;
+
+        p->info.present = 1;
+
+        char name[BLKDEV_NAME_LEN] = "sd0";
+        name[2] = (char)('0' + ahci_count);
+        blkdev_t* bd = blkdev_register(name, AHCI_SECTOR_SIZE, p->info.size, p->info.queue_depth,
+                                       &ahci_blk_ops, (void*)(uintptr_t)ahci_count);
+        if (bd) {
+            bd->model = p->info.model;
+            bd->max_transfer = AHCI_MAX_SECTORS;
+            bd->stats = &p->info.stats;
+        }
+
+        ahci_count++;
+    }
+
+    return ahci_count;
+}
+
+ahci_device_t* ahci_get_device(uint8_t index) {
+    if (index >= ahci_count) return NULL;
+    return &ahci_ports[index].info;
+}
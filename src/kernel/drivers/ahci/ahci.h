@@ -0,0 +1,85 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include "../block/blkdev.h"
+
+/* Generic host control registers (offsets from ABAR, PCI BAR5) */
+#define AHCI_CAP            0x00
+#define AHCI_GHC            0x04
+#define AHCI_IS             0x08
+#define AHCI_PI             0x0C
+#define AHCI_PORT_BASE      0x100
+#define AHCI_PORT_SIZE      0x80
+
+#define AHCI_CAP_NCQ        (1u << 30)  /* Native command queuing */
+#define AHCI_CAP_S64A       (1u << 31)
+#define AHCI_GHC_AE         (1u << 31)  /* AHCI enable */
+
+/* Port registers (offsets from the port base) */
+#define AHCI_PxCLB          0x00
+#define AHCI_PxCLBU         0x04
+#define AHCI_PxFB           0x08
+#define AHCI_PxFBU          0x0C
+#define AHCI_PxIS           0x10
+#define AHCI_PxIE           0x14
+#define AHCI_PxCMD          0x18
+#define AHCI_PxTFD          0x20
+#define AHCI_PxSIG          0x24
+#define AHCI_PxSSTS         0x28
+#define AHCI_PxSCTL         0x2C
+#define AHCI_PxSERR         0x30
+#define AHCI_PxSACT         0x34
+#define AHCI_PxCI           0x38
+
+#define AHCI_PxCMD_ST       (1u << 0)   /* Start processing the command list */
+#define AHCI_PxCMD_SUD      (1u << 1)   /* Spin-up device */
+#define AHCI_PxCMD_POD      (1u << 2)   /* Power on device */
+#define AHCI_PxCMD_FRE      (1u << 4)   /* FIS receive enable */
+#define AHCI_PxCMD_FR       (1u << 14)  /* FIS receive running */
+#define AHCI_PxCMD_CR       (1u << 15)  /* Command list running */
+
+#define AHCI_PxIS_TFES      (1u << 30)  /* Task file error */
+#define AHCI_PxIS_ERRORS    0x7DC00010u /* TFES, HBFS, HBDS, IFS, INFS, OFS, IPMS, UFS */
+
+#define AHCI_SSTS_DET_PRESENT   0x3     /* Device present, Phy communication up */
+#define AHCI_SIG_ATA            0x00000101
+
+/* Command header flags (DW0) */
+#define AHCI_CMD_FIS_LEN        5       /* Register H2D FIS, in dwords */
+#define AHCI_CMD_WRITE          (1u << 6)
+
+#define AHCI_FIS_REG_H2D        0x27
+
+/* ATA commands used over AHCI */
+#define AHCI_ATA_READ_DMA_EXT       0x25
+#define AHCI_ATA_WRITE_DMA_EXT      0x35
+#define AHCI_ATA_READ_FPDMA         0x60    /* NCQ */
+#define AHCI_ATA_WRITE_FPDMA        0x61
+#define AHCI_ATA_FLUSH_EXT          0xEA
+#define AHCI_ATA_IDENTIFY           0xEC
+
+#define AHCI_MAX_DEVICES        4
+#define AHCI_SLOTS              32
+#define AHCI_PRDT_ENTRIES       16
+#define AHCI_PRD_MAX_BYTES      (4 * 1024 * 1024)   /* 22-bit byte count */
+/* Sectors per command: four full PRDs, well under the 16-bit NCQ count */
+#define AHCI_MAX_SECTORS        (4 * AHCI_PRD_MAX_BYTES / 512)
+#define AHCI_SECTOR_SIZE        512
+
+typedef struct {
+    uint8_t     present;
+    uint8_t     port;           /* HBA port number */
+    uint8_t     ncq;            /* Drive and HBA both do NCQ */
+    uint8_t     queue_depth;    /* Commands kept in flight */
+    uint64_t    size;           /* Sectors */
+    char        model[41];
+    blkdev_stats_t stats;       /* Command counters for iostat */
+} ahci_device_t;
+
+/* Find the AHCI controller and register SATA disks as sd0..sd3; safe to call again */
+int ahci_init(void);
+
+ahci_device_t* ahci_get_device(uint8_t index);
+
+#endif
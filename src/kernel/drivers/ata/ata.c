@@ -1,11 +1,64 @@
 #include "ata.h"
 #include "../../utils/ports.h"
 #include "../../utils/string.h"
+#include "../pci/pci.h"
+#include "../block/blkdev.h"
+#include "../../arch/i686/timer/timer.h"
+
+/* Command timeout; measured in PIT ticks so it does not depend on CPU speed */
+#define ATA_TIMEOUT_MS      3000
+/* Spin cap used only when interrupts are off and the PIT cannot tick */
+#define ATA_SPIN_LIMIT      10000000
+
+typedef struct __attribute__((packed)) {
+    uint32_t    addr;
+    uint16_t    bytes;          /* 0 means 64K */
+    uint16_t    flags;
+} ata_prd_t;
 
 /* Up to 4 drives: primary master/slave, secondary master/slave */
 static ata_device_t ata_devices[4];
 static int ata_initialized = 0;
 
+/* Bus master I/O base from the IDE controller BAR4, 0 if DMA is unavailable */
+static uint16_t ata_bm_base = 0;
+
+/*
+ * Set when the channels sit behind a PCI IDE function, whose data ports
+ * take 32-bit accesses. IDENTIFY word 48 is obsolete and can't be trusted.
+ */
+static uint8_t ata_pio32_ok = 0;
+
+/* One PRD table per channel; aligned to its size so it never crosses 64K */
+static ata_prd_t ata_prdt[2][ATA_PRD_MAX] __attribute__((aligned(4096)));
+
+/* A DMA command started by ata_start() and not yet collected by ata_finish() */
+typedef struct {
+    uint8_t         active;
+    uint8_t         done;           /* Completed; result is valid */
+    uint8_t         write;
+    int             result;
+    uint64_t        lba;
+    blkdev_seg_t    seg;
+    uint64_t        start;          /* timer_stamp() at issue */
+} ata_async_t;
+
+#define ATA_NO_DRIVE    0xFF
+
+static ata_async_t ata_async[4];
+/* Drive whose DMA command is running on each channel */
+static uint8_t ata_channel_owner[2] = { ATA_NO_DRIVE, ATA_NO_DRIVE };
+
+/* Set when a wait gives up, so the command can be counted as a timeout */
+static uint8_t ata_timed_out = 0;
+
+/* Set by the IRQ14/IRQ15 handler, consumed by ata_wait_irq() */
+static volatile uint8_t ata_irq_pending[2];
+
+static uint32_t ata_max_sectors(ata_device_t* dev);
+static int ata_transfer_segs(ata_device_t* dev, uint64_t lba, const blkdev_seg_t* segs,
+                             int nsegs, int write);
+
 /* I/O delay */
 static void ata_io_wait(uint16_t ctrl_port) {
     inb(ctrl_port);
@@ -14,27 +67,52 @@ static void ata_io_wait(uint16_t ctrl_port) {
     inb(ctrl_port);
 }
 
+static int ata_interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+static uint32_t ata_deadline(void) {
+    return get_ticks() + (ATA_TIMEOUT_MS * get_timer_frequency()) / 1000 + 1;
+}
+
+static int ata_expired(uint32_t deadline, uint32_t* spins) {
+    if ((int32_t)(get_ticks() - deadline) >= 0 ||
+        (!ata_interrupts_enabled() && ++(*spins) > ATA_SPIN_LIMIT)) {
+        ata_timed_out = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void ata_account(ata_device_t* dev, int write, uint32_t sectors, uint64_t start, int result) {
+    blkdev_account(&dev->stats, write, sectors, timer_elapsed_us(start), result);
+    if (result < 0 && ata_timed_out) dev->stats.timeouts++;
+}
+
 /* Wait for BSY to clear */
 static int ata_wait_bsy(uint16_t status_port) {
-    int timeout = 100000;
-    while ((inb(status_port) & ATA_SR_BSY) && timeout > 0) {
-        timeout--;
+    uint32_t deadline = ata_deadline();
+    uint32_t spins = 0;
+    while (inb(status_port) & ATA_SR_BSY) {
+        if (ata_expired(deadline, &spins)) return -1;
     }
-    return timeout > 0 ? 0 : -1;
+    return 0;
 }
 
 /* Wait for DRQ */
 static int ata_wait_drq(uint16_t status_port) {
-    int timeout = 100000;
+    uint32_t deadline = ata_deadline();
+    uint32_t spins = 0;
     uint8_t status;
-    while (timeout > 0) {
+    while (1) {
         status = inb(status_port);
         if (status & ATA_SR_ERR) return -1;
         if (status & ATA_SR_DF) return -1;
         if (status & ATA_SR_DRQ) return 0;
-        timeout--;
+        if (ata_expired(deadline, &spins)) return -1;
     }
-    return -1;
 }
 
 /* Poll status after command */
@@ -51,6 +129,54 @@ static int ata_poll(uint16_t status_port) {
     return 0;
 }
 
+/* Arm the channel before writing a command that will raise INTRQ */
+static void ata_irq_arm(uint8_t channel) {
+    ata_irq_pending[channel] = 0;
+}
+
+/*
+ * Sleep with hlt until the channel raises its IRQ. The PIT wakes us every
+ * tick, so a drive whose IRQ is not routed to 14/15 is still noticed through
+ * the alternate status register; callers confirm the state with ata_poll().
+ */
+static int ata_wait_irq(uint8_t channel) {
+    uint16_t alt_status = (channel == 0) ? ATA_PRIMARY_CTRL : ATA_SECONDARY_CTRL;
+
+    if (!ata_interrupts_enabled()) return ata_wait_bsy(alt_status);
+
+    uint32_t start = get_ticks();
+    uint32_t deadline = ata_deadline();
+    uint32_t spins = 0;
+
+    while (1) {
+        __asm__ volatile ("cli");
+        if (ata_irq_pending[channel]) {
+            ata_irq_pending[channel] = 0;
+            __asm__ volatile ("sti");
+            return 0;
+        }
+        if (get_ticks() != start && !(inb(alt_status) & ATA_SR_BSY)) {
+            __asm__ volatile ("sti");
+            return 0;
+        }
+        if (ata_expired(deadline, &spins)) {
+            __asm__ volatile ("sti");
+            return -1;
+        }
+        /* sti takes effect after hlt starts, so the IRQ cannot slip in between */
+        __asm__ volatile ("sti; hlt");
+    }
+}
+
+void ata_irq_handler(uint8_t channel) {
+    if (channel > 1) return;
+    uint16_t io_base = (channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
+
+    /* Reading the status register acknowledges INTRQ on the drive */
+    inb(io_base + 7);
+    ata_irq_pending[channel] = 1;
+}
+
 /* Software reset */
 static void ata_soft_reset(uint16_t ctrl_port) {
     outb(ctrl_port, 0x04);  /* Set SRST */
@@ -59,6 +185,66 @@ static void ata_soft_reset(uint16_t ctrl_port) {
     ata_io_wait(ctrl_port);
 }
 
+/*
+ * Select the drive and load address and sector count. LBA48 registers are
+ * two-deep FIFOs: the high-order bytes go in first, then the low-order ones.
+ * A count of 256 (LBA28) or 65536 (LBA48) is encoded as 0.
+ */
+static void ata_setup_command(ata_device_t* dev, uint64_t lba, uint32_t count) {
+    uint16_t io_base = (dev->channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
+    uint16_t ctrl_base = (dev->channel == 0) ? ATA_PRIMARY_CTRL : ATA_SECONDARY_CTRL;
+
+    if (dev->lba48) {
+        outb(io_base + 6, 0x40 | (dev->drive << 4));
+        ata_io_wait(ctrl_base);
+
+        outb(io_base + 1, 0x00);
+        outb(io_base + 2, (uint8_t)((count >> 8) & 0xFF));  /* Sector count hi */
+        outb(io_base + 3, (uint8_t)((lba >> 24) & 0xFF));
+        outb(io_base + 4, (uint8_t)((lba >> 32) & 0xFF));
+        outb(io_base + 5, (uint8_t)((lba >> 40) & 0xFF));
+
+        outb(io_base + 1, 0x00);                    /* Features */
+        outb(io_base + 2, (uint8_t)(count & 0xFF));         /* Sector count lo */
+        outb(io_base + 3, (uint8_t)(lba & 0xFF));           /* LBA lo */
+        outb(io_base + 4, (uint8_t)((lba >> 8) & 0xFF));    /* LBA mid */
+        outb(io_base + 5, (uint8_t)((lba >> 16) & 0xFF));   /* LBA hi */
+        return;
+    }
+
+    /* Select drive with LBA mode */
+    outb(io_base + 6, 0xE0 | (dev->drive << 4) | ((lba >> 24) & 0x0F));
+    ata_io_wait(ctrl_base);
+
+    outb(io_base + 1, 0x00);                    /* Features */
+    outb(io_base + 2, (uint8_t)(count & 0xFF));         /* Sector count */
+    outb(io_base + 3, (uint8_t)(lba & 0xFF));           /* LBA lo */
+    outb(io_base + 4, (uint8_t)((lba >> 8) & 0xFF));    /* LBA mid */
+    outb(io_base + 5, (uint8_t)((lba >> 16) & 0xFF));   /* LBA hi */
+}
+
+/* Enable READ/WRITE MULTIPLE with the largest power-of-two block the drive allows */
+static void ata_set_multiple(ata_device_t* dev, uint8_t max_block) {
+    uint16_t io_base = (dev->channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
+    uint16_t ctrl_base = (dev->channel == 0) ? ATA_PRIMARY_CTRL : ATA_SECONDARY_CTRL;
+    int block = 1;
+
+    dev->multiple = 0;
+    while (block * 2 <= max_block) block *= 2;
+    if (block < 2) return;
+
+    outb(io_base + 6, 0xA0 | (dev->drive << 4));
+    ata_io_wait(ctrl_base);
+    outb(io_base + 2, (uint8_t)block);
+
+    ata_irq_arm(dev->channel);
+    outb(io_base + 7, ATA_CMD_SET_MULTIPLE);
+    if (ata_wait_irq(dev->channel) < 0) return;
+    if (ata_poll(io_base + 7) < 0) return;
+
+    dev->multiple = (uint8_t)block;
+}
+
 /* Identify drive */
 static int ata_identify(uint8_t channel, uint8_t drive, ata_device_t* dev) {
     uint16_t io_base = (channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
@@ -83,7 +269,7 @@ static int ata_identify(uint8_t channel, uint8_t drive, ata_device_t* dev) {
 
     /* Check if drive exists */
     uint8_t status = inb(io_base + 7);
-    if (status == 0) return -1;  /* No drive */
+    if (status == 0 || status == 0xFF) return -1;  /* No drive / floating bus */
 
     /* Wait for BSY to clear */
     if (ata_wait_bsy(io_base + 7) < 0) return -1;
@@ -101,19 +287,22 @@ static int ata_identify(uint8_t channel, uint8_t drive, ata_device_t* dev) {
 
     /* Read identify data */
     uint16_t identify[256];
-    for (int i = 0; i < 256; i++) {
-        identify[i] = inw(io_base);
-    }
+    insw(io_base, identify, 256);
 
     dev->present = 1;
     dev->signature = identify[0];
     dev->capabilities = identify[49];
     dev->command_sets = ((uint32_t)identify[83] << 16) | identify[82];
+    dev->dma = (ata_bm_base != 0) && (identify[49] & (1 << 8));
+    dev->lba48 = (dev->command_sets & (1 << 26)) != 0;
+    dev->pio32 = ata_pio32_ok;
+    dev->pio_mode = dev->pio32 ? ATA_PIO_STRING32 : ATA_PIO_STRING16;
 
     /* Get size */
-    if (dev->command_sets & (1 << 26)) {
-        /* 48-bit LBA */
-        dev->size = ((uint32_t)identify[103] << 16) | identify[102];
+    if (dev->lba48) {
+        /* 48-bit LBA: words 100-103 */
+        dev->size = ((uint64_t)identify[103] << 48) | ((uint64_t)identify[102] << 32) |
+                    ((uint64_t)identify[101] << 16) | identify[100];
     } else {
         /* 28-bit LBA */
         dev->size = ((uint32_t)identify[61] << 16) | identify[60];
@@ -132,14 +321,169 @@ static int ata_identify(uint8_t channel, uint8_t drive, ata_device_t* dev) {
         else break;
     }
 
+    /* Word 47: maximum sectors per DRQ block for READ/WRITE MULTIPLE */
+    ata_set_multiple(dev, (uint8_t)(identify[47] & 0xFF));
+
+    return 0;
+}
+
+/* Find a bus-master capable IDE controller (PIIX3/4) and enable DMA */
+static void ata_dma_init(void) {
+    pci_device_t ide;
+
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0, &ide) < 0) return;
+    ata_pio32_ok = 1;
+    if (!(ide.prog_if & 0x80)) return;     /* No bus master support */
+
+    uint32_t bar4 = pci_read_bar(&ide, 4);
+    if (!(bar4 & 0x01)) return;            /* Expect an I/O space BAR */
+    bar4 &= ~0x03u;
+    if (bar4 == 0 || bar4 > 0xFFFF) return;
+
+    pci_enable_bus_master(&ide);
+    ata_bm_base = (uint16_t)bar4;
+}
+
+static uint16_t ata_bm_port(uint8_t channel) {
+    return ata_bm_base + channel * ATA_BM_CHANNEL_SIZE;
+}
+
+/* Describe the segments in the channel PRD table, splitting at 64K boundaries */
+static int ata_dma_setup(uint8_t channel, const blkdev_seg_t* segs, int nsegs) {
+    ata_prd_t* prdt = ata_prdt[channel];
+    int n = 0;
+
+    for (int i = 0; i < nsegs; i++) {
+        uint32_t addr = (uint32_t)(uintptr_t)segs[i].buf;
+        uint32_t bytes = segs[i].count * ATA_SECTOR_SIZE;
+
+        if (addr & 0x01) return -1;        /* PRD addresses must be word aligned */
+
+        while (bytes > 0) {
+            if (n >= ATA_PRD_MAX) return -1;
+
+            uint32_t chunk = 0x10000 - (addr & 0xFFFF);
+            if (chunk > bytes) chunk = bytes;
+
+            prdt[n].addr = addr;
+            prdt[n].bytes = (uint16_t)(chunk & 0xFFFF);
+            prdt[n].flags = 0;
+
+            addr += chunk;
+            bytes -= chunk;
+            n++;
+        }
+    }
+
+    if (n == 0) return -1;
+    prdt[n - 1].flags = ATA_PRD_EOT;
     return 0;
 }
 
+/* Issue a READ/WRITE DMA command and start the engine without waiting */
+static int ata_dma_start(ata_device_t* dev, uint64_t lba, uint32_t count,
+                         const blkdev_seg_t* segs, int nsegs, int write) {
+    uint16_t io_base = (dev->channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
+    uint16_t bm = ata_bm_port(dev->channel);
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+
+    if (ata_dma_setup(dev->channel, segs, nsegs) < 0) return -1;
+
+    /* Wait for drive to be ready */
+    if (ata_wait_bsy(io_base + 7) < 0) return -1;
+
+    /* Stop the engine, load the PRD table, clear IRQ/ERR (write 1 to clear) */
+    outb(bm + ATA_BM_COMMAND, 0);
+    outl(bm + ATA_BM_PRDT, (uint32_t)(uintptr_t)ata_prdt[dev->channel]);
+    outb(bm + ATA_BM_STATUS, inb(bm + ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    outb(bm + ATA_BM_COMMAND, direction);
+
+    ata_setup_command(dev, lba, count);
+    ata_irq_arm(dev->channel);
+    if (dev->lba48) outb(io_base + 7, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    else outb(io_base + 7, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+
+    /* Start the transfer */
+    outb(bm + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+    return 0;
+}
+
+/* Wait for a started DMA command; returns -1 so the caller can fall back to PIO */
+static int ata_dma_finish(ata_device_t* dev, int write) {
+    uint16_t io_base = (dev->channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
+    uint16_t bm = ata_bm_port(dev->channel);
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+
+    /* Sleep until the drive interrupts, then confirm with the controller */
+    int ok = (ata_wait_irq(dev->channel) == 0);
+    uint8_t bm_status = inb(bm + ATA_BM_STATUS);
+    uint32_t deadline = ata_deadline();
+    uint32_t spins = 0;
+    while (ok && !(bm_status & ATA_BM_SR_ERR) &&
+           (!(bm_status & ATA_BM_SR_IRQ) || (bm_status & ATA_BM_SR_ACTIVE))) {
+        if (ata_expired(deadline, &spins)) ok = 0;
+        bm_status = inb(bm + ATA_BM_STATUS);
+    }
+
+    /* Stop the engine and acknowledge the drive and controller interrupt */
+    outb(bm + ATA_BM_COMMAND, direction);
+    if (ata_wait_bsy(io_base + 7) < 0) return -1;
+    uint8_t status = inb(io_base + 7);
+    outb(bm + ATA_BM_STATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+    if (!ok) return -1;
+    if (bm_status & ATA_BM_SR_ERR) return -1;
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+
+    return 0;
+}
+
+static int ata_dma_transfer(ata_device_t* dev, uint64_t lba, uint32_t count,
+                            const blkdev_seg_t* segs, int nsegs, int write) {
+    if (ata_dma_start(dev, lba, count, segs, nsegs, write) < 0) return -1;
+    return ata_dma_finish(dev, write);
+}
+
+static int ata_blk_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    return ata_read_sectors((uint8_t)(uintptr_t)dev->priv, lba, count, buffer);
+}
+
+static int ata_blk_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    return ata_write_sectors((uint8_t)(uintptr_t)dev->priv, lba, count, buffer);
+}
+
+static int ata_blk_flush(blkdev_t* dev) {
+    return ata_flush((uint8_t)(uintptr_t)dev->priv);
+}
+
+static int ata_blk_submit(blkdev_t* dev, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    return ata_transfer_segs(&ata_devices[(uintptr_t)dev->priv], lba, segs, nsegs, write);
+}
+
+static int ata_blk_start(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    return ata_start((uint8_t)(uintptr_t)dev->priv, lba, count, buffer, write);
+}
+
+static int ata_blk_finish(blkdev_t* dev) {
+    return ata_finish((uint8_t)(uintptr_t)dev->priv);
+}
+
+static const blkdev_ops_t ata_blk_ops = {
+    .read = ata_blk_read,
+    .write = ata_blk_write,
+    .flush = ata_blk_flush,
+    .submit = ata_blk_submit,
+    .start = ata_blk_start,
+    .finish = ata_blk_finish,
+};
+
 int ata_init(void) {
     if (ata_initialized) return 0;
 
     memset(ata_devices, 0, sizeof(ata_devices));
 
+    ata_dma_init();
+
     /* Reset both channels */
     ata_soft_reset(ATA_PRIMARY_CTRL);
     ata_soft_reset(ATA_SECONDARY_CTRL);
@@ -159,6 +503,30 @@ int ata_init(void) {
     /* Secondary Slave (drive 3) */
     if (ata_identify(1, 1, &ata_devices[3]) == 0) found++;
 
+    /* Tell the controller which drives may use DMA */
+    if (ata_bm_base) {
+        for (int d = 0; d < 4; d++) {
+            if (!ata_devices[d].present || !ata_devices[d].dma) continue;
+            uint16_t bm = ata_bm_port(ata_devices[d].channel);
+            uint8_t bit = ata_devices[d].drive ? ATA_BM_SR_DRV1_DMA : ATA_BM_SR_DRV0_DMA;
+            outb(bm + ATA_BM_STATUS, (inb(bm + ATA_BM_STATUS) & ~(ATA_BM_SR_ERR | ATA_BM_SR_IRQ)) | bit);
+        }
+    }
+
+    /* Expose present drives as hd0..hd3 */
+    for (int d = 0; d < 4; d++) {
+        if (!ata_devices[d].present) continue;
+        char name[BLKDEV_NAME_LEN] = "hd0";
+        name[2] = (char)('0' + d);
+        blkdev_t* bd = blkdev_register(name, ATA_SECTOR_SIZE, ata_devices[d].size, 1,
+                                       &ata_blk_ops, (void*)(uintptr_t)d);
+        if (bd) {
+            bd->model = ata_devices[d].model;
+            bd->max_transfer = ata_max_sectors(&ata_devices[d]);
+            bd->stats = &ata_devices[d].stats;
+        }
+    }
+
     ata_initialized = 1;
     return found;
 }
@@ -174,80 +542,269 @@ ata_device_t* ata_get_device(uint8_t drive) {
     return &ata_devices[drive];
 }
 
-int ata_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, void* buffer) {
-    if (drive >= 4 || !ata_devices[drive].present) return -1;
-    if (count == 0) return -1;
+/* Move one DRQ block through the data port */
+static void ata_pio_data(ata_device_t* dev, uint16_t io_base, void* buf, uint32_t words, int write) {
+    switch (dev->pio_mode) {
+        case ATA_PIO_STRING32:
+            if (write) outsl(io_base, buf, words / 2);
+            else insl(io_base, buf, words / 2);
+            break;
+
+        case ATA_PIO_STRING16:
+            if (write) outsw(io_base, buf, words);
+            else insw(io_base, buf, words);
+            break;
+
+        default: {
+            uint16_t* w = (uint16_t*)buf;
+            if (write) {
+                for (uint32_t i = 0; i < words; i++) outw(io_base, w[i]);
+            } else {
+                for (uint32_t i = 0; i < words; i++) w[i] = inw(io_base);
+            }
+            break;
+        }
+    }
+}
 
-    ata_device_t* dev = &ata_devices[drive];
+/*
+ * PIO transfer. With READ/WRITE MULTIPLE the drive raises one interrupt and
+ * one DRQ phase per block of dev->multiple sectors instead of per sector.
+ */
+static int ata_pio_transfer(ata_device_t* dev, uint64_t lba, uint32_t count,
+                            const blkdev_seg_t* segs, int nsegs, int write) {
     uint16_t io_base = (dev->channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
-    uint16_t ctrl_base = (dev->channel == 0) ? ATA_PRIMARY_CTRL : ATA_SECONDARY_CTRL;
+    uint32_t block = dev->multiple ? dev->multiple : 1;
+    uint8_t cmd;
+
+    if (dev->lba48) {
+        if (write) cmd = dev->multiple ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_PIO_EXT;
+        else cmd = dev->multiple ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_PIO_EXT;
+    } else {
+        if (write) cmd = dev->multiple ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_PIO;
+        else cmd = dev->multiple ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_PIO;
+    }
 
     /* Wait for drive to be ready */
     if (ata_wait_bsy(io_base + 7) < 0) return -1;
 
-    /* Select drive with LBA mode */
-    outb(io_base + 6, 0xE0 | (dev->drive << 4) | ((lba >> 24) & 0x0F));
-    ata_io_wait(ctrl_base);
+    ata_setup_command(dev, lba, count);
+    ata_irq_arm(dev->channel);
+    outb(io_base + 7, cmd);
 
-    /* Send read command */
-    outb(io_base + 1, 0x00);                    /* Features */
-    outb(io_base + 2, count);                   /* Sector count */
-    outb(io_base + 3, (uint8_t)(lba & 0xFF));           /* LBA lo */
-    outb(io_base + 4, (uint8_t)((lba >> 8) & 0xFF));    /* LBA mid */
-    outb(io_base + 5, (uint8_t)((lba >> 16) & 0xFF));   /* LBA hi */
-    outb(io_base + 7, ATA_CMD_READ_PIO);        /* Command */
+    int seg = 0;
+    uint32_t seg_done = 0;              /* Sectors of segs[seg] already moved */
+    uint32_t done = 0;
+
+    while (done < count) {
+        uint32_t n = count - done;
+        if (n > block) n = block;
 
-    /* Read sectors */
-    uint16_t* buf = (uint16_t*)buffer;
-    for (int s = 0; s < count; s++) {
+        /* Reads interrupt when a block is ready; the first write block is requested by DRQ alone */
+        if (!write || done > 0) {
+            if (ata_wait_irq(dev->channel) < 0) return -1;
+        }
+        ata_irq_arm(dev->channel);
         if (ata_poll(io_base + 7) < 0) return -1;
         if (ata_wait_drq(io_base + 7) < 0) return -1;
 
-        for (int i = 0; i < 256; i++) {
-            buf[s * 256 + i] = inw(io_base);
+        /* A DRQ block may span segments; the data port does not care how it is split */
+        uint32_t left = n;
+        while (left > 0 && seg < nsegs) {
+            uint32_t piece = segs[seg].count - seg_done;
+            if (piece > left) piece = left;
+
+            uint8_t* buf = (uint8_t*)segs[seg].buf + seg_done * ATA_SECTOR_SIZE;
+            ata_pio_data(dev, io_base, buf, piece * 256, write);
+
+            seg_done += piece;
+            left -= piece;
+            if (seg_done == segs[seg].count) {
+                seg++;
+                seg_done = 0;
+            }
         }
+
+        done += n;
+    }
+
+    /* Writes end with one more interrupt once the last block is accepted */
+    if (write) {
+        if (ata_wait_irq(dev->channel) < 0) return -1;
+        if (ata_poll(io_base + 7) < 0) return -1;
+    }
+
+    return 0;
+}
+
+/* Largest single command for this drive */
+static uint32_t ata_max_sectors(ata_device_t* dev) {
+    uint32_t max = dev->lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+    if (dev->dma && max > ATA_DMA_MAX_SECTORS) max = ATA_DMA_MAX_SECTORS;
+    return max;
+}
+
+/*
+ * Finish whatever the channel has in flight. Only the two drives of one
+ * channel contend for it; the other channel keeps running.
+ */
+static void ata_channel_drain(uint8_t channel) {
+    uint8_t owner = ata_channel_owner[channel];
+    if (owner == ATA_NO_DRIVE) return;
+
+    ata_async_t* a = &ata_async[owner];
+    ata_device_t* dev = &ata_devices[owner];
+
+    ata_timed_out = 0;
+    a->result = ata_dma_finish(dev, a->write);
+    if (a->result < 0) {
+        ata_timed_out = 0;
+        a->result = ata_pio_transfer(dev, a->lba, a->seg.count, &a->seg, 1, a->write);
+    }
+    ata_account(dev, a->write, a->seg.count, a->start, a->result);
+
+    a->done = 1;
+    ata_channel_owner[channel] = ATA_NO_DRIVE;
+}
+
+/* One command covering all segments; count must not exceed ata_max_sectors() */
+static int ata_transfer_segs(ata_device_t* dev, uint64_t lba, const blkdev_seg_t* segs,
+                             int nsegs, int write) {
+    uint32_t count = 0;
+    for (int i = 0; i < nsegs; i++) count += segs[i].count;
+    if (count == 0 || count > ata_max_sectors(dev)) return -1;
+
+    ata_channel_drain(dev->channel);
+
+    uint64_t start = timer_stamp();
+    ata_timed_out = 0;
+
+    int result;
+    if (dev->dma && ata_dma_transfer(dev, lba, count, segs, nsegs, write) == 0) {
+        result = 0;
+    } else {
+        /* A DMA timeout that PIO recovers from is not worth reporting */
+        ata_timed_out = 0;
+        result = ata_pio_transfer(dev, lba, count, segs, nsegs, write);
+    }
+
+    ata_account(dev, write, count, start, result);
+    return result;
+}
+
+/* Split a request into the largest commands the addressing mode and PRD table allow */
+static int ata_transfer(ata_device_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    uint8_t* buf = (uint8_t*)buffer;
+    uint32_t max = ata_max_sectors(dev);
+
+    while (count > 0) {
+        blkdev_seg_t seg;
+        seg.buf = buf;
+        seg.count = (count > max) ? max : count;
+
+        if (ata_transfer_segs(dev, lba, &seg, 1, write) < 0) return -1;
+
+        lba += seg.count;
+        count -= seg.count;
+        buf += seg.count * ATA_SECTOR_SIZE;
     }
 
     return 0;
 }
 
-int ata_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, const void* buffer) {
+int ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer) {
+    if (drive >= 4 || !ata_devices[drive].present) return -1;
+    if (count == 0) return -1;
+
+    return ata_transfer(&ata_devices[drive], lba, count, buffer, 0);
+}
+
+int ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const void* buffer) {
     if (drive >= 4 || !ata_devices[drive].present) return -1;
     if (count == 0) return -1;
 
+    return ata_transfer(&ata_devices[drive], lba, count, (void*)buffer, 1);
+}
+
+int ata_start(uint8_t drive, uint64_t lba, uint32_t count, void* buffer, int write) {
+    if (drive >= 4 || !ata_devices[drive].present) return -1;
+    if (count == 0 || count > ata_max_sectors(&ata_devices[drive])) return -1;
+
     ata_device_t* dev = &ata_devices[drive];
+    ata_async_t* a = &ata_async[drive];
+    if (a->active) return -1;
+
+    a->active = 1;
+    a->done = 0;
+    a->lba = lba;
+    a->seg.buf = buffer;
+    a->seg.count = count;
+    a->write = (uint8_t)(write ? 1 : 0);
+
+    /* Without DMA the CPU moves the data anyway, so just do it now */
+    if (!dev->dma) {
+        a->result = ata_transfer_segs(dev, lba, &a->seg, 1, write);
+        a->done = 1;
+        return 0;
+    }
+
+    ata_channel_drain(dev->channel);
+
+    a->start = timer_stamp();
+    if (ata_dma_start(dev, lba, count, &a->seg, 1, write) < 0) {
+        a->result = ata_pio_transfer(dev, lba, count, &a->seg, 1, write);
+        ata_account(dev, write, count, a->start, a->result);
+        a->done = 1;
+        return 0;
+    }
+
+    ata_channel_owner[dev->channel] = drive;
+    return 0;
+}
+
+int ata_finish(uint8_t drive) {
+    if (drive >= 4 || !ata_async[drive].active) return -1;
+
+    ata_async_t* a = &ata_async[drive];
+    if (!a->done) ata_channel_drain(ata_devices[drive].channel);
+
+    a->active = 0;
+    return a->result;
+}
+
+int ata_set_pio_mode(uint8_t drive, ata_pio_mode_t mode) {
+    if (drive >= 4 || !ata_devices[drive].present) return -1;
+    if (mode == ATA_PIO_STRING32 && !ata_devices[drive].pio32) return -1;
+
+    ata_devices[drive].pio_mode = (uint8_t)mode;
+    return 0;
+}
+
+static int ata_flush_cache(ata_device_t* dev) {
     uint16_t io_base = (dev->channel == 0) ? ATA_PRIMARY_DATA : ATA_SECONDARY_DATA;
     uint16_t ctrl_base = (dev->channel == 0) ? ATA_PRIMARY_CTRL : ATA_SECONDARY_CTRL;
 
-    /* Wait for drive to be ready */
     if (ata_wait_bsy(io_base + 7) < 0) return -1;
 
-    /* Select drive with LBA mode */
-    outb(io_base + 6, 0xE0 | (dev->drive << 4) | ((lba >> 24) & 0x0F));
+    outb(io_base + 6, 0xE0 | (dev->drive << 4));
     ata_io_wait(ctrl_base);
 
-    /* Send write command */
-    outb(io_base + 1, 0x00);                    /* Features */
-    outb(io_base + 2, count);                   /* Sector count */
-    outb(io_base + 3, (uint8_t)(lba & 0xFF));           /* LBA lo */
-    outb(io_base + 4, (uint8_t)((lba >> 8) & 0xFF));    /* LBA mid */
-    outb(io_base + 5, (uint8_t)((lba >> 16) & 0xFF));   /* LBA hi */
-    outb(io_base + 7, ATA_CMD_WRITE_PIO);       /* Command */
+    ata_irq_arm(dev->channel);
+    outb(io_base + 7, dev->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    if (ata_wait_irq(dev->channel) < 0) return -1;
+    return ata_poll(io_base + 7);
+}
 
-    /* Write sectors */
-    const uint16_t* buf = (const uint16_t*)buffer;
-    for (int s = 0; s < count; s++) {
-        if (ata_poll(io_base + 7) < 0) return -1;
-        if (ata_wait_drq(io_base + 7) < 0) return -1;
+int ata_flush(uint8_t drive) {
+    if (drive >= 4 || !ata_devices[drive].present) return -1;
 
-        for (int i = 0; i < 256; i++) {
-            outw(io_base, buf[s * 256 + i]);
-        }
+    ata_device_t* dev = &ata_devices[drive];
+    ata_channel_drain(dev->channel);
 
-        /* Flush cache */
-        outb(io_base + 7, ATA_CMD_CACHE_FLUSH);
-        if (ata_poll(io_base + 7) < 0) return -1;
-    }
+    uint64_t start = timer_stamp();
+    ata_timed_out = 0;
 
-    return 0;
+    int result = ata_flush_cache(dev);
+    ata_account(dev, -1, 0, start, result);
+    return result;
 }
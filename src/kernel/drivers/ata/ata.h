@@ -2,6 +2,7 @@
 #define ATA_H
 
 #include <stdint.h>
+#include "../block/blkdev.h"
 
 /* ATA Primary Channel Ports */
 #define ATA_PRIMARY_DATA        0x1F0
@@ -43,10 +44,44 @@
 #define ATA_CMD_READ_PIO_EXT    0x24
 #define ATA_CMD_WRITE_PIO       0x30
 #define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_READ_MULTIPLE_EXT   0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT  0x39
+#define ATA_CMD_READ_MULTIPLE   0xC4
+#define ATA_CMD_WRITE_MULTIPLE  0xC5
+#define ATA_CMD_SET_MULTIPLE    0xC6
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_WRITE_DMA_EXT   0x35
 #define ATA_CMD_CACHE_FLUSH     0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT 0xEA
 #define ATA_CMD_IDENTIFY        0xEC
 
+/* Bus Master IDE registers (offsets from BAR4, +8 for secondary channel) */
+#define ATA_BM_COMMAND      0x00
+#define ATA_BM_STATUS       0x02
+#define ATA_BM_PRDT         0x04
+#define ATA_BM_CHANNEL_SIZE 0x08
+
+#define ATA_BM_CMD_START    0x01    /* Start/stop bus master */
+#define ATA_BM_CMD_READ     0x08    /* Direction: device -> memory */
+
+#define ATA_BM_SR_ACTIVE    0x01    /* Transfer in progress */
+#define ATA_BM_SR_ERR       0x02    /* DMA error */
+#define ATA_BM_SR_IRQ       0x04    /* Interrupt raised */
+#define ATA_BM_SR_DRV0_DMA  0x20    /* Master DMA capable */
+#define ATA_BM_SR_DRV1_DMA  0x40    /* Slave DMA capable */
+
+/* Physical Region Descriptor: one contiguous chunk, must not cross 64K */
+#define ATA_PRD_EOT         0x8000
+#define ATA_PRD_MAX         512
+
+/* Sectors per command: 8-bit count for LBA28, 16-bit count for LBA48 */
+#define ATA_LBA28_MAX_SECTORS   256
+#define ATA_LBA48_MAX_SECTORS   65536
+/* Largest DMA command that fits the PRD table even for an unaligned buffer */
+#define ATA_DMA_MAX_SECTORS     ((ATA_PRD_MAX - 1) * (0x10000 / ATA_SECTOR_SIZE))
+
 /* Drive selection */
 #define ATA_MASTER      0x00
 #define ATA_SLAVE       0x01
@@ -54,6 +89,13 @@
 /* Sector size */
 #define ATA_SECTOR_SIZE 512
 
+/* How PIO moves data through the data port */
+typedef enum {
+    ATA_PIO_WORD = 0,           /* One inw/outw per word */
+    ATA_PIO_STRING16,           /* rep insw/outsw */
+    ATA_PIO_STRING32            /* rep insl/outsl, PCI IDE controllers only */
+} ata_pio_mode_t;
+
 typedef struct {
     uint8_t     present;
     uint8_t     channel;        /* 0 = primary, 1 = secondary */
@@ -61,18 +103,45 @@ typedef struct {
     uint16_t    signature;
     uint16_t    capabilities;
     uint32_t    command_sets;
-    uint32_t    size;           /* Size in sectors */
+    uint64_t    size;           /* Size in sectors */
+    uint8_t     lba48;          /* 48-bit addressing (IDENTIFY word 83 bit 10) */
+    uint8_t     dma;            /* Bus master DMA usable */
+    uint8_t     multiple;       /* Sectors per DRQ block for READ/WRITE MULTIPLE, 0 = off */
+    uint8_t     pio32;          /* Controller accepts 32-bit data port access */
+    uint8_t     pio_mode;       /* ata_pio_mode_t in use */
     char        model[41];
+    blkdev_stats_t stats;       /* Command counters for iostat */
 } ata_device_t;
 
 /* Initialize ATA subsystem, detect drives */
 int ata_init(void);
 
-/* Read sectors from drive */
-int ata_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, void* buffer);
+/* Read sectors from drive; large counts are split into as few commands as possible */
+int ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, void* buffer);
 
 /* Write sectors to drive */
-int ata_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, const void* buffer);
+int ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const void* buffer);
+
+/*
+ * Start a transfer of at most one command's worth of sectors and return
+ * without waiting; collect it with ata_finish(). One request per drive may
+ * be outstanding. Drives on different channels run concurrently, drives on
+ * the same channel take turns. Without DMA the transfer completes inside
+ * ata_start().
+ */
+int ata_start(uint8_t drive, uint64_t lba, uint32_t count, void* buffer, int write);
+
+/* Wait for the request started on drive; returns its result */
+int ata_finish(uint8_t drive);
+
+/* Select the PIO data transfer method (diskbench compares them) */
+int ata_set_pio_mode(uint8_t drive, ata_pio_mode_t mode);
+
+/* Flush the drive write cache; call at sync points, not after every write */
+int ata_flush(uint8_t drive);
+
+/* IRQ14 (channel 0) / IRQ15 (channel 1) handler */
+void ata_irq_handler(uint8_t channel);
 
 /* Get drive info */
 ata_device_t* ata_get_device(uint8_t drive);
@@ -0,0 +1,307 @@
+#include "bcache.h"
+#include "blkqueue.h"
+#include "../../utils/string.h"
+
+#define BCACHE_NONE     0xFFFF
+
+typedef struct {
+    blkdev_t*   dev;            /* NULL = free slot */
+    uint64_t    lba;
+    uint32_t    size;
+    uint8_t     dirty;
+    uint8_t     queued;         /* Submitted by the sync in progress */
+    uint16_t    hash_next;
+    uint16_t    lru_prev;       /* Towards most recently used */
+    uint16_t    lru_next;       /* Towards least recently used */
+} bcache_block_t;
+
+static bcache_block_t blocks[BCACHE_BLOCKS];
+static uint8_t block_data[BCACHE_BLOCKS][BCACHE_BLOCK_SIZE] __attribute__((aligned(4096)));
+
+static uint16_t hash_heads[BCACHE_HASH_SIZE];
+static uint16_t lru_head = BCACHE_NONE;     /* Most recently used */
+static uint16_t lru_tail = BCACHE_NONE;     /* Eviction candidate */
+static int bcache_ready = 0;
+
+static bcache_stats_t stats;
+
+static void bcache_setup(void) {
+    if (bcache_ready) return;
+
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) hash_heads[i] = BCACHE_NONE;
+
+    /* Chain every slot into the LRU list; free slots sit at the tail */
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        blocks[i].dev = NULL;
+        blocks[i].hash_next = BCACHE_NONE;
+        blocks[i].lru_prev = (i == 0) ? BCACHE_NONE : (uint16_t)(i - 1);
+        blocks[i].lru_next = (i == BCACHE_BLOCKS - 1) ? BCACHE_NONE : (uint16_t)(i + 1);
+    }
+    lru_head = 0;
+    lru_tail = BCACHE_BLOCKS - 1;
+
+    bcache_ready = 1;
+}
+
+static uint32_t hash_of(blkdev_t* dev, uint64_t lba) {
+    return ((uint32_t)lba ^ ((uint32_t)(lba >> 32) * 31) ^ ((uint32_t)dev->id << 5)) & (BCACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(uint16_t i) {
+    bcache_block_t* b = &blocks[i];
+    if (b->lru_prev != BCACHE_NONE) blocks[b->lru_prev].lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next != BCACHE_NONE) blocks[b->lru_next].lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+}
+
+static void lru_push_front(uint16_t i) {
+    blocks[i].lru_prev = BCACHE_NONE;
+    blocks[i].lru_next = lru_head;
+    if (lru_head != BCACHE_NONE) blocks[lru_head].lru_prev = i;
+    lru_head = i;
+    if (lru_tail == BCACHE_NONE) lru_tail = i;
+}
+
+static void lru_push_back(uint16_t i) {
+    blocks[i].lru_next = BCACHE_NONE;
+    blocks[i].lru_prev = lru_tail;
+    if (lru_tail != BCACHE_NONE) blocks[lru_tail].lru_next = i;
+    lru_tail = i;
+    if (lru_head == BCACHE_NONE) lru_head = i;
+}
+
+static void hash_remove(uint16_t i) {
+    uint16_t* link = &hash_heads[hash_of(blocks[i].dev, blocks[i].lba)];
+    while (*link != BCACHE_NONE) {
+        if (*link == i) {
+            *link = blocks[i].hash_next;
+            break;
+        }
+        link = &blocks[*link].hash_next;
+    }
+    blocks[i].hash_next = BCACHE_NONE;
+}
+
+static uint16_t lookup(blkdev_t* dev, uint64_t lba) {
+    uint16_t i = hash_heads[hash_of(dev, lba)];
+    while (i != BCACHE_NONE) {
+        if (blocks[i].dev == dev && blocks[i].lba == lba) return i;
+        i = blocks[i].hash_next;
+    }
+    return BCACHE_NONE;
+}
+
+static int writeback(uint16_t i) {
+    bcache_block_t* b = &blocks[i];
+    if (!b->dirty) return 0;
+    if (blkdev_write(b->dev, b->lba, b->size / b->dev->sector_size, block_data[i]) < 0) return -1;
+    b->dirty = 0;
+    stats.dirty--;
+    stats.writebacks++;
+    return 0;
+}
+
+/* Unhash a slot and move it to the tail so it is reused first */
+static void drop(uint16_t i) {
+    if (blocks[i].dirty) {
+        blocks[i].dirty = 0;
+        stats.dirty--;
+    }
+    hash_remove(i);
+    blocks[i].dev = NULL;
+    stats.used--;
+    lru_unlink(i);
+    lru_push_back(i);
+}
+
+/* Take the least recently used slot, writing it back if needed */
+static int grab_slot(uint16_t* out) {
+    uint16_t i = lru_tail;
+    if (blocks[i].dev) {
+        if (writeback(i) < 0) return -1;
+        drop(i);
+        stats.evictions++;
+    }
+    *out = i;
+    return 0;
+}
+
+static void install(uint16_t i, blkdev_t* dev, uint64_t lba, uint32_t size) {
+    blocks[i].dev = dev;
+    blocks[i].lba = lba;
+    blocks[i].size = size;
+    blocks[i].dirty = 0;
+
+    uint32_t h = hash_of(dev, lba);
+    blocks[i].hash_next = hash_heads[h];
+    hash_heads[h] = i;
+    stats.used++;
+
+    lru_unlink(i);
+    lru_push_front(i);
+}
+
+static int check_args(blkdev_t* dev, uint32_t size) {
+    if (!dev || size == 0 || size > BCACHE_BLOCK_SIZE) return -1;
+    if (size % dev->sector_size) return -1;
+    return 0;
+}
+
+/* Find the block for (dev, lba), reading it in on a miss */
+static int get_block(blkdev_t* dev, uint64_t lba, uint32_t size, int fill, uint16_t* out) {
+    bcache_setup();
+
+    uint16_t i = lookup(dev, lba);
+    if (i != BCACHE_NONE && blocks[i].size != size) {
+        if (writeback(i) < 0) return -1;
+        drop(i);
+        i = BCACHE_NONE;
+    }
+
+    if (i != BCACHE_NONE) {
+        stats.hits++;
+        lru_unlink(i);
+        lru_push_front(i);
+        *out = i;
+        return 0;
+    }
+
+    stats.misses++;
+    if (grab_slot(&i) < 0) return -1;
+
+    if (fill && blkdev_read(dev, lba, size / dev->sector_size, block_data[i]) < 0) {
+        return -1;
+    }
+
+    install(i, dev, lba, size);
+    *out = i;
+    return 0;
+}
+
+int bcache_read(blkdev_t* dev, uint64_t lba, uint32_t size, void* buffer) {
+    if (check_args(dev, size) < 0) return -1;
+
+    uint16_t i;
+    if (get_block(dev, lba, size, 1, &i) < 0) return -1;
+    memcpy(buffer, block_data[i], size);
+    return 0;
+}
+
+int bcache_write(blkdev_t* dev, uint64_t lba, uint32_t size, const void* buffer) {
+    if (check_args(dev, size) < 0) return -1;
+    if (lba + size / dev->sector_size > dev->sector_count) return -1;
+
+    /* The whole block is overwritten, so a miss needs no read */
+    uint16_t i;
+    if (get_block(dev, lba, size, 0, &i) < 0) return -1;
+    memcpy(block_data[i], buffer, size);
+
+    if (!blocks[i].dirty) {
+        blocks[i].dirty = 1;
+        stats.dirty++;
+    }
+    return 0;
+}
+
+/* Visit cached blocks of dev that overlap [lba, lba + count) */
+static int for_overlapping(blkdev_t* dev, uint64_t lba, uint32_t count, int drop_them) {
+    if (!bcache_ready || stats.used == 0) return 0;
+
+    uint64_t end = lba + count;
+    for (uint16_t i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_block_t* b = &blocks[i];
+        if (b->dev != dev) continue;
+        if (b->lba >= end || b->lba + b->size / dev->sector_size <= lba) continue;
+
+        if (drop_them) {
+            drop(i);
+        } else if (writeback(i) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int bcache_read_direct(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    if (for_overlapping(dev, lba, count, 0) < 0) return -1;
+    return blkdev_read(dev, lba, count, buffer);
+}
+
+int bcache_write_direct(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    if (blkdev_write(dev, lba, count, buffer) < 0) return -1;
+    return for_overlapping(dev, lba, count, 1);
+}
+
+int bcache_write_queued(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    if (blkq_submit(dev, lba, count, (void*)buffer, 1) < 0) return -1;
+    return for_overlapping(dev, lba, count, 1);
+}
+
+/* Queue every dirty block of one device and let the elevator write them */
+static int sync_device(blkdev_t* dev) {
+    int result = 0;
+
+    for (uint16_t i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_block_t* b = &blocks[i];
+        if (b->dev != dev || !b->dirty) continue;
+        if (blkq_submit(dev, b->lba, b->size / dev->sector_size, block_data[i], 1) < 0) {
+            result = -1;
+        } else {
+            b->queued = 1;
+        }
+    }
+
+    /* A failed dispatch leaves everything dirty; only what was queued is clean */
+    int dispatched = blkq_dispatch(dev);
+
+    for (uint16_t i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_block_t* b = &blocks[i];
+        if (b->dev != dev || !b->queued) continue;
+        b->queued = 0;
+        if (dispatched < 0) continue;
+        b->dirty = 0;
+        stats.dirty--;
+        stats.writebacks++;
+    }
+    return (dispatched < 0) ? -1 : result;
+}
+
+int bcache_sync(blkdev_t* dev) {
+    int result = 0;
+
+    if (bcache_ready && stats.dirty) {
+        for (int d = 0; d < blkdev_count(); d++) {
+            blkdev_t* bd = blkdev_get((uint8_t)d);
+            if (dev && bd != dev) continue;
+            if (sync_device(bd) < 0) result = -1;
+        }
+    }
+
+    if (dev) {
+        if (blkdev_flush(dev) < 0) result = -1;
+    } else {
+        for (int d = 0; d < blkdev_count(); d++) {
+            if (blkdev_flush(blkdev_get((uint8_t)d)) < 0) result = -1;
+        }
+    }
+    return result;
+}
+
+void bcache_invalidate(blkdev_t* dev) {
+    if (!bcache_ready) return;
+    for (uint16_t i = 0; i < BCACHE_BLOCKS; i++) {
+        if (blocks[i].dev == dev) drop(i);
+    }
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    memcpy(out, &stats, sizeof(bcache_stats_t));
+}
+
+void bcache_reset_stats(void) {
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.writebacks = 0;
+    stats.evictions = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+#define BCACHE_BLOCKS       256
+#define BCACHE_BLOCK_SIZE   4096    /* Largest FS sector we cache */
+#define BCACHE_HASH_SIZE    64      /* Power of two */
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t writebacks;    /* Dirty blocks written to the device */
+    uint32_t evictions;
+    uint32_t dirty;         /* Dirty blocks right now */
+    uint32_t used;          /* Valid blocks right now */
+} bcache_stats_t;
+
+/*
+ * Cached block I/O. A block is `size` bytes starting at device sector
+ * `lba`; callers must use the same size for the same LBA (the FAT driver
+ * always passes its FS sector size).
+ */
+int bcache_read(blkdev_t* dev, uint64_t lba, uint32_t size, void* buffer);
+int bcache_write(blkdev_t* dev, uint64_t lba, uint32_t size, const void* buffer);
+
+/*
+ * Uncached bulk I/O for file data. Kept coherent with the cache: dirty
+ * blocks in the range are written back before a read, and cached copies
+ * are dropped after a write.
+ */
+int bcache_read_direct(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer);
+int bcache_write_direct(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer);
+
+/*
+ * Like bcache_write_direct() but only queued; the elevator issues it with
+ * the rest of the batch at the next bcache_sync(). `buffer` must stay
+ * valid until then.
+ */
+int bcache_write_queued(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer);
+
+/* Write back dirty blocks and flush the device cache; dev NULL = all devices */
+int bcache_sync(blkdev_t* dev);
+
+/* Drop every block of dev (dirty data is discarded) */
+void bcache_invalidate(blkdev_t* dev);
+
+void bcache_get_stats(bcache_stats_t* stats);
+void bcache_reset_stats(void);
+
+#endif
@@ -0,0 +1,129 @@
+#include "blkdev.h"
+#include "blkqueue.h"
+#include "../ata/ata.h"
+#include "../ahci/ahci.h"
+#include "../virtio/virtio_blk.h"
+#include "../nvme/nvme.h"
+#include "../../utils/string.h"
+
+static blkdev_t blkdevs[BLKDEV_MAX];
+static int blkdev_total = 0;
+
+void blkdev_init(void) {
+    /* Each driver registers its disks the first time it runs */
+    ata_init();
+    ahci_init();
+    virtio_blk_init();
+    nvme_init();
+}
+
+blkdev_t* blkdev_register(const char* name, uint16_t sector_size, uint64_t sector_count,
+                          uint16_t queue_depth, const blkdev_ops_t* ops, void* priv) {
+    if (blkdev_total >= BLKDEV_MAX) return NULL;
+
+    blkdev_t* dev = &blkdevs[blkdev_total];
+    memset(dev, 0, sizeof(blkdev_t));
+
+    strncpy(dev->name, name, BLKDEV_NAME_LEN - 1);
+    dev->id = (uint8_t)blkdev_total;
+    dev->model = dev->name;
+    dev->sector_size = sector_size;
+    dev->sector_count = sector_count;
+    dev->queue_depth = queue_depth ? queue_depth : 1;
+    dev->ops = ops;
+    dev->priv = priv;
+
+    blkdev_total++;
+    return dev;
+}
+
+int blkdev_count(void) {
+    return blkdev_total;
+}
+
+blkdev_t* blkdev_get(uint8_t id) {
+    if (id >= blkdev_total) return NULL;
+    return &blkdevs[id];
+}
+
+blkdev_t* blkdev_find(const char* name) {
+    /* Bare "0".."3" keeps the old "mount 0" syntax working */
+    if (name[0] >= '0' && name[0] <= '3' && name[1] == '\0') {
+        char hd[4] = { 'h', 'd', name[0], '\0' };
+        return blkdev_find(hd);
+    }
+
+    for (int i = 0; i < blkdev_total; i++) {
+        if (strcmp(blkdevs[i].name, name) == 0) return &blkdevs[i];
+    }
+    return NULL;
+}
+
+int blkdev_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    if (!dev || !dev->ops->read || count == 0) return -1;
+    if (lba + count > dev->sector_count) return -1;
+    if (blkq_barrier(dev, lba, count) < 0) return -1;
+    return dev->ops->read(dev, lba, count, buffer);
+}
+
+int blkdev_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    if (!dev || !dev->ops->write || count == 0) return -1;
+    if (lba + count > dev->sector_count) return -1;
+    if (blkq_barrier(dev, lba, count) < 0) return -1;
+    return dev->ops->write(dev, lba, count, buffer);
+}
+
+int blkdev_flush(blkdev_t* dev) {
+    if (!dev) return -1;
+    if (blkq_dispatch(dev) < 0) return -1;
+    if (!dev->ops->flush) return 0;
+    return dev->ops->flush(dev);
+}
+
+int blkdev_set_polling(blkdev_t* dev, int polling) {
+    if (!dev || !dev->ops->set_polling) return -1;
+    if (blkq_dispatch(dev) < 0) return -1;
+    return dev->ops->set_polling(dev, polling);
+}
+
+int blkdev_start(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    if (!dev || count == 0) return -1;
+    if (lba + count > dev->sector_count) return -1;
+    if (dev->max_transfer && count > dev->max_transfer) return -1;
+    if (blkq_barrier(dev, lba, count) < 0) return -1;
+
+    if (dev->ops->start) return dev->ops->start(dev, lba, count, buffer, write);
+
+    dev->sync_result = write ? dev->ops->write(dev, lba, count, buffer)
+                             : dev->ops->read(dev, lba, count, buffer);
+    return 0;
+}
+
+int blkdev_finish(blkdev_t* dev) {
+    if (!dev) return -1;
+    if (dev->ops->finish) return dev->ops->finish(dev);
+    return dev->sync_result;
+}
+
+void blkdev_account(blkdev_stats_t* stats, int write, uint32_t sectors, uint32_t us, int result) {
+    if (!stats) return;
+
+    if (write < 0) {
+        stats->flushes++;
+    } else if (write) {
+        stats->write_ops++;
+        stats->write_sectors += sectors;
+    } else {
+        stats->read_ops++;
+        stats->read_sectors += sectors;
+    }
+
+    if (result < 0) stats->errors++;
+
+    stats->busy_us += us;
+    if (us > stats->max_us) stats->max_us = us;
+
+    int bucket = 0;
+    while (bucket < BLKDEV_LAT_BUCKETS - 1 && us >= (32u << bucket)) bucket++;
+    stats->lat_hist[bucket]++;
+}
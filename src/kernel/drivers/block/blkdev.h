@@ -0,0 +1,90 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+#define BLKDEV_MAX          8
+#define BLKDEV_NAME_LEN     8
+
+#define BLKDEV_LAT_BUCKETS  16      /* Bucket i holds latencies below 2^(i+5) us; the last is open-ended */
+
+typedef struct blkdev blkdev_t;
+
+/* Per-device I/O counters, updated by the backend for every command */
+typedef struct {
+    uint32_t    read_ops;
+    uint32_t    write_ops;
+    uint32_t    read_sectors;
+    uint32_t    write_sectors;
+    uint32_t    flushes;
+    uint32_t    errors;
+    uint32_t    timeouts;
+    uint32_t    busy_us;            /* Total time spent in commands */
+    uint32_t    max_us;             /* Since boot or the last iostat, which restarts it */
+    uint32_t    lat_hist[BLKDEV_LAT_BUCKETS];
+} blkdev_stats_t;
+
+/* One piece of a scatter-gather transfer */
+typedef struct {
+    void*       buf;
+    uint32_t    count;          /* Sectors */
+} blkdev_seg_t;
+
+/* Backend operations; counts and LBAs are in device sectors */
+typedef struct {
+    int (*read)(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer);
+    int (*write)(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer);
+    int (*flush)(blkdev_t* dev);
+    /* Optional: one command over several buffers, at most max_transfer sectors */
+    int (*submit)(blkdev_t* dev, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write);
+    /* Optional: issue one transfer without waiting, then collect it */
+    int (*start)(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write);
+    int (*finish)(blkdev_t* dev);
+    /* Optional: 1 = poll for completions, 0 = sleep until the device IRQ */
+    int (*set_polling)(blkdev_t* dev, int polling);
+} blkdev_ops_t;
+
+struct blkdev {
+    char                name[BLKDEV_NAME_LEN];  /* "hd0", "ram0", ... */
+    uint8_t             id;                     /* Index in the registry */
+    const char*         model;                  /* Human-readable description */
+    uint16_t            sector_size;            /* Bytes per LBA */
+    uint64_t            sector_count;
+    uint16_t            queue_depth;            /* Commands the backend can keep in flight */
+    uint32_t            max_transfer;           /* Sectors per submit() command, 0 = no limit */
+    const blkdev_ops_t* ops;
+    void*               priv;                   /* Backend data (ATA drive number, ...) */
+    blkdev_stats_t*     stats;                  /* Owned by the backend, NULL if not tracked */
+    int                 sync_result;            /* blkdev_start() result for backends without start() */
+};
+
+/* Register ATA drives; safe to call more than once */
+void blkdev_init(void);
+
+/* Returns the new device or NULL when the table is full */
+blkdev_t* blkdev_register(const char* name, uint16_t sector_size, uint64_t sector_count,
+                          uint16_t queue_depth, const blkdev_ops_t* ops, void* priv);
+
+int blkdev_count(void);
+blkdev_t* blkdev_get(uint8_t id);
+/* Accepts "hd0", "ram0", ... or a bare ATA drive number */
+blkdev_t* blkdev_find(const char* name);
+
+int blkdev_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer);
+int blkdev_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer);
+int blkdev_flush(blkdev_t* dev);
+/* -1 when the backend has no such mode or no usable IRQ line */
+int blkdev_set_polling(blkdev_t* dev, int polling);
+
+/*
+ * Overlapped I/O: start one transfer (at most max_transfer sectors) and
+ * collect it later with blkdev_finish(). Backends without start() complete
+ * the transfer inside blkdev_start().
+ */
+int blkdev_start(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write);
+int blkdev_finish(blkdev_t* dev);
+
+/* Record one completed command; write < 0 records a flush */
+void blkdev_account(blkdev_stats_t* stats, int write, uint32_t sectors, uint32_t us, int result);
+
+#endif
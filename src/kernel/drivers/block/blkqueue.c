@@ -0,0 +1,148 @@
+#include "blkqueue.h"
+#include "../../utils/string.h"
+
+typedef struct {
+    uint64_t    lba;
+    uint32_t    count;
+    uint8_t*    buf;
+    uint8_t     write;
+} blkq_request_t;
+
+typedef struct {
+    blkq_request_t  reqs[BLKQ_DEPTH];
+    int             count;
+    uint64_t        head;       /* LBA just past the last command issued */
+    blkq_stats_t    stats;
+} blkq_t;
+
+static blkq_t queues[BLKDEV_MAX];
+
+static int overlaps(const blkq_request_t* r, uint64_t lba, uint32_t count) {
+    return r->lba < lba + count && lba < r->lba + r->count;
+}
+
+int blkq_barrier(blkdev_t* dev, uint64_t lba, uint32_t count) {
+    blkq_t* q = &queues[dev->id];
+    for (int i = 0; i < q->count; i++) {
+        if (overlaps(&q->reqs[i], lba, count)) return blkq_dispatch(dev);
+    }
+    return 0;
+}
+
+int blkq_submit(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    if (!dev || count == 0) return -1;
+    if (lba + count > dev->sector_count) return -1;
+
+    blkq_t* q = &queues[dev->id];
+    uint8_t* buf = (uint8_t*)buffer;
+    q->stats.submitted++;
+
+    /* Requests to the same sectors must reach the disk in submission order */
+    if (blkq_barrier(dev, lba, count) < 0) return -1;
+
+    /* Extend the previous request when both the disk and memory runs continue */
+    if (q->count > 0) {
+        blkq_request_t* last = &q->reqs[q->count - 1];
+        if (last->write == (write ? 1 : 0) && last->lba + last->count == lba &&
+            last->buf + last->count * dev->sector_size == buf) {
+            last->count += count;
+            q->stats.merged++;
+            return 0;
+        }
+    }
+
+    if (q->count == BLKQ_DEPTH && blkq_dispatch(dev) < 0) return -1;
+
+    blkq_request_t* r = &q->reqs[q->count++];
+    r->lba = lba;
+    r->count = count;
+    r->buf = buf;
+    r->write = write ? 1 : 0;
+    return 0;
+}
+
+/* Issue n requests that are adjacent on disk as one command */
+static int issue(blkdev_t* dev, blkq_t* q, const blkq_request_t* const* order, int n) {
+    uint64_t lba = order[0]->lba;
+    int write = order[0]->write;
+    uint32_t total = 0;
+
+    if (dev->ops->submit && (n > 1 || !dev->max_transfer || order[0]->count <= dev->max_transfer)) {
+        blkdev_seg_t segs[BLKQ_MAX_SEGS];
+        for (int i = 0; i < n; i++) {
+            segs[i].buf = order[i]->buf;
+            segs[i].count = order[i]->count;
+            total += order[i]->count;
+        }
+        if (dev->ops->submit(dev, lba, segs, n, write) < 0) return -1;
+        q->stats.commands++;
+    } else {
+        /* No scatter-gather, or a single request the backend has to split itself */
+        for (int i = 0; i < n; i++) {
+            const blkq_request_t* r = order[i];
+            int result = write ? dev->ops->write(dev, r->lba, r->count, r->buf)
+                               : dev->ops->read(dev, r->lba, r->count, r->buf);
+            if (result < 0) return -1;
+            total += r->count;
+            q->stats.commands++;
+        }
+    }
+
+    q->stats.sectors += total;
+    q->head = lba + total;
+    return 0;
+}
+
+int blkq_dispatch(blkdev_t* dev) {
+    if (!dev) return -1;
+
+    blkq_t* q = &queues[dev->id];
+    int count = q->count;
+    if (count == 0) return 0;
+    q->count = 0;
+
+    /* Stable insertion sort by LBA; overlapping requests never coexist */
+    const blkq_request_t* sorted[BLKQ_DEPTH];
+    for (int i = 0; i < count; i++) {
+        const blkq_request_t* r = &q->reqs[i];
+        int j = i;
+        while (j > 0 && sorted[j - 1]->lba > r->lba) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = r;
+    }
+
+    /* C-LOOK: sweep upwards from the current head position, then wrap */
+    int start = 0;
+    while (start < count && sorted[start]->lba < q->head) start++;
+
+    const blkq_request_t* order[BLKQ_DEPTH];
+    int n = 0;
+    for (int i = start; i < count; i++) order[n++] = sorted[i];
+    for (int i = 0; i < start; i++) order[n++] = sorted[i];
+
+    int result = 0;
+    for (int i = 0; i < n; ) {
+        uint32_t total = order[i]->count;
+        int j = i + 1;
+
+        while (j < n && j - i < BLKQ_MAX_SEGS &&
+               order[j]->write == order[i]->write &&
+               order[j]->lba == order[j - 1]->lba + order[j - 1]->count &&
+               (!dev->max_transfer || total + order[j]->count <= dev->max_transfer)) {
+            total += order[j]->count;
+            j++;
+        }
+
+        q->stats.merged += (uint32_t)(j - i - 1);
+        if (issue(dev, q, &order[i], j - i) < 0) result = -1;
+        i = j;
+    }
+
+    return result;
+}
+
+void blkq_get_stats(blkdev_t* dev, blkq_stats_t* stats) {
+    memcpy(stats, &queues[dev->id].stats, sizeof(blkq_stats_t));
+}
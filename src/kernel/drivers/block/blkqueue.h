@@ -0,0 +1,31 @@
+#ifndef BLKQUEUE_H
+#define BLKQUEUE_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+#define BLKQ_DEPTH          64      /* Pending requests per device */
+#define BLKQ_MAX_SEGS       64      /* Buffers merged into one command */
+
+typedef struct {
+    uint32_t    submitted;      /* Requests handed to blkq_submit() */
+    uint32_t    merged;         /* Requests absorbed into a neighbour */
+    uint32_t    commands;       /* Commands issued to the backend */
+    uint32_t    sectors;        /* Sectors moved by those commands */
+} blkq_stats_t;
+
+/*
+ * Queue a transfer. Nothing moves until blkq_dispatch() (or a barrier or a
+ * full queue forces it), so `buffer` must stay valid until then.
+ */
+int blkq_submit(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write);
+
+/* Sort pending requests by LBA, merge neighbours and issue them */
+int blkq_dispatch(blkdev_t* dev);
+
+/* Dispatch first if a pending request overlaps [lba, lba + count) */
+int blkq_barrier(blkdev_t* dev, uint64_t lba, uint32_t count);
+
+void blkq_get_stats(blkdev_t* dev, blkq_stats_t* stats);
+
+#endif
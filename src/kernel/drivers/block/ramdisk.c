@@ -0,0 +1,48 @@
+#include "ramdisk.h"
+#include "../../utils/string.h"
+#include "../../arch/i686/timer/timer.h"
+
+static blkdev_t* ramdisk_dev = NULL;
+static blkdev_stats_t ramdisk_stats;
+
+static int ramdisk_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    uint64_t start = timer_stamp();
+    uint8_t* base = (uint8_t*)dev->priv;
+    memcpy(buffer, base + (uint32_t)lba * RAMDISK_SECTOR_SIZE, count * RAMDISK_SECTOR_SIZE);
+    blkdev_account(&ramdisk_stats, 0, count, timer_elapsed_us(start), 0);
+    return 0;
+}
+
+static int ramdisk_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    uint64_t start = timer_stamp();
+    uint8_t* base = (uint8_t*)dev->priv;
+    memcpy(base + (uint32_t)lba * RAMDISK_SECTOR_SIZE, buffer, count * RAMDISK_SECTOR_SIZE);
+    blkdev_account(&ramdisk_stats, 1, count, timer_elapsed_us(start), 0);
+    return 0;
+}
+
+static const blkdev_ops_t ramdisk_ops = {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .flush = NULL,
+};
+
+blkdev_t* ramdisk_create(uint32_t size) {
+    if (ramdisk_dev) return ramdisk_dev;
+
+    if (size == 0) size = RAMDISK_DEFAULT_SIZE;
+    if (size > RAMDISK_MAX_SIZE) size = RAMDISK_MAX_SIZE;
+    size &= ~(uint32_t)(RAMDISK_SECTOR_SIZE - 1);
+    if (size == 0) return NULL;
+
+    uint8_t* base = (uint8_t*)RAMDISK_BASE;
+    memset(base, 0, size);
+
+    ramdisk_dev = blkdev_register("ram0", RAMDISK_SECTOR_SIZE, size / RAMDISK_SECTOR_SIZE,
+                                  1, &ramdisk_ops, base);
+    if (ramdisk_dev) {
+        ramdisk_dev->model = "RAM disk";
+        ramdisk_dev->stats = &ramdisk_stats;
+    }
+    return ramdisk_dev;
+}
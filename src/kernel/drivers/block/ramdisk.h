@@ -0,0 +1,20 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+/*
+ * The RAM disk lives above the ELF program window (SAFE_LOAD_MAX) so it
+ * never overlaps the kernel image or a loaded program. The machine needs
+ * RAMDISK_BASE + size bytes of memory (the default QEMU setup has 64M).
+ */
+#define RAMDISK_BASE            0x01000000
+#define RAMDISK_MAX_SIZE        (32 * 1024 * 1024)
+#define RAMDISK_DEFAULT_SIZE    (8 * 1024 * 1024)
+#define RAMDISK_SECTOR_SIZE     512
+
+/* Create ram0 with the given size in bytes (0 = default); returns the device */
+blkdev_t* ramdisk_create(uint32_t size);
+
+#endif
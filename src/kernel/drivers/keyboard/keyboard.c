@@ -4,6 +4,7 @@
 #include "../vga/vga.h"
 #include "../../kernel.h"
 #include "../vga/colors.h"
+#include "../../arch/i686/timer/timer.h"
 
 #include <stdbool.h>
 
@@ -203,7 +204,7 @@ void keyboard_handler(void) {
 
 
 char keyboard_read_char(void) {
-    while ((inb(KBD_STATUS) & 1) == 0);
+    while ((inb(KBD_STATUS) & 1) == 0) timer_idle(); // Пока ждём клавишу - отложенная работа
 
     unsigned char sc = inb(KBD_DATA);
 
@@ -316,6 +317,7 @@ void keyboard_read_line(char* buffer, int max_len) {
         while (1) {
             // ЭНЕРГОЭФФЕКТИВНОЕ ОЖИДАНИЕ ПРЕРЫВАНИЯ
             while (!keyboard_has_key()) {
+                timer_idle(); // Отложенная работа (сброс write-back кэша FAT) - пока ждём ввода
                 __asm__ __volatile__("hlt"); // Спим, пока прерывание клавиатуры не положит символ в буфер!
             }
 
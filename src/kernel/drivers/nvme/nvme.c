@@ -0,0 +1,746 @@
+#include "nvme.h"
+#include "../pci/pci.h"
+#include "../../utils/string.h"
+#include "../../arch/i686/pic/pic.h"
+#include "../../arch/i686/timer/timer.h"
+
+/* Command timeout; the controller's own CAP.TO only covers enable/disable */
+#define NVME_TIMEOUT_MS     5000
+#define NVME_SPIN_LIMIT     50000000
+#define NVME_BOUNCE_BYTES   (64 * 1024)
+
+/* 64 bytes, naturally aligned, so nvme_push() can copy it by dwords */
+typedef struct {
+    uint32_t    cdw0;           /* Opcode 7:0, command identifier 31:16 */
+    uint32_t    nsid;
+    uint32_t    cdw2;
+    uint32_t    cdw3;
+    uint64_t    mptr;
+    uint64_t    prp1;
+    uint64_t    prp2;
+    uint32_t    cdw10;
+    uint32_t    cdw11;
+    uint32_t    cdw12;
+    uint32_t    cdw13;
+    uint32_t    cdw14;
+    uint32_t    cdw15;
+} nvme_cmd_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t    result;
+    uint32_t    reserved;
+    uint16_t    sq_head;
+    uint16_t    sq_id;
+    uint16_t    cid;
+    uint16_t    status;         /* Phase tag in bit 0, status field above it */
+} nvme_cpl_t;
+
+typedef struct {
+    volatile nvme_cmd_t*    sq;
+    volatile nvme_cpl_t*    cq;
+    uint16_t    qid;
+    uint16_t    size;
+    uint16_t    sq_tail;
+    uint16_t    sq_rung;        /* Tail value last written to the doorbell */
+    uint16_t    cq_head;
+    uint8_t     phase;
+    uint16_t    inflight;
+} nvme_queue_t;
+
+typedef struct {
+    int8_t      write;          /* 1 write, 0 read, -1 flush */
+    uint32_t    sectors;
+    uint64_t    start;
+} nvme_slot_t;
+
+/* Queues must be page aligned; a 2K PRP list never crosses a page */
+typedef struct {
+    uint8_t     admin_sq[NVME_PAGE_SIZE];
+    uint8_t     admin_cq[NVME_PAGE_SIZE];
+    uint8_t     io_sq[NVME_IO_QUEUES][NVME_PAGE_SIZE];
+    uint8_t     io_cq[NVME_IO_QUEUES][NVME_PAGE_SIZE];
+    uint64_t    prp_lists[NVME_MAX_CMDS][NVME_PRP_LIST_ENTRIES];
+} nvme_mem_t;
+
+typedef struct {
+    nvme_device_t   info;
+    uintptr_t       regs;
+    uint32_t        stride;         /* Doorbell stride in bytes */
+    uint32_t        nsid;
+    uint8_t         dead;
+    nvme_queue_t    admin;
+    nvme_queue_t    io[NVME_IO_QUEUES];
+    uint8_t         next_io;        /* Round-robin over the I/O queues */
+
+    uint32_t        busy;
+    uint32_t        failed;
+    uint32_t        async;          /* Slots owned by blkdev_start() */
+    uint8_t         async_sync;     /* start() had to run synchronously ... */
+    int             async_result;   /* ... and this is what finish() returns */
+    nvme_slot_t     slots[NVME_MAX_CMDS];
+} nvme_ctrl_t;
+
+static nvme_mem_t nvme_mem[NVME_MAX_DEVICES] __attribute__((aligned(NVME_PAGE_SIZE)));
+static nvme_ctrl_t nvme_ctrls[NVME_MAX_DEVICES];
+static int nvme_count = 0;
+static int nvme_initialized = 0;
+
+static uint8_t identify_buf[NVME_PAGE_SIZE] __attribute__((aligned(NVME_PAGE_SIZE)));
+static uint8_t bounce_buf[NVME_BOUNCE_BYTES] __attribute__((aligned(NVME_PAGE_SIZE)));
+
+static uint32_t reg_read(nvme_ctrl_t* c, uint32_t offset) {
+    return *(volatile uint32_t*)(c->regs + offset);
+}
+
+static void reg_write(nvme_ctrl_t* c, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(c->regs + offset) = value;
+}
+
+static void reg_write64(nvme_ctrl_t* c, uint32_t offset, uint64_t value) {
+    reg_write(c, offset, (uint32_t)value);
+    reg_write(c, offset + 4, (uint32_t)(value >> 32));
+}
+
+static void sq_doorbell(nvme_ctrl_t* c, nvme_queue_t* q) {
+    reg_write(c, NVME_REG_DOORBELL + (2 * q->qid) * c->stride, q->sq_tail);
+    q->sq_rung = q->sq_tail;
+}
+
+static void cq_doorbell(nvme_ctrl_t* c, nvme_queue_t* q) {
+    reg_write(c, NVME_REG_DOORBELL + (2 * q->qid + 1) * c->stride, q->cq_head);
+}
+
+static int nvme_interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+/* Lines 0 (timer), 1 (keyboard), 2 (cascade) and 14/15 (IDE) can't be shared */
+static int nvme_irq_usable(uint8_t irq) {
+    return irq > 2 && irq < 14;
+}
+
+static uint32_t nvme_deadline(uint32_t ms) {
+    return get_ticks() + (ms * get_timer_frequency()) / 1000 + 1;
+}
+
+static int nvme_expired(uint32_t deadline, uint32_t* spins) {
+    if ((int32_t)(get_ticks() - deadline) >= 0) return 1;
+    if (!nvme_interrupts_enabled() && ++(*spins) > NVME_SPIN_LIMIT) return 1;
+    return 0;
+}
+
+static void nvme_queue_init(nvme_queue_t* q, uint16_t qid, void* sq, void* cq, uint16_t size) {
+    memset(sq, 0, NVME_PAGE_SIZE);
+    memset(cq, 0, NVME_PAGE_SIZE);
+    q->sq = (volatile nvme_cmd_t*)sq;
+    q->cq = (volatile nvme_cpl_t*)cq;
+    q->qid = qid;
+    q->size = size;
+    q->sq_tail = 0;
+    q->sq_rung = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+    q->inflight = 0;
+}
+
+static int cq_pending(nvme_queue_t* q) {
+    return (q->cq[q->cq_head].status & 1) == q->phase;
+}
+
+/* Copy a command into the SQ; it reaches the controller at the next doorbell */
+static void nvme_push(nvme_queue_t* q, const nvme_cmd_t* cmd) {
+    volatile uint32_t* dst = (volatile uint32_t*)&q->sq[q->sq_tail];
+    const uint32_t* src = (const uint32_t*)cmd;
+    for (int i = 0; i < 16; i++) dst[i] = src[i];
+
+    q->sq_tail = (uint16_t)((q->sq_tail + 1) % q->size);
+    q->inflight++;
+}
+
+/* Pop one completion; the caller rings the CQ doorbell once per batch */
+static nvme_cpl_t nvme_pop(nvme_queue_t* q) {
+    nvme_cpl_t e;
+    __sync_synchronize();
+    e.result = q->cq[q->cq_head].result;
+    e.cid = q->cq[q->cq_head].cid;
+    e.status = q->cq[q->cq_head].status;
+
+    q->cq_head = (uint16_t)((q->cq_head + 1) % q->size);
+    if (q->cq_head == 0) q->phase ^= 1;
+    q->inflight--;
+    return e;
+}
+
+/* Admin commands are rare and run one at a time, polled */
+static int nvme_admin(nvme_ctrl_t* c, nvme_cmd_t* cmd, uint32_t* result) {
+    nvme_queue_t* q = &c->admin;
+
+    cmd->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t)q->sq_tail << 16);
+    nvme_push(q, cmd);
+    sq_doorbell(c, q);
+
+    uint32_t deadline = nvme_deadline(NVME_TIMEOUT_MS);
+    uint32_t spins = 0;
+    while (!cq_pending(q)) {
+        if (nvme_expired(deadline, &spins)) return -1;
+    }
+
+    nvme_cpl_t e = nvme_pop(q);
+    cq_doorbell(c, q);
+
+    if (result) *result = e.result;
+    return (e.status >> 1) ? -1 : 0;
+}
+
+static void nvme_complete(nvme_ctrl_t* c, int slot, int result, int timed_out) {
+    nvme_slot_t* s = &c->slots[slot];
+    uint32_t bit = 1u << slot;
+
+    blkdev_account(&c->info.stats, s->write, s->sectors, timer_elapsed_us(s->start), result);
+    if (timed_out) c->info.stats.timeouts++;
+
+    c->busy &= ~bit;
+    if (result < 0) c->failed |= bit;
+    else c->failed &= ~bit;
+}
+
+/* Ring every I/O SQ that has new entries: one doorbell write per queue per batch */
+static void nvme_ring(nvme_ctrl_t* c) {
+    __sync_synchronize();
+    for (int i = 0; i < c->info.io_queues; i++) {
+        if (c->io[i].sq_tail != c->io[i].sq_rung) sq_doorbell(c, &c->io[i]);
+    }
+}
+
+static void nvme_reap(nvme_ctrl_t* c) {
+    for (int i = 0; i < c->info.io_queues; i++) {
+        nvme_queue_t* q = &c->io[i];
+        if (!cq_pending(q)) continue;
+
+        while (cq_pending(q)) {
+            nvme_cpl_t e = nvme_pop(q);
+            if (e.cid < NVME_MAX_CMDS && (c->busy & (1u << e.cid))) {
+                nvme_complete(c, e.cid, (e.status >> 1) ? -1 : 0, 0);
+            }
+        }
+        cq_doorbell(c, q);
+    }
+}
+
+static int nvme_any_pending(nvme_ctrl_t* c) {
+    for (int i = 0; i < c->info.io_queues; i++) {
+        if (cq_pending(&c->io[i])) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Wait for at least one completion on any I/O queue. In interrupt mode the
+ * INTx line is unmasked only while we sleep; the handler masks it again.
+ */
+static int nvme_wait_any(nvme_ctrl_t* c) {
+    uint32_t deadline = nvme_deadline(NVME_TIMEOUT_MS);
+    uint32_t spins = 0;
+
+    if (c->info.polling || !nvme_interrupts_enabled()) {
+        while (!nvme_any_pending(c)) {
+            if (reg_read(c, NVME_REG_CSTS) & NVME_CSTS_CFS) return -1;
+            if (nvme_expired(deadline, &spins)) return -1;
+        }
+        return 0;
+    }
+
+    while (1) {
+        __asm__ volatile ("cli");
+        if (nvme_any_pending(c)) {
+            __asm__ volatile ("sti");
+            return 0;
+        }
+        if (nvme_expired(deadline, &spins)) {
+            __asm__ volatile ("sti");
+            return -1;
+        }
+        reg_write(c, NVME_REG_INTMC, 1);
+        /* sti takes effect after hlt starts, so the IRQ cannot slip in between */
+        __asm__ volatile ("sti; hlt");
+    }
+}
+
+/*
+ * Wait until no slot in mask is in flight. A timeout or fatal status would
+ * need a controller reset to recover the queues, so the disk is marked dead.
+ */
+static void nvme_drain(nvme_ctrl_t* c, uint32_t mask) {
+    nvme_ring(c);
+    nvme_reap(c);
+
+    while (c->busy & mask) {
+        if (nvme_wait_any(c) < 0) {
+            for (int i = 0; i < NVME_MAX_CMDS; i++) {
+                if (c->busy & (1u << i)) nvme_complete(c, i, -1, 1);
+            }
+            c->dead = 1;
+            return;
+        }
+        nvme_reap(c);
+    }
+}
+
+static int nvme_wait(nvme_ctrl_t* c, uint32_t mask) {
+    nvme_drain(c, mask);
+
+    int result = (c->dead || (c->failed & mask)) ? -1 : 0;
+    c->failed &= ~mask;
+    return result;
+}
+
+/* Pick a free command slot and an I/O queue with room, waiting if needed */
+static int nvme_alloc(nvme_ctrl_t* c, nvme_queue_t** queue) {
+    while (!c->dead) {
+        for (int i = 0; i < NVME_MAX_CMDS; i++) {
+            if (c->busy & (1u << i)) continue;
+
+            for (int n = 0; n < c->info.io_queues; n++) {
+                nvme_queue_t* q = &c->io[(c->next_io + n) % c->info.io_queues];
+                if (q->inflight < q->size - 1) {
+                    c->next_io = (uint8_t)((c->next_io + n + 1) % c->info.io_queues);
+                    *queue = q;
+                    return i;
+                }
+            }
+            break;
+        }
+        nvme_drain(c, c->busy & (~c->busy + 1));
+    }
+    return -1;
+}
+
+/* Stamp the slot into the command and place it in the queue */
+static void nvme_post(nvme_ctrl_t* c, nvme_queue_t* q, int slot, nvme_cmd_t* cmd,
+                      int8_t write, uint32_t sectors) {
+    cmd->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t)slot << 16);
+    cmd->nsid = c->nsid;
+
+    c->slots[slot].write = write;
+    c->slots[slot].sectors = sectors;
+    c->slots[slot].start = timer_stamp();
+    c->busy |= 1u << slot;
+
+    nvme_push(q, cmd);
+}
+
+static int nvme_queue_cmd(nvme_ctrl_t* c, nvme_cmd_t* cmd, int8_t write, uint32_t sectors) {
+    nvme_queue_t* q;
+    int slot = nvme_alloc(c, &q);
+    if (slot < 0) return -1;
+
+    nvme_post(c, q, slot, cmd, write, sectors);
+    return slot;
+}
+
+/* Build one read/write command over the collected pages; PRP2 may point at the slot's list */
+static int nvme_queue_rw(nvme_ctrl_t* c, uint64_t lba, const uint32_t* pages, int npages,
+                         uint32_t bytes, int write) {
+    nvme_queue_t* q;
+    int slot = nvme_alloc(c, &q);
+    if (slot < 0) return -1;
+
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+
+    uint32_t sectors = bytes / c->info.sector_size;
+    cmd.cdw0 = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+    cmd.prp1 = pages[0];
+    cmd.cdw10 = (uint32_t)lba;
+    cmd.cdw11 = (uint32_t)(lba >> 32);
+    cmd.cdw12 = sectors - 1;
+
+    if (npages == 2) {
+        cmd.prp2 = pages[1];
+    } else if (npages > 2) {
+        uint64_t* list = nvme_mem[c - nvme_ctrls].prp_lists[slot];
+        for (int i = 1; i < npages; i++) list[i - 1] = pages[i];
+        cmd.prp2 = (uint32_t)(uintptr_t)list;
+    }
+
+    nvme_post(c, q, slot, &cmd, (int8_t)(write ? 1 : 0), sectors);
+    return slot;
+}
+
+/*
+ * Turn segments into commands with PRP lists. After the first entry every
+ * PRP entry must start a page and every entry but the last must end one, so
+ * segments are joined into one command only across page-aligned boundaries.
+ * The whole batch is announced with one doorbell per queue.
+ */
+static uint32_t nvme_issue_rw(nvme_ctrl_t* c, uint64_t lba, const blkdev_seg_t* segs,
+                              int nsegs, int write) {
+    uint32_t pages[NVME_PRP_LIST_ENTRIES + 1];
+    uint32_t max_bytes = c->info.max_sectors * c->info.sector_size;
+    uint32_t mask = 0;
+    int npages = 0;
+    uint32_t bytes = 0;
+    uint32_t end = 0;
+
+    for (int s = 0; s < nsegs && !c->dead; s++) {
+        uint32_t addr = (uint32_t)(uintptr_t)segs[s].buf;
+        uint32_t remaining = segs[s].count * c->info.sector_size;
+
+        while (remaining) {
+            if (npages && ((end | addr) & (NVME_PAGE_SIZE - 1))) {
+                int slot = nvme_queue_rw(c, lba, pages, npages, bytes, write);
+                if (slot < 0) return mask;
+                mask |= 1u << slot;
+                lba += bytes / c->info.sector_size;
+                npages = 0;
+                bytes = 0;
+            }
+
+            uint32_t take = ((addr & ~(NVME_PAGE_SIZE - 1)) + NVME_PAGE_SIZE) - addr;
+            if (take > remaining) take = remaining;
+            if (take > max_bytes - bytes) take = max_bytes - bytes;
+
+            pages[npages++] = addr;
+            addr += take;
+            remaining -= take;
+            bytes += take;
+            end = addr;
+
+            if (bytes == max_bytes) {
+                int slot = nvme_queue_rw(c, lba, pages, npages, bytes, write);
+                if (slot < 0) return mask;
+                mask |= 1u << slot;
+                lba += bytes / c->info.sector_size;
+                npages = 0;
+                bytes = 0;
+            }
+        }
+    }
+
+    if (npages && !c->dead) {
+        int slot = nvme_queue_rw(c, lba, pages, npages, bytes, write);
+        if (slot >= 0) mask |= 1u << slot;
+    }
+
+    nvme_ring(c);
+    return mask;
+}
+
+/* PRP entries must be dword aligned; odd buffers go through a bounce buffer */
+static int nvme_bounce_rw(nvme_ctrl_t* c, uint64_t lba, uint32_t count, void* buffer, int write) {
+    uint32_t chunk = NVME_BOUNCE_BYTES / c->info.sector_size;
+    uint8_t* p = (uint8_t*)buffer;
+
+    while (count > 0) {
+        uint32_t n = (count < chunk) ? count : chunk;
+        uint32_t bytes = n * c->info.sector_size;
+        blkdev_seg_t seg = { bounce_buf, n };
+
+        if (write) memcpy(bounce_buf, p, bytes);
+        if (nvme_wait(c, nvme_issue_rw(c, lba, &seg, 1, write)) < 0) return -1;
+        if (!write) memcpy(p, bounce_buf, bytes);
+
+        lba += n;
+        count -= n;
+        p += bytes;
+    }
+    return 0;
+}
+
+static int nvme_segs_aligned(const blkdev_seg_t* segs, int nsegs) {
+    for (int i = 0; i < nsegs; i++) {
+        if ((uintptr_t)segs[i].buf & 3) return 0;
+    }
+    return 1;
+}
+
+static nvme_ctrl_t* nvme_of(blkdev_t* dev) {
+    return &nvme_ctrls[(uintptr_t)dev->priv];
+}
+
+static int nvme_rw(nvme_ctrl_t* c, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    if (nvme_segs_aligned(segs, nsegs)) {
+        return nvme_wait(c, nvme_issue_rw(c, lba, segs, nsegs, write));
+    }
+
+    int result = 0;
+    for (int i = 0; i < nsegs; i++) {
+        if (nvme_segs_aligned(&segs[i], 1)) {
+            if (nvme_wait(c, nvme_issue_rw(c, lba, &segs[i], 1, write)) < 0) result = -1;
+        } else if (nvme_bounce_rw(c, lba, segs[i].count, segs[i].buf, write) < 0) {
+            result = -1;
+        }
+        lba += segs[i].count;
+    }
+    return result;
+}
+
+static int nvme_blk_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    blkdev_seg_t seg = { buffer, count };
+    return nvme_rw(nvme_of(dev), lba, &seg, 1, 0);
+}
+
+static int nvme_blk_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    blkdev_seg_t seg = { (void*)buffer, count };
+    return nvme_rw(nvme_of(dev), lba, &seg, 1, 1);
+}
+
+static int nvme_blk_submit(blkdev_t* dev, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    return nvme_rw(nvme_of(dev), lba, segs, nsegs, write);
+}
+
+static int nvme_blk_flush(blkdev_t* dev) {
+    nvme_ctrl_t* c = nvme_of(dev);
+    if (!c->info.volatile_cache) return 0;
+
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_CMD_FLUSH;
+
+    int slot = nvme_queue_cmd(c, &cmd, -1, 0);
+    if (slot < 0) return -1;
+    nvme_ring(c);
+    return nvme_wait(c, 1u << slot);
+}
+
+static int nvme_blk_start(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    nvme_ctrl_t* c = nvme_of(dev);
+    if (c->async || c->async_sync) return -1;
+
+    blkdev_seg_t seg = { buffer, count };
+    if (!nvme_segs_aligned(&seg, 1)) {
+        c->async_result = nvme_bounce_rw(c, lba, count, buffer, write);
+        c->async_sync = 1;
+        return 0;
+    }
+
+    c->async = nvme_issue_rw(c, lba, &seg, 1, write);
+    return c->async ? 0 : -1;
+}
+
+static int nvme_blk_finish(blkdev_t* dev) {
+    nvme_ctrl_t* c = nvme_of(dev);
+
+    if (c->async_sync) {
+        c->async_sync = 0;
+        return c->async_result;
+    }
+    if (!c->async) return -1;
+
+    int result = nvme_wait(c, c->async);
+    c->async = 0;
+    return result;
+}
+
+static int nvme_blk_set_polling(blkdev_t* dev, int polling) {
+    return nvme_set_polling((uint8_t)(uintptr_t)dev->priv, polling);
+}
+
+static const blkdev_ops_t nvme_blk_ops = {
+    .read = nvme_blk_read,
+    .write = nvme_blk_write,
+    .flush = nvme_blk_flush,
+    .submit = nvme_blk_submit,
+    .start = nvme_blk_start,
+    .finish = nvme_blk_finish,
+    .set_polling = nvme_blk_set_polling,
+};
+
+static int nvme_wait_ready(nvme_ctrl_t* c, int ready, uint32_t timeout_ms) {
+    uint32_t deadline = nvme_deadline(timeout_ms);
+    uint32_t spins = 0;
+
+    while (((reg_read(c, NVME_REG_CSTS) & NVME_CSTS_RDY) != 0) != ready) {
+        if (reg_read(c, NVME_REG_CSTS) & NVME_CSTS_CFS) return -1;
+        if (nvme_expired(deadline, &spins)) return -1;
+    }
+    return 0;
+}
+
+static int nvme_identify(nvme_ctrl_t* c, uint32_t cns, uint32_t nsid) {
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    memset(identify_buf, 0, sizeof(identify_buf));
+
+    cmd.cdw0 = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.prp1 = (uint32_t)(uintptr_t)identify_buf;
+    cmd.cdw10 = cns;
+    return nvme_admin(c, &cmd, NULL);
+}
+
+static int nvme_create_queues(nvme_ctrl_t* c, nvme_mem_t* mem, uint16_t size, int nqueues) {
+    nvme_cmd_t cmd;
+    uint32_t result;
+
+    /* Ask for nqueues pairs; the controller may grant fewer */
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd.cdw11 = ((uint32_t)(nqueues - 1) << 16) | (uint32_t)(nqueues - 1);
+    if (nvme_admin(c, &cmd, &result) == 0) {
+        int granted = (int)(result & 0xFFFF) + 1;
+        if ((int)(result >> 16) + 1 < granted) granted = (int)(result >> 16) + 1;
+        if (granted < nqueues) nqueues = granted;
+    }
+
+    int irq_usable = nvme_irq_usable(c->info.irq);
+    int created = 0;
+
+    for (int i = 0; i < nqueues; i++) {
+        uint16_t qid = (uint16_t)(i + 1);
+        nvme_queue_init(&c->io[i], qid, mem->io_sq[i], mem->io_cq[i], size);
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.cdw0 = NVME_ADMIN_CREATE_CQ;
+        cmd.prp1 = (uint32_t)(uintptr_t)mem->io_cq[i];
+        cmd.cdw10 = ((uint32_t)(size - 1) << 16) | qid;
+        cmd.cdw11 = 1 | (irq_usable ? 2 : 0);   /* Contiguous, interrupts on vector 0 */
+        if (nvme_admin(c, &cmd, NULL) < 0) break;
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.cdw0 = NVME_ADMIN_CREATE_SQ;
+        cmd.prp1 = (uint32_t)(uintptr_t)mem->io_sq[i];
+        cmd.cdw10 = ((uint32_t)(size - 1) << 16) | qid;
+        cmd.cdw11 = ((uint32_t)qid << 16) | 1;  /* Bound to CQ qid, contiguous */
+        if (nvme_admin(c, &cmd, NULL) < 0) break;
+
+        created++;
+    }
+
+    c->info.io_queues = (uint8_t)created;
+    return created ? 0 : -1;
+}
+
+static int nvme_probe(nvme_ctrl_t* c, nvme_mem_t* mem) {
+    uint32_t cap_lo = reg_read(c, NVME_REG_CAP);
+    uint32_t cap_hi = reg_read(c, NVME_REG_CAP + 4);
+
+    uint32_t mqes = (cap_lo & 0xFFFF) + 1;
+    uint32_t enable_ms = ((cap_lo >> 24) & 0xFF) * 500 + 500;
+    c->stride = 4u << (cap_hi & 0x0F);
+    if ((cap_hi >> 16) & 0x0F) return -1;       /* MPSMIN above 4K */
+
+    /* Reset, point the controller at the admin queue, enable */
+    reg_write(c, NVME_REG_CC, reg_read(c, NVME_REG_CC) & ~NVME_CC_EN);
+    if (nvme_wait_ready(c, 0, enable_ms) < 0) return -1;
+
+    nvme_queue_init(&c->admin, 0, mem->admin_sq, mem->admin_cq, NVME_ADMIN_QUEUE_SIZE);
+    reg_write(c, NVME_REG_AQA, ((uint32_t)(NVME_ADMIN_QUEUE_SIZE - 1) << 16) | (NVME_ADMIN_QUEUE_SIZE - 1));
+    reg_write64(c, NVME_REG_ASQ, (uint32_t)(uintptr_t)mem->admin_sq);
+    reg_write64(c, NVME_REG_ACQ, (uint32_t)(uintptr_t)mem->admin_cq);
+
+    reg_write(c, NVME_REG_INTMS, 0xFFFFFFFF);
+    reg_write(c, NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    if (nvme_wait_ready(c, 1, enable_ms) < 0) return -1;
+
+    /* Identify controller: model, MDTS, volatile write cache */
+    if (nvme_identify(c, 1, 0) < 0) return -1;
+
+    memcpy(c->info.model, identify_buf + 24, 40);
+    c->info.model[40] = '\0';
+    for (int i = 39; i >= 0 && c->info.model[i] == ' '; i--) c->info.model[i] = '\0';
+
+    uint8_t mdts = identify_buf[77];
+    c->info.volatile_cache = identify_buf[525] & 1;
+
+    /* Identify namespace 1 */
+    c->nsid = 1;
+    if (nvme_identify(c, 0, c->nsid) < 0) return -1;
+
+    uint64_t nsze = *(uint64_t*)identify_buf;
+    uint8_t flbas = identify_buf[26] & 0x0F;
+    uint32_t lbaf = *(uint32_t*)(identify_buf + 128 + 4 * flbas);
+    uint8_t lbads = (uint8_t)((lbaf >> 16) & 0xFF);
+    if (nsze == 0 || lbads < 9 || lbads > 12) return -1;
+
+    c->info.size = nsze;
+    c->info.sector_size = (uint16_t)(1u << lbads);
+
+    /* One command may not exceed MDTS pages nor what one PRP list describes */
+    uint32_t max_bytes = NVME_MAX_SECTORS * 512;
+    if (mdts && mdts < 20 && ((uint32_t)NVME_PAGE_SIZE << mdts) < max_bytes) {
+        max_bytes = (uint32_t)NVME_PAGE_SIZE << mdts;
+    }
+    c->info.max_sectors = max_bytes / c->info.sector_size;
+
+    uint16_t qsize = NVME_IO_QUEUE_SIZE;
+    if (qsize > mqes) qsize = (uint16_t)mqes;
+    c->info.queue_size = qsize;
+
+    if (nvme_create_queues(c, mem, qsize, NVME_IO_QUEUES) < 0) return -1;
+
+    c->info.polling = nvme_irq_usable(c->info.irq) ? 0 : 1;
+    if (!c->info.polling) pic_clear_mask(c->info.irq);
+    return 0;
+}
+
+int nvme_init(void) {
+    if (nvme_initialized) return nvme_count;
+    nvme_initialized = 1;
+
+    pci_device_t pdev;
+    for (int i = 0; nvme_count < NVME_MAX_DEVICES &&
+                    pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_NVME, i, &pdev) == 0; i++) {
+        if (pdev.prog_if != PCI_PROG_IF_NVME) continue;
+
+        uint32_t bar0 = pci_read_bar(&pdev, 0);
+        if (bar0 & 0x01) continue;                          /* Must be memory space */
+        if ((bar0 & 0x06) == 0x04 && pci_read_bar(&pdev, 1) != 0) continue;  /* Above 4G */
+        bar0 &= ~0x0Fu;
+        if (bar0 == 0) continue;
+
+        nvme_ctrl_t* c = &nvme_ctrls[nvme_count];
+        memset(c, 0, sizeof(nvme_ctrl_t));
+        c->regs = bar0;
+        c->info.irq = pdev.irq;
+
+        pci_enable_bus_master(&pdev);
+        if (nvme_probe(c, &nvme_mem[nvme_count]) < 0) continue;
+
+        c->info.present = 1;
+
+        char name[BLKDEV_NAME_LEN] = "nvme0n1";
+        name[4] = (char)('0' + nvme_count);
+        blkdev_t* bd = blkdev_register(name, c->info.sector_size, c->info.size, NVME_MAX_CMDS,
+                                       &nvme_blk_ops, (void*)(uintptr_t)nvme_count);
+        if (bd) {
+            bd->model = c->info.model;
+            bd->max_transfer = c->info.max_sectors;
+            bd->stats = &c->info.stats;
+        }
+
+        nvme_count++;
+    }
+
+    return nvme_count;
+}
+
+nvme_device_t* nvme_get_device(uint8_t index) {
+    if (index >= nvme_count) return NULL;
+    return &nvme_ctrls[index].info;
+}
+
+int nvme_set_polling(uint8_t index, int polling) {
+    if (index >= nvme_count) return -1;
+    nvme_ctrl_t* c = &nvme_ctrls[index];
+
+    if (!polling && !nvme_irq_usable(c->info.irq)) return -1;
+
+    nvme_drain(c, c->busy);
+    c->info.polling = polling ? 1 : 0;
+    reg_write(c, NVME_REG_INTMS, 0xFFFFFFFF);
+    if (!polling) pic_clear_mask(c->info.irq);
+    return 0;
+}
+
+void nvme_irq_handler(uint8_t irq) {
+    for (int i = 0; i < nvme_count; i++) {
+        nvme_ctrl_t* c = &nvme_ctrls[i];
+        if (c->info.irq != irq || c->info.polling) continue;
+        /* Level-triggered INTx stays up until the CQ is consumed; mask it for now */
+        reg_write(c, NVME_REG_INTMS, 1);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include <stdint.h>
+#include "../block/blkdev.h"
+
+/* Controller registers (offsets from BAR0) */
+#define NVME_REG_CAP        0x00    /* 64-bit */
+#define NVME_REG_VS         0x08
+#define NVME_REG_INTMS      0x0C
+#define NVME_REG_INTMC      0x10
+#define NVME_REG_CC         0x14
+#define NVME_REG_CSTS       0x1C
+#define NVME_REG_AQA        0x24
+#define NVME_REG_ASQ        0x28    /* 64-bit */
+#define NVME_REG_ACQ        0x30    /* 64-bit */
+#define NVME_REG_DOORBELL   0x1000
+
+#define NVME_CC_EN          (1u << 0)
+#define NVME_CC_IOSQES      (6u << 16)  /* 64-byte submission entries */
+#define NVME_CC_IOCQES      (4u << 20)  /* 16-byte completion entries */
+#define NVME_CSTS_RDY       (1u << 0)
+#define NVME_CSTS_CFS       (1u << 1)   /* Controller fatal status */
+
+/* Admin opcodes */
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+#define NVME_FEAT_NUM_QUEUES    0x07
+
+/* NVM command set opcodes */
+#define NVME_CMD_FLUSH      0x00
+#define NVME_CMD_WRITE      0x01
+#define NVME_CMD_READ       0x02
+
+#define NVME_MAX_DEVICES        2
+#define NVME_PAGE_SIZE          4096
+#define NVME_ADMIN_QUEUE_SIZE   16
+#define NVME_IO_QUEUES          2       /* I/O SQ/CQ pairs per controller */
+#define NVME_IO_QUEUE_SIZE      32      /* Entries per I/O queue */
+#define NVME_MAX_CMDS           32      /* Commands in flight per controller */
+#define NVME_PRP_LIST_ENTRIES   256     /* One 2K PRP list per command */
+#define NVME_MAX_SECTORS        2048    /* 1MB per command, before MDTS */
+
+typedef struct {
+    uint8_t     present;
+    uint8_t     irq;            /* PCI interrupt line */
+    uint8_t     polling;        /* 1: spin on the completion queues, 0: sleep until the IRQ */
+    uint8_t     io_queues;      /* I/O queue pairs created */
+    uint16_t    queue_size;     /* Entries per I/O queue */
+    uint16_t    sector_size;    /* Namespace LBA size */
+    uint32_t    max_sectors;    /* Per command, from MDTS */
+    uint8_t     volatile_cache; /* Flush does something */
+    uint64_t    size;           /* Sectors in namespace 1 */
+    char        model[41];
+    blkdev_stats_t stats;       /* Command counters for iostat */
+} nvme_device_t;
+
+/* Find NVMe controllers and register namespace 1 of each as nvme0n1, nvme1n1; safe to call again */
+int nvme_init(void);
+
+nvme_device_t* nvme_get_device(uint8_t index);
+
+/* Switch completion between polling and interrupts */
+int nvme_set_polling(uint8_t index, int polling);
+
+/* Called from the shared PCI IRQ path; masks the controller's INTx until the next wait */
+void nvme_irq_handler(uint8_t irq);
+
+#endif
@@ -28,6 +28,94 @@ uint16_t pci_config_read_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t o
     return (uint16_t)((inl(0xCFC) >> ((offset & 2) * 8)) & 0xFFFF);
 }
 
+// Чтение полного 32-битного регистра (нужно для BAR)
+uint32_t pci_config_read_dword(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    uint32_t address = (uint32_t)(((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+    ((uint32_t)func << 8) | (offset & 0xFC) | ((uint32_t)0x80000000));
+
+    outl(0xCF8, address);
+    return inl(0xCFC);
+}
+
+// Запись 16-битного слова (регистр команд и т.п.)
+void pci_config_write_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value) {
+    uint32_t address = (uint32_t)(((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+    ((uint32_t)func << 8) | (offset & 0xFC) | ((uint32_t)0x80000000));
+
+    outl(0xCF8, address);
+    outw(0xCFC + (offset & 2), value);
+}
+
+static void pci_fill_device(uint8_t bus, uint8_t slot, uint8_t func, pci_device_t* out) {
+    out->bus = bus;
+    out->slot = slot;
+    out->func = func;
+    out->vendor_id = pci_config_read_word(bus, slot, func, PCI_REG_VENDOR_ID);
+    out->device_id = pci_config_read_word(bus, slot, func, PCI_REG_DEVICE_ID);
+
+    uint16_t class_word = pci_config_read_word(bus, slot, func, PCI_REG_SUBCLASS);
+    out->class_code = (uint8_t)(class_word >> 8);
+    out->subclass = (uint8_t)(class_word & 0xFF);
+    out->prog_if = (uint8_t)(pci_config_read_word(bus, slot, func, 0x08) >> 8);
+    out->irq = (uint8_t)(pci_config_read_word(bus, slot, func, PCI_REG_IRQ_LINE) & 0xFF);
+}
+
+// Обходим все функции всех устройств; match решает, подходит ли устройство.
+// Возвращаем index-ое совпадение (IDE-контроллер PIIX живёт на функции 1)
+static int pci_find(int (*match)(const pci_device_t*, uint16_t, uint16_t),
+                    uint16_t a, uint16_t b, int index, pci_device_t* out) {
+    for (uint16_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if (pci_config_read_word(bus, slot, 0, PCI_REG_VENDOR_ID) == 0xFFFF) continue;
+
+            uint8_t header = (uint8_t)(pci_config_read_word(bus, slot, 0, PCI_REG_HEADER_TYPE) & 0xFF);
+            uint8_t funcs = (header & 0x80) ? 8 : 1;
+
+            for (uint8_t func = 0; func < funcs; func++) {
+                if (pci_config_read_word(bus, slot, func, PCI_REG_VENDOR_ID) == 0xFFFF) continue;
+
+                pci_device_t dev;
+                pci_fill_device((uint8_t)bus, slot, func, &dev);
+                if (!match(&dev, a, b)) continue;
+
+                if (index-- == 0) {
+                    *out = dev;
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+static int pci_match_class(const pci_device_t* dev, uint16_t class_code, uint16_t subclass) {
+    return dev->class_code == class_code && dev->subclass == subclass;
+}
+
+static int pci_match_id(const pci_device_t* dev, uint16_t vendor_id, uint16_t device_id) {
+    return dev->vendor_id == vendor_id && dev->device_id == device_id;
+}
+
+// Ищем index-ое устройство нужного класса, включая многофункциональные
+int pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_device_t* out) {
+    return pci_find(pci_match_class, class_code, subclass, index, out);
+}
+
+// Ищем index-ое устройство с данными vendor/device ID (например, virtio-blk)
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, int index, pci_device_t* out) {
+    return pci_find(pci_match_id, vendor_id, device_id, index, out);
+}
+
+uint32_t pci_read_bar(const pci_device_t* dev, int bar) {
+    return pci_config_read_dword(dev->bus, dev->slot, dev->func, PCI_REG_BAR0 + bar * 4);
+}
+
+void pci_enable_bus_master(const pci_device_t* dev) {
+    uint16_t cmd = pci_config_read_word(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    cmd |= PCI_CMD_IO_SPACE | PCI_CMD_MEM_SPACE | PCI_CMD_BUS_MASTER;
+    pci_config_write_word(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd);
+}
+
 // Простой сканер PCI, который выведет все найденные устройства
 void pci_scan_bus() {
     vga_print_color("Scanning PCI bus...\n", LIGHT_CYAN);
@@ -75,6 +163,11 @@ void pci_scan_bus() {
                 rtl8139_init(io_base, irq, (uint8_t)bus, slot, 0);
                 }
 
+            // virtio-blk регистрируется через blkdev_init(), здесь только помечаем
+            if (vendor_id == PCI_VENDOR_VIRTIO && device_id == PCI_DEVICE_VIRTIO_BLK) {
+                vga_print_color("  <-- virtio-blk", LIGHT_CYAN);
+            }
+
             vga_putc('\n');
         }
     }
@@ -3,8 +3,57 @@
 
 #include <stdint.h>
 
+// Смещения в конфигурационном пространстве PCI
+#define PCI_REG_VENDOR_ID   0x00
+#define PCI_REG_DEVICE_ID   0x02
+#define PCI_REG_COMMAND     0x04
+#define PCI_REG_PROG_IF     0x09
+#define PCI_REG_SUBCLASS    0x0A
+#define PCI_REG_CLASS       0x0B
+#define PCI_REG_HEADER_TYPE 0x0E
+#define PCI_REG_BAR0        0x10
+#define PCI_REG_IRQ_LINE    0x3C
+
+// Биты регистра команд
+#define PCI_CMD_IO_SPACE    0x0001
+#define PCI_CMD_MEM_SPACE   0x0002
+#define PCI_CMD_BUS_MASTER  0x0004
+
+// Классы устройств
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+#define PCI_SUBCLASS_SATA   0x06
+#define PCI_PROG_IF_AHCI    0x01
+#define PCI_SUBCLASS_NVME   0x08
+#define PCI_PROG_IF_NVME    0x02
+
+// virtio (legacy/transitional PCI ID)
+#define PCI_VENDOR_VIRTIO       0x1AF4
+#define PCI_DEVICE_VIRTIO_BLK   0x1001
+
+typedef struct {
+    uint8_t  bus;
+    uint8_t  slot;
+    uint8_t  func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t  class_code;
+    uint8_t  subclass;
+    uint8_t  prog_if;
+    uint8_t  irq;
+} pci_device_t;
+
 // Базовые функции PCI
 uint16_t pci_config_read_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint32_t pci_config_read_dword(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value);
 void pci_scan_bus();
 
+// Поиск устройства по классу/подклассу (index - какое по счёту совпадение вернуть)
+int pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_device_t* out);
+// То же самое, но по vendor/device ID
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, int index, pci_device_t* out);
+uint32_t pci_read_bar(const pci_device_t* dev, int bar);
+void pci_enable_bus_master(const pci_device_t* dev);
+
 #endif
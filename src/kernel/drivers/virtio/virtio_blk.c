@@ -0,0 +1,528 @@
+#include "virtio_blk.h"
+#include "../pci/pci.h"
+#include "../../utils/ports.h"
+#include "../../utils/string.h"
+#include "../../arch/i686/pic/pic.h"
+#include "../../arch/i686/timer/timer.h"
+
+/* The device has no command timeout of its own; this only catches a dead host */
+#define VBLK_TIMEOUT_MS     5000
+#define VBLK_SPIN_LIMIT     50000000
+
+typedef struct __attribute__((packed)) {
+    uint64_t    addr;
+    uint32_t    len;
+    uint16_t    flags;
+    uint16_t    next;
+} vring_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t    flags;
+    uint16_t    idx;
+    uint16_t    ring[];
+} vring_avail_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t    id;
+    uint32_t    len;
+} vring_used_elem_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t            flags;
+    uint16_t            idx;
+    vring_used_elem_t   ring[];
+} vring_used_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t    type;
+    uint32_t    reserved;
+    uint64_t    sector;
+} vblk_req_hdr_t;
+
+/* One request: header and status live here so the device can DMA them */
+typedef struct {
+    vblk_req_hdr_t      hdr;
+    volatile uint8_t    status;
+    int8_t              write;      /* 1 write, 0 read, -1 flush */
+    uint16_t            head;       /* First descriptor of the chain */
+    uint32_t            sectors;
+    uint64_t            start;
+} vblk_req_t;
+
+typedef struct {
+    virtio_blk_device_t     info;
+
+    vring_desc_t*           desc;
+    volatile vring_avail_t* avail;
+    volatile vring_used_t*  used;
+
+    uint16_t    free_head;          /* Free descriptors are chained through .next */
+    uint16_t    num_free;
+    uint16_t    avail_idx;          /* Our copy; published to the device by vblk_kick() */
+    uint16_t    last_used;
+    uint8_t     dead;               /* Stopped answering; every request fails */
+    uint32_t    features;           /* Negotiated feature bits */
+
+    uint32_t    busy;               /* Request slots in flight */
+    uint32_t    failed;             /* Completed with an error, not yet collected */
+    uint32_t    async;              /* Slots owned by blkdev_start() */
+    vblk_req_t  reqs[VIRTIO_BLK_MAX_REQS];
+    uint8_t     desc_req[VIRTIO_BLK_MAX_QUEUE];     /* Head descriptor -> request slot */
+} vblk_t;
+
+/* Ring memory for the largest queue we accept: desc + avail, padded, then used */
+#define VBLK_RING_BYTES  (3 * VRING_ALIGN)
+
+static uint8_t vblk_rings[VIRTIO_BLK_MAX_DEVICES][VBLK_RING_BYTES] __attribute__((aligned(VRING_ALIGN)));
+static vblk_t vblk_devices[VIRTIO_BLK_MAX_DEVICES];
+static int vblk_count = 0;
+static int vblk_initialized = 0;
+
+static int vblk_interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+/* Lines 0 (timer), 1 (keyboard), 2 (cascade) and 14/15 (IDE) can't be shared */
+static int vblk_irq_usable(uint8_t irq) {
+    return irq > 2 && irq < 14;
+}
+
+static uint32_t vblk_deadline(void) {
+    return get_ticks() + (VBLK_TIMEOUT_MS * get_timer_frequency()) / 1000 + 1;
+}
+
+static int vblk_expired(uint32_t deadline, uint32_t* spins) {
+    if ((int32_t)(get_ticks() - deadline) >= 0) return 1;
+    if (!vblk_interrupts_enabled() && ++(*spins) > VBLK_SPIN_LIMIT) return 1;
+    return 0;
+}
+
+static uint32_t vblk_config_read32(vblk_t* v, uint16_t offset) {
+    return inl(v->info.io_base + VIRTIO_REG_CONFIG + offset);
+}
+
+/* Lay the split ring out in the static area, as the legacy PFN register expects */
+static void vblk_setup_ring(vblk_t* v, uint8_t* mem) {
+    uint16_t n = v->info.queue_size;
+
+    memset(mem, 0, VBLK_RING_BYTES);
+    v->desc = (vring_desc_t*)mem;
+    v->avail = (volatile vring_avail_t*)(mem + n * sizeof(vring_desc_t));
+
+    uint32_t used_off = n * sizeof(vring_desc_t) + 4 + 2 * n + 2;
+    used_off = (used_off + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+    v->used = (volatile vring_used_t*)(mem + used_off);
+
+    for (uint16_t i = 0; i < n; i++) v->desc[i].next = (uint16_t)(i + 1);
+    v->free_head = 0;
+    v->num_free = n;
+    v->avail_idx = 0;
+    v->last_used = 0;
+
+    v->avail->flags = v->info.polling ? VRING_AVAIL_F_NO_INTERRUPT : 0;
+}
+
+/* Publish everything queued since the last kick with one index update and one notify */
+static void vblk_kick(vblk_t* v) {
+    if (v->avail->idx == v->avail_idx) return;
+
+    __sync_synchronize();
+    v->avail->idx = v->avail_idx;
+    __sync_synchronize();
+
+    if (!(v->used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(v->info.io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+    }
+}
+
+static void vblk_complete(vblk_t* v, int slot, int result, int timed_out) {
+    vblk_req_t* r = &v->reqs[slot];
+    uint32_t bit = 1u << slot;
+
+    blkdev_account(&v->info.stats, r->write, r->sectors, timer_elapsed_us(r->start), result);
+    if (timed_out) v->info.stats.timeouts++;
+
+    v->busy &= ~bit;
+    if (result < 0) v->failed |= bit;
+    else v->failed &= ~bit;
+}
+
+/* Return finished chains to the free list and complete their requests */
+static void vblk_reap(vblk_t* v) {
+    while (v->last_used != v->used->idx) {
+        __sync_synchronize();
+        vring_used_elem_t e = v->used->ring[v->last_used % v->info.queue_size];
+        v->last_used++;
+
+        uint16_t head = (uint16_t)e.id;
+        uint16_t tail = head;
+        uint16_t n = 1;
+        while (v->desc[tail].flags & VRING_DESC_F_NEXT) {
+            tail = v->desc[tail].next;
+            n++;
+        }
+        v->desc[tail].next = v->free_head;
+        v->free_head = head;
+        v->num_free += n;
+
+        int slot = v->desc_req[head];
+        vblk_complete(v, slot, v->reqs[slot].status == 0 ? 0 : -1, 0);
+    }
+}
+
+/*
+ * Wait for the device to post at least one completion. In interrupt mode we
+ * sleep with hlt; the PIT still wakes us every tick, so a lost IRQ only costs
+ * latency. Returns -1 on timeout.
+ */
+static int vblk_wait_used(vblk_t* v) {
+    uint32_t deadline = vblk_deadline();
+    uint32_t spins = 0;
+
+    if (v->info.polling || !vblk_interrupts_enabled()) {
+        while (v->last_used == v->used->idx) {
+            if (vblk_expired(deadline, &spins)) return -1;
+        }
+        return 0;
+    }
+
+    while (1) {
+        __asm__ volatile ("cli");
+        if (v->last_used != v->used->idx) {
+            __asm__ volatile ("sti");
+            return 0;
+        }
+        if (vblk_expired(deadline, &spins)) {
+            __asm__ volatile ("sti");
+            return -1;
+        }
+        /* sti takes effect after hlt starts, so the IRQ cannot slip in between */
+        __asm__ volatile ("sti; hlt");
+    }
+}
+
+/*
+ * Wait until no slot in mask is in flight. A timeout means the host has
+ * stopped servicing the ring; without a device reset the descriptors cannot
+ * be reclaimed, so the disk is marked dead.
+ */
+static void vblk_drain(vblk_t* v, uint32_t mask) {
+    vblk_kick(v);
+    vblk_reap(v);
+
+    while (v->busy & mask) {
+        if (vblk_wait_used(v) < 0) {
+            for (int i = 0; i < VIRTIO_BLK_MAX_REQS; i++) {
+                if (v->busy & (1u << i)) vblk_complete(v, i, -1, 1);
+            }
+            v->dead = 1;
+            return;
+        }
+        vblk_reap(v);
+    }
+}
+
+static int vblk_wait(vblk_t* v, uint32_t mask) {
+    vblk_drain(v, mask);
+
+    int result = (v->dead || (v->failed & mask)) ? -1 : 0;
+    v->failed &= ~mask;
+    return result;
+}
+
+/* Find a request slot with ndesc free descriptors, waiting for completions if needed */
+static int vblk_alloc(vblk_t* v, uint16_t ndesc) {
+    while (!v->dead) {
+        if (v->num_free >= ndesc) {
+            for (int i = 0; i < VIRTIO_BLK_MAX_REQS; i++) {
+                if (!(v->busy & (1u << i))) return i;
+            }
+        }
+        /* Ring or slots full: hand over what we have and wait for the oldest */
+        vblk_drain(v, v->busy & (~v->busy + 1));
+    }
+    return -1;
+}
+
+static uint16_t vblk_take_desc(vblk_t* v, uint64_t addr, uint32_t len, uint16_t flags) {
+    uint16_t i = v->free_head;
+    v->free_head = v->desc[i].next;
+    v->num_free--;
+
+    v->desc[i].addr = addr;
+    v->desc[i].len = len;
+    v->desc[i].flags = flags;
+    return i;
+}
+
+/*
+ * Chain header, data pieces and status into the ring. The request becomes
+ * visible to the device at the next vblk_kick(), which lets one notify cover
+ * a whole batch.
+ */
+static void vblk_queue(vblk_t* v, int slot, uint32_t type, uint64_t lba,
+                       const uint32_t* addr, const uint32_t* len, int npieces, int write) {
+    vblk_req_t* r = &v->reqs[slot];
+    uint32_t sectors = 0;
+
+    r->hdr.type = type;
+    r->hdr.reserved = 0;
+    r->hdr.sector = lba;
+    r->status = 0xFF;
+
+    uint16_t head = vblk_take_desc(v, (uint32_t)(uintptr_t)&r->hdr, sizeof(vblk_req_hdr_t), VRING_DESC_F_NEXT);
+    uint16_t prev = head;
+
+    for (int i = 0; i < npieces; i++) {
+        uint16_t d = vblk_take_desc(v, addr[i], len[i],
+                                    VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE));
+        v->desc[prev].next = d;
+        prev = d;
+        sectors += len[i] / VIRTIO_BLK_SECTOR_SIZE;
+    }
+
+    uint16_t st = vblk_take_desc(v, (uint32_t)(uintptr_t)&r->status, 1, VRING_DESC_F_WRITE);
+    v->desc[prev].next = st;
+
+    r->head = head;
+    r->write = (int8_t)(type == VIRTIO_BLK_T_FLUSH ? -1 : (write ? 1 : 0));
+    r->sectors = sectors;
+    r->start = timer_stamp();
+    v->desc_req[head] = (uint8_t)slot;
+    v->busy |= 1u << slot;
+
+    v->avail->ring[v->avail_idx % v->info.queue_size] = head;
+    v->avail_idx++;
+}
+
+/*
+ * Queue reads or writes over the segments as requests of up to seg_max
+ * descriptors, then kick once. Returns the slots used.
+ */
+static uint32_t vblk_issue_rw(vblk_t* v, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    uint32_t addr[VIRTIO_BLK_MAX_DATA_DESCS];
+    uint32_t len[VIRTIO_BLK_MAX_DATA_DESCS];
+    uint32_t mask = 0;
+    int seg = 0;
+    uint32_t seg_off = 0;
+
+    while (seg < nsegs && !v->dead) {
+        int npieces = 0;
+        uint32_t sectors = 0;
+
+        while (seg < nsegs && npieces < (int)v->info.seg_max && sectors < VIRTIO_BLK_MAX_SECTORS) {
+            uint32_t seg_bytes = segs[seg].count * VIRTIO_BLK_SECTOR_SIZE;
+            uint32_t bytes = seg_bytes - seg_off;
+            if (bytes > v->info.size_max) bytes = v->info.size_max;
+            if (bytes > (VIRTIO_BLK_MAX_SECTORS - sectors) * VIRTIO_BLK_SECTOR_SIZE) {
+                bytes = (VIRTIO_BLK_MAX_SECTORS - sectors) * VIRTIO_BLK_SECTOR_SIZE;
+            }
+
+            addr[npieces] = (uint32_t)(uintptr_t)segs[seg].buf + seg_off;
+            len[npieces] = bytes;
+            npieces++;
+
+            sectors += bytes / VIRTIO_BLK_SECTOR_SIZE;
+            seg_off += bytes;
+            if (seg_off == seg_bytes) {
+                seg++;
+                seg_off = 0;
+            }
+        }
+
+        int slot = vblk_alloc(v, (uint16_t)(npieces + 2));
+        if (slot < 0) break;
+
+        vblk_queue(v, slot, write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, lba, addr, len, npieces, write);
+        mask |= 1u << slot;
+        lba += sectors;
+    }
+
+    vblk_kick(v);
+    return mask;
+}
+
+static vblk_t* vblk_of(blkdev_t* dev) {
+    return &vblk_devices[(uintptr_t)dev->priv];
+}
+
+static int vblk_rw(blkdev_t* dev, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    vblk_t* v = vblk_of(dev);
+    if (write && v->info.read_only) return -1;
+    return vblk_wait(v, vblk_issue_rw(v, lba, segs, nsegs, write));
+}
+
+static int vblk_blk_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer) {
+    blkdev_seg_t seg = { buffer, count };
+    return vblk_rw(dev, lba, &seg, 1, 0);
+}
+
+static int vblk_blk_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buffer) {
+    blkdev_seg_t seg = { (void*)buffer, count };
+    return vblk_rw(dev, lba, &seg, 1, 1);
+}
+
+static int vblk_blk_submit(blkdev_t* dev, uint64_t lba, const blkdev_seg_t* segs, int nsegs, int write) {
+    return vblk_rw(dev, lba, segs, nsegs, write);
+}
+
+static int vblk_blk_flush(blkdev_t* dev) {
+    vblk_t* v = vblk_of(dev);
+
+    /* Without VIRTIO_BLK_F_FLUSH the host cache is write-through */
+    if (!(v->features & VIRTIO_BLK_F_FLUSH)) return 0;
+
+    int slot = vblk_alloc(v, 2);
+    if (slot < 0) return -1;
+
+    vblk_queue(v, slot, VIRTIO_BLK_T_FLUSH, 0, NULL, NULL, 0, 0);
+    return vblk_wait(v, 1u << slot);
+}
+
+static int vblk_blk_start(blkdev_t* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    vblk_t* v = vblk_of(dev);
+    if (v->async) return -1;
+    if (write && v->info.read_only) return -1;
+
+    blkdev_seg_t seg = { buffer, count };
+    v->async = vblk_issue_rw(v, lba, &seg, 1, write);
+    return v->async ? 0 : -1;
+}
+
+static int vblk_blk_finish(blkdev_t* dev) {
+    vblk_t* v = vblk_of(dev);
+    if (!v->async) return -1;
+
+    int result = vblk_wait(v, v->async);
+    v->async = 0;
+    return result;
+}
+
+static int vblk_blk_set_polling(blkdev_t* dev, int polling) {
+    return virtio_blk_set_polling((uint8_t)(uintptr_t)dev->priv, polling);
+}
+
+static const blkdev_ops_t vblk_blk_ops = {
+    .read = vblk_blk_read,
+    .write = vblk_blk_write,
+    .flush = vblk_blk_flush,
+    .submit = vblk_blk_submit,
+    .start = vblk_blk_start,
+    .finish = vblk_blk_finish,
+    .set_polling = vblk_blk_set_polling,
+};
+
+/* Legacy initialisation: reset, ACK, DRIVER, features, queue 0, DRIVER_OK */
+static int vblk_probe(vblk_t* v, uint8_t* ring) {
+    uint16_t io = v->info.io_base;
+
+    outb(io + VIRTIO_REG_STATUS, 0);
+    outb(io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK);
+    outb(io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    uint32_t offered = inl(io + VIRTIO_REG_DEVICE_FEATURES);
+    uint32_t wanted = offered & (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX |
+                                 VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+    outl(io + VIRTIO_REG_GUEST_FEATURES, wanted);
+    v->features = wanted;
+
+    outw(io + VIRTIO_REG_QUEUE_SELECT, 0);
+    uint16_t qsize = inw(io + VIRTIO_REG_QUEUE_SIZE);
+    if (qsize < 4 || qsize > VIRTIO_BLK_MAX_QUEUE) {
+        outb(io + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    v->info.queue_size = qsize;
+
+    v->info.size = (uint64_t)vblk_config_read32(v, VIRTIO_BLK_CFG_CAPACITY) |
+                   ((uint64_t)vblk_config_read32(v, VIRTIO_BLK_CFG_CAPACITY + 4) << 32);
+    v->info.read_only = (wanted & VIRTIO_BLK_F_RO) ? 1 : 0;
+
+    /* Descriptors per request: header + data + status must fit the ring */
+    v->info.seg_max = VIRTIO_BLK_MAX_DATA_DESCS;
+    if (wanted & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t seg_max = vblk_config_read32(v, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < v->info.seg_max) v->info.seg_max = seg_max;
+    }
+    if (v->info.seg_max > (uint32_t)qsize - 2) v->info.seg_max = qsize - 2;
+
+    v->info.size_max = VIRTIO_BLK_MAX_SECTORS * VIRTIO_BLK_SECTOR_SIZE;
+    if (wanted & VIRTIO_BLK_F_SIZE_MAX) {
+        uint32_t size_max = vblk_config_read32(v, VIRTIO_BLK_CFG_SIZE_MAX) & ~(VIRTIO_BLK_SECTOR_SIZE - 1);
+        if (size_max && size_max < v->info.size_max) v->info.size_max = size_max;
+    }
+
+    v->info.polling = vblk_irq_usable(v->info.irq) ? 0 : 1;
+
+    vblk_setup_ring(v, ring);
+    outl(io + VIRTIO_REG_QUEUE_PFN, (uint32_t)(uintptr_t)ring / VRING_ALIGN);
+
+    if (!v->info.polling) pic_clear_mask(v->info.irq);
+
+    outb(io + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    return (v->info.size > 0) ? 0 : -1;
+}
+
+int virtio_blk_init(void) {
+    if (vblk_initialized) return vblk_count;
+    vblk_initialized = 1;
+
+    pci_device_t pdev;
+    for (int i = 0; vblk_count < VIRTIO_BLK_MAX_DEVICES &&
+                    pci_find_device(PCI_VENDOR_VIRTIO, PCI_DEVICE_VIRTIO_BLK, i, &pdev) == 0; i++) {
+        uint32_t bar0 = pci_read_bar(&pdev, 0);
+        if (!(bar0 & 0x01)) continue;       /* Legacy interface is I/O space */
+
+        vblk_t* v = &vblk_devices[vblk_count];
+        memset(v, 0, sizeof(vblk_t));
+        v->info.io_base = (uint16_t)(bar0 & ~0x03u);
+        v->info.irq = pdev.irq;
+
+        pci_enable_bus_master(&pdev);
+        if (vblk_probe(v, vblk_rings[vblk_count]) < 0) continue;
+
+        v->info.present = 1;
+
+        char name[BLKDEV_NAME_LEN] = "vd0";
+        name[2] = (char)('0' + vblk_count);
+        blkdev_t* bd = blkdev_register(name, VIRTIO_BLK_SECTOR_SIZE, v->info.size, VIRTIO_BLK_MAX_REQS,
+                                       &vblk_blk_ops, (void*)(uintptr_t)vblk_count);
+        if (bd) {
+            bd->model = "virtio-blk";
+            bd->max_transfer = VIRTIO_BLK_MAX_SECTORS;
+            bd->stats = &v->info.stats;
+        }
+
+        vblk_count++;
+    }
+
+    return vblk_count;
+}
+
+virtio_blk_device_t* virtio_blk_get_device(uint8_t index) {
+    if (index >= vblk_count) return NULL;
+    return &vblk_devices[index].info;
+}
+
+int virtio_blk_set_polling(uint8_t index, int polling) {
+    if (index >= vblk_count) return -1;
+    vblk_t* v = &vblk_devices[index];
+
+    if (!polling && !vblk_irq_usable(v->info.irq)) return -1;
+
+    vblk_drain(v, v->busy);
+    v->info.polling = polling ? 1 : 0;
+    v->avail->flags = polling ? VRING_AVAIL_F_NO_INTERRUPT : 0;
+    if (!polling) pic_clear_mask(v->info.irq);
+    return 0;
+}
+
+void virtio_blk_irq_handler(uint8_t irq) {
+    for (int i = 0; i < vblk_count; i++) {
+        if (vblk_devices[i].info.irq != irq) continue;
+        /* Reading ISR status deasserts the (possibly shared) line */
+        inb(vblk_devices[i].info.io_base + VIRTIO_REG_ISR);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include "../block/blkdev.h"
+
+/* Legacy virtio PCI registers (offsets from the I/O BAR0) */
+#define VIRTIO_REG_DEVICE_FEATURES  0x00
+#define VIRTIO_REG_GUEST_FEATURES   0x04
+#define VIRTIO_REG_QUEUE_PFN        0x08
+#define VIRTIO_REG_QUEUE_SIZE       0x0C
+#define VIRTIO_REG_QUEUE_SELECT     0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY     0x10
+#define VIRTIO_REG_STATUS           0x12
+#define VIRTIO_REG_ISR              0x13
+#define VIRTIO_REG_CONFIG           0x14    /* Device config without MSI-X */
+
+#define VIRTIO_STATUS_ACK           0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+/* virtio-blk feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX       (1u << 1)
+#define VIRTIO_BLK_F_SEG_MAX        (1u << 2)
+#define VIRTIO_BLK_F_RO             (1u << 5)
+#define VIRTIO_BLK_F_FLUSH          (1u << 9)
+
+/* virtio-blk config space (offsets from VIRTIO_REG_CONFIG) */
+#define VIRTIO_BLK_CFG_CAPACITY     0x00    /* 64-bit, in 512-byte sectors */
+#define VIRTIO_BLK_CFG_SIZE_MAX     0x08
+#define VIRTIO_BLK_CFG_SEG_MAX      0x0C
+
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_T_FLUSH          4
+
+/* Split virtqueue */
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2       /* Device writes this buffer */
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+#define VRING_ALIGN                 4096
+
+#define VIRTIO_BLK_MAX_DEVICES      2
+#define VIRTIO_BLK_MAX_QUEUE        256     /* Largest ring we keep static memory for */
+#define VIRTIO_BLK_MAX_REQS         32      /* Requests in flight per device */
+#define VIRTIO_BLK_MAX_DATA_DESCS   16      /* Data descriptors per request */
+#define VIRTIO_BLK_MAX_SECTORS      2048    /* 1MB per request */
+#define VIRTIO_BLK_SECTOR_SIZE      512
+
+typedef struct {
+    uint8_t     present;
+    uint8_t     irq;            /* PCI interrupt line */
+    uint8_t     polling;        /* 1: spin on the used ring, 0: sleep until the IRQ */
+    uint8_t     read_only;
+    uint16_t    io_base;
+    uint16_t    queue_size;     /* Descriptors in the ring, set by the device */
+    uint64_t    size;           /* Sectors */
+    uint32_t    seg_max;        /* Data descriptors per request we will use */
+    uint32_t    size_max;       /* Bytes per data descriptor */
+    blkdev_stats_t stats;       /* Request counters for iostat */
+} virtio_blk_device_t;
+
+/* Find virtio-blk PCI functions and register them as vd0, vd1; safe to call again */
+int virtio_blk_init(void);
+
+virtio_blk_device_t* virtio_blk_get_device(uint8_t index);
+
+/* Switch completion between polling and interrupts */
+int virtio_blk_set_polling(uint8_t index, int polling);
+
+/* Called from the shared PCI IRQ path; acknowledges our ISR status */
+void virtio_blk_irq_handler(uint8_t irq);
+
+#endif
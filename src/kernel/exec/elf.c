@@ -8,7 +8,8 @@
 
 #define ELF_MAX_FILE_SIZE   (512 * 1024)
 
-static uint8_t elf_buffer[ELF_MAX_FILE_SIZE];
+/* Page aligned: fat_read() transfers whole runs straight into it */
+static uint8_t elf_buffer[ELF_MAX_FILE_SIZE] __attribute__((aligned(4096)));
 
 #define KERNEL_RESERVED_END 0x110000
 #define SAFE_LOAD_MAX       0xA00000
@@ -70,6 +71,10 @@ static int sys_file_remove(const char* path) {
     return fat_rm(path);
 }
 
+static int sys_file_sync(void) {
+    return fat_flush();
+}
+
 static int sys_file_mkdir(const char* path) {
     return fat_mkdir(path);
 }
@@ -133,7 +138,7 @@ static void setup_syscall_table(void) {
     syscall_table_t* table = (syscall_table_t*)SYSCALL_TABLE_ADDR;
 
     table->magic = SYSCALL_MAGIC_VALUE;
-    table->version = 3;
+    table->version = 4;
 
     table->print = sys_print;
     table->print_color = sys_print_color;
@@ -162,6 +167,8 @@ static void setup_syscall_table(void) {
 
     table->malloc = sys_malloc;
     table->free = sys_free;
+
+    table->file_sync = sys_file_sync;
 }
 
 elf_error_t elf_validate(const void* data, uint32_t size) {
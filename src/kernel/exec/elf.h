@@ -51,6 +51,8 @@ typedef struct {
     
     void*       (*malloc)(uint32_t size);
     void        (*free)(void* ptr);
+
+    int         (*file_sync)(void);
 } syscall_table_t;
 
 typedef struct {
@@ -1,8 +1,10 @@
 #include "fat.h"
-#include "../../drivers/ata/ata.h"
+#include "../../drivers/block/blkdev.h"
+#include "../../drivers/block/bcache.h"
 #include "../../drivers/vga/vga.h"
 #include "../../utils/string.h"
 #include "../../drivers/vga/colors.h"
+#include "../../arch/i686/timer/timer.h"
 
 
 typedef struct __attribute__((packed)) {
@@ -77,17 +79,18 @@ typedef struct __attribute__((packed)) {
 } fat_lfn_entry_t;
 
 #define MAX_SECTOR_SIZE     4096
+#define MAX_CLUSTER_SIZE    (64 * 1024)
 #define DIR_ENTRY_SIZE      32
 
 static struct {
     uint8_t     mounted;
-    uint8_t     drive;
+    blkdev_t*   dev;
     fat_type_t  type;
 
     uint16_t    bytes_per_sector;
     uint8_t     sectors_per_cluster;
     uint16_t    entries_per_sector;
-    uint8_t     ata_sectors_per_fs_sector;
+    uint8_t     dev_sectors_per_fs_sector;
 
     uint32_t    fat_start_sector;
     uint32_t    fat_size_sectors;
@@ -105,42 +108,100 @@ static struct {
 
     uint8_t     sector_buf[MAX_SECTOR_SIZE];
 
-    uint32_t    fat_cache_sector;
-    uint8_t     fat_cache[MAX_SECTOR_SIZE];
-    uint8_t     fat_cache_dirty;
+    uint8_t     num_fats;
 
 } fat_state;
 
-static int read_sector(uint32_t sector, void* buffer) {
-    if (fat_state.bytes_per_sector == 512) {
-        return ata_read_sectors(fat_state.drive, sector, 1, buffer);
-    }
+/* Whole-cluster bounce buffer for data transfers */
+static uint8_t cluster_buf[MAX_CLUSTER_SIZE] __attribute__((aligned(4)));
 
-    uint32_t ata_sector = sector * fat_state.ata_sectors_per_fs_sector;
-    uint8_t* buf = (uint8_t*)buffer;
+/* Zero-padded last sector of a queued file write */
+static uint8_t tail_buf[MAX_SECTOR_SIZE] __attribute__((aligned(4)));
 
-    for (int i = 0; i < fat_state.ata_sectors_per_fs_sector; i++) {
-        if (ata_read_sectors(fat_state.drive, ata_sector + i, 1, buf + (i * 512)) < 0) {
-            return -1;
-        }
-    }
-    return 0;
+/*
+ * Read-ahead: clusters fetched ahead of a sequential reader, in chain
+ * order. The window starts small and doubles each time a stream runs
+ * off the end of what was prefetched.
+ */
+#define RA_BUF_SIZE         (128 * 1024)
+#define RA_MAX_CLUSTERS     (RA_BUF_SIZE / 512)
+#define RA_INIT_WINDOW      2
+#define RA_DIRECT_MIN       (32 * 1024)     /* Reads this long bypass the buffer */
+
+static uint8_t ra_buf[RA_BUF_SIZE] __attribute__((aligned(4096)));
+
+static struct {
+    uint32_t        clusters[RA_MAX_CLUSTERS];
+    uint32_t        count;          /* Clusters held in ra_buf */
+    uint32_t        next;           /* Chain successor of the last cluster handed out */
+    fat_ra_stats_t  stats;
+} ra;
+
+/*
+ * Metadata (FAT, directories) goes through the buffer cache one FS sector
+ * at a time; file data is transferred directly in whole runs.
+ */
+static uint64_t fs_to_dev_lba(uint32_t sector) {
+    return (uint64_t)sector * fat_state.dev_sectors_per_fs_sector;
+}
+
+static int read_sectors(uint32_t sector, uint32_t count, void* buffer) {
+    return bcache_read_direct(fat_state.dev, fs_to_dev_lba(sector),
+                              count * fat_state.dev_sectors_per_fs_sector, buffer);
+}
+
+static int write_sectors(uint32_t sector, uint32_t count, const void* buffer) {
+    ra.count = 0;
+    return bcache_write_direct(fat_state.dev, fs_to_dev_lba(sector),
+                               count * fat_state.dev_sectors_per_fs_sector, buffer);
+}
+
+/* Data write issued by the elevator at the next fat_sync(); buffer must stay valid until then */
+static int queue_sectors(uint32_t sector, uint32_t count, const void* buffer) {
+    ra.count = 0;
+    return bcache_write_queued(fat_state.dev, fs_to_dev_lba(sector),
+                               count * fat_state.dev_sectors_per_fs_sector, buffer);
+}
+
+static int read_sector(uint32_t sector, void* buffer) {
+    return bcache_read(fat_state.dev, fs_to_dev_lba(sector), fat_state.bytes_per_sector, buffer);
 }
 
 static int write_sector(uint32_t sector, const void* buffer) {
-    if (fat_state.bytes_per_sector == 512) {
-        return ata_write_sectors(fat_state.drive, sector, 1, buffer);
-    }
+    ra.count = 0;
+    return bcache_write(fat_state.dev, fs_to_dev_lba(sector), fat_state.bytes_per_sector, buffer);
+}
 
-    uint32_t ata_sector = sector * fat_state.ata_sectors_per_fs_sector;
-    const uint8_t* buf = (const uint8_t*)buffer;
+/*
+ * Directory entries are modified through one held sector: entries that
+ * land in the same sector share a single read and a single write, issued
+ * when the update moves on to another sector or commits. Every update
+ * commits before it returns, so nothing stays held between calls.
+ */
+static uint8_t dirtx_buf[MAX_SECTOR_SIZE] __attribute__((aligned(4)));
 
-    for (int i = 0; i < fat_state.ata_sectors_per_fs_sector; i++) {
-        if (ata_write_sectors(fat_state.drive, ata_sector + i, 1, buf + (i * 512)) < 0) {
-            return -1;
-        }
+static struct {
+    uint32_t    sector;         /* Sector held in dirtx_buf, 0 = none */
+    uint8_t     dirty;
+} dirtx;
+
+static int dirtx_commit(void) {
+    int result = 0;
+    if (dirtx.sector != 0 && dirtx.dirty) result = write_sector(dirtx.sector, dirtx_buf);
+    dirtx.sector = 0;
+    dirtx.dirty = 0;
+    return result;
+}
+
+/* Entry `index` of directory sector `sector`, about to be modified; NULL on I/O error */
+static fat_dir_entry_t* dirtx_entry(uint32_t sector, uint16_t index) {
+    if (sector != dirtx.sector) {
+        if (dirtx_commit() < 0) return NULL;
+        if (read_sector(sector, dirtx_buf) < 0) return NULL;
+        dirtx.sector = sector;
     }
-    return 0;
+    dirtx.dirty = 1;
+    return &((fat_dir_entry_t*)dirtx_buf)[index];
 }
 
 static void to_upper(char* str) {
@@ -155,68 +216,218 @@ static uint32_t cluster_to_sector(uint32_t cluster) {
            (cluster - 2) * fat_state.sectors_per_cluster;
 }
 
-static int fat_cache_load(uint32_t sector) {
-    if (fat_state.fat_cache_sector == sector) return 0;
+/* FS sectors of a cluster that fit in cluster_buf at once */
+static uint32_t cluster_chunk_sectors(void) {
+    uint32_t max = MAX_CLUSTER_SIZE / fat_state.bytes_per_sector;
+    return (fat_state.sectors_per_cluster < max) ? fat_state.sectors_per_cluster : max;
+}
 
-    if (fat_state.fat_cache_dirty) {
-        write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-        fat_state.fat_cache_dirty = 0;
+/*
+ * FAT table cache. A FAT that fits in fatc_buf (every FAT12/16 volume and
+ * small FAT32 ones) is read whole at mount and stays resident. Larger FAT32
+ * tables are cached in FATC_SLOT_BYTES chunks with LRU replacement; a
+ * sequential scan pulls in FATC_PREFETCH chunks with one read. Dirty state
+ * is a bit per FS sector of fatc_buf, so write-back merges neighbouring
+ * sectors into one write per FAT copy.
+ */
+#define FATC_BYTES          (128 * 1024)
+#define FATC_SLOT_BYTES     4096
+#define FATC_SLOTS          (FATC_BYTES / FATC_SLOT_BYTES)
+#define FATC_PREFETCH       4
+#define FATC_MAX_BITS       (FATC_BYTES / 512)
+#define FATC_EMPTY          0xFFFFFFFF
+
+static uint8_t fatc_buf[FATC_BYTES] __attribute__((aligned(4096)));
+
+static struct {
+    uint8_t     resident;
+    uint32_t    slot_sectors;               /* FS sectors per LRU chunk */
+    uint32_t    chunk[FATC_SLOTS];          /* Chunk held by each slot, or FATC_EMPTY */
+    uint32_t    used[FATC_SLOTS];           /* LRU stamp */
+    uint32_t    clock;
+    uint32_t    last_miss;                  /* Chunk loaded last, to spot scans */
+    int         last_slot;
+    uint32_t    dirty[FATC_MAX_BITS / 32];  /* Bit per FS sector of fatc_buf */
+} fatc;
+
+static int fatc_is_dirty(uint32_t bit) {
+    return (fatc.dirty[bit / 32] >> (bit % 32)) & 1;
+}
+
+/* FAT-relative sector held at bit (buffer sector) */
+static uint32_t fatc_sector_of(uint32_t bit) {
+    if (fatc.resident) return bit;
+    uint32_t slot = bit / fatc.slot_sectors;
+    if (fatc.chunk[slot] == FATC_EMPTY) return FATC_EMPTY;
+    return fatc.chunk[slot] * fatc.slot_sectors + bit % fatc.slot_sectors;
+}
+
+/* Write dirty sectors among bits [first, first + count), in runs, to every FAT copy */
+static int fatc_writeback(uint32_t first, uint32_t count) {
+    uint16_t bps = fat_state.bytes_per_sector;
+    int result = 0;
+
+    for (uint32_t bit = first; bit < first + count; bit++) {
+        if (!fatc_is_dirty(bit)) continue;
+
+        uint32_t sector = fatc_sector_of(bit);
+        uint32_t run = 1;
+        while (bit + run < first + count && fatc_is_dirty(bit + run) &&
+               fatc_sector_of(bit + run) == sector + run) {
+            run++;
+        }
+
+        for (uint8_t copy = 0; copy < fat_state.num_fats; copy++) {
+            uint32_t lba = fat_state.fat_start_sector + copy * fat_state.fat_size_sectors + sector;
+            if (write_sectors(lba, run, fatc_buf + bit * bps) < 0) result = -1;
+        }
+        for (uint32_t i = 0; i < run; i++) {
+            fatc.dirty[(bit + i) / 32] &= ~(1u << ((bit + i) % 32));
+        }
+        bit += run - 1;
     }
+    return result;
+}
 
-    if (read_sector(sector, fat_state.fat_cache) < 0) return -1;
-    fat_state.fat_cache_sector = sector;
-    return 0;
+static int fatc_flush(void) {
+    return fatc_writeback(0, FATC_BYTES / fat_state.bytes_per_sector);
 }
 
-static uint32_t fat_get_entry(uint32_t cluster) {
-    uint32_t fat_offset;
-    uint32_t fat_sector;
-    uint32_t ent_offset;
-    uint32_t value = 0;
+static int fatc_init(void) {
     uint16_t bps = fat_state.bytes_per_sector;
 
-    switch (fat_state.type) {
-        case FAT_TYPE_12:
-            fat_offset = cluster + (cluster / 2);
-            fat_sector = fat_state.fat_start_sector + (fat_offset / bps);
-            ent_offset = fat_offset % bps;
+    memset(&fatc, 0, sizeof(fatc));
+    fatc.last_miss = FATC_EMPTY;
 
-            if (fat_cache_load(fat_sector) < 0) return 0xFFFFFFFF;
+    if ((uint64_t)fat_state.fat_size_sectors * bps <= FATC_BYTES) {
+        fatc.resident = 1;
+        return read_sectors(fat_state.fat_start_sector, fat_state.fat_size_sectors, fatc_buf);
+    }
 
-            value = fat_state.fat_cache[ent_offset];
+    fatc.slot_sectors = FATC_SLOT_BYTES / bps;
+    for (int i = 0; i < FATC_SLOTS; i++) fatc.chunk[i] = FATC_EMPTY;
+    return 0;
+}
 
-            if (ent_offset == (uint32_t)(bps - 1)) {
-                if (fat_cache_load(fat_sector + 1) < 0) return 0xFFFFFFFF;
-                value |= ((uint32_t)fat_state.fat_cache[0]) << 8;
-            } else {
-                value |= ((uint32_t)fat_state.fat_cache[ent_offset + 1]) << 8;
+/* Drop slots [first, first + count) after writing them back */
+static int fatc_evict(int first, int count) {
+    int result = fatc_writeback(first * fatc.slot_sectors, count * fatc.slot_sectors);
+    for (int i = first; i < first + count; i++) fatc.chunk[i] = FATC_EMPTY;
+    return result;
+}
+
+/* Bring chunk (and, on a sequential scan, the ones after it) into the cache */
+static int fatc_load(uint32_t chunk) {
+    uint32_t chunks = (fat_state.fat_size_sectors + fatc.slot_sectors - 1) / fatc.slot_sectors;
+    int n = 1;
+    if (chunk == fatc.last_miss + 1) n = FATC_PREFETCH;
+    if (chunk + n > chunks) n = (int)(chunks - chunk);
+
+    /* Victim: the group of n neighbouring slots whose newest use is oldest */
+    int base = 0;
+    uint32_t best = 0xFFFFFFFF;
+    for (int g = 0; g + n <= FATC_SLOTS; g += n) {
+        uint32_t newest = 0;
+        for (int i = g; i < g + n; i++) {
+            uint32_t u = (fatc.chunk[i] == FATC_EMPTY) ? 0 : fatc.used[i];
+            if (u > newest) newest = u;
+        }
+        if (newest < best) {
+            best = newest;
+            base = g;
+        }
+    }
+
+    /* Chunks already cached elsewhere would end up twice */
+    for (int i = 0; i < FATC_SLOTS; i++) {
+        if (i >= base && i < base + n) continue;
+        if (fatc.chunk[i] != FATC_EMPTY && fatc.chunk[i] >= chunk && fatc.chunk[i] < chunk + n) {
+            fatc_evict(i, 1);
+        }
+    }
+    fatc_evict(base, n);
+
+    uint32_t first = chunk * fatc.slot_sectors;
+    uint32_t count = (uint32_t)n * fatc.slot_sectors;
+    if (first + count > fat_state.fat_size_sectors) count = fat_state.fat_size_sectors - first;
+
+    if (read_sectors(fat_state.fat_start_sector + first, count,
+                     fatc_buf + base * FATC_SLOT_BYTES) < 0) return -1;
+
+    for (int i = 0; i < n; i++) {
+        fatc.chunk[base + i] = chunk + i;
+        fatc.used[base + i] = ++fatc.clock;
+    }
+    fatc.last_miss = chunk + n - 1;
+    return base;
+}
+
+/* Pointer to byte `offset` of the FAT; marks its sector dirty when asked */
+static uint8_t* fatc_ptr(uint32_t offset, int dirty) {
+    uint16_t bps = fat_state.bytes_per_sector;
+    uint32_t pos;
+
+    /* A corrupt chain can name a cluster past the end of the table */
+    if (offset >= fat_state.fat_size_sectors * bps) return NULL;
+
+    if (fatc.resident) {
+        pos = offset;
+    } else {
+        uint32_t chunk = offset / FATC_SLOT_BYTES;
+        int slot = fatc.last_slot;
+
+        if (fatc.chunk[slot] != chunk) {
+            slot = -1;
+            for (int i = 0; i < FATC_SLOTS; i++) {
+                if (fatc.chunk[i] == chunk) {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot < 0) {
+                slot = fatc_load(chunk);
+                if (slot < 0) return NULL;
             }
+            fatc.last_slot = slot;
+        }
+        fatc.used[slot] = ++fatc.clock;
+        pos = (uint32_t)slot * FATC_SLOT_BYTES + offset % FATC_SLOT_BYTES;
+    }
+
+    if (dirty) fatc.dirty[(pos / bps) / 32] |= 1u << ((pos / bps) % 32);
+    return fatc_buf + pos;
+}
+
+static uint32_t fat_get_entry(uint32_t cluster) {
+    uint32_t value;
+    uint8_t* p;
+
+    switch (fat_state.type) {
+        case FAT_TYPE_12: {
+            uint32_t fat_offset = cluster + (cluster / 2);
+
+            /* The two bytes may sit in different sectors (or chunks) */
+            if (!(p = fatc_ptr(fat_offset, 0))) return 0xFFFFFFFF;
+            value = *p;
+            if (!(p = fatc_ptr(fat_offset + 1, 0))) return 0xFFFFFFFF;
+            value |= (uint32_t)*p << 8;
 
             if (cluster & 1) value >>= 4;
             else value &= 0x0FFF;
 
             if (value >= 0x0FF8) value = 0x0FFFFFFF;
             break;
+        }
 
         case FAT_TYPE_16:
-            fat_offset = cluster * 2;
-            fat_sector = fat_state.fat_start_sector + (fat_offset / bps);
-            ent_offset = fat_offset % bps;
-
-            if (fat_cache_load(fat_sector) < 0) return 0xFFFFFFFF;
-
-            value = *(uint16_t*)&fat_state.fat_cache[ent_offset];
+            if (!(p = fatc_ptr(cluster * 2, 0))) return 0xFFFFFFFF;
+            value = *(uint16_t*)p;
             if (value >= 0xFFF8) value = 0x0FFFFFFF;
             break;
 
         case FAT_TYPE_32:
-            fat_offset = cluster * 4;
-            fat_sector = fat_state.fat_start_sector + (fat_offset / bps);
-            ent_offset = fat_offset % bps;
-
-            if (fat_cache_load(fat_sector) < 0) return 0xFFFFFFFF;
-
-            value = *(uint32_t*)&fat_state.fat_cache[ent_offset] & 0x0FFFFFFF;
+            if (!(p = fatc_ptr(cluster * 4, 0))) return 0xFFFFFFFF;
+            value = *(uint32_t*)p & 0x0FFFFFFF;
             if (value >= 0x0FFFFFF8) value = 0x0FFFFFFF;
             break;
 
@@ -227,68 +438,516 @@ static uint32_t fat_get_entry(uint32_t cluster) {
     return value;
 }
 
+/*
+ * Free-cluster accounting. A bitmap of used clusters is built at mount so
+ * allocation scans words, not FAT entries, starting from a rolling
+ * next-free hint; the free count makes df O(1). Volumes with more
+ * clusters than the bitmap covers keep the count and hint and fall back
+ * to scanning the (cached) FAT. On FAT32 both values are written back to
+ * the FSInfo sector at sync.
+ */
+#define FREEMAP_BITS        (2 * 1024 * 1024)
+#define FSINFO_LEAD_SIG     0x41615252
+#define FSINFO_STRUCT_SIG   0x61417272
+#define FSINFO_TRAIL_SIG    0xAA550000
+#define FSINFO_UNKNOWN      0xFFFFFFFF
+
+static uint32_t freemap[FREEMAP_BITS / 32];
+
+static struct {
+    uint8_t     enabled;            /* freemap covers the volume */
+    uint32_t    free_count;
+    uint32_t    next_free;          /* Where the next search starts */
+    uint32_t    fsinfo_sector;      /* 0 when the volume has none */
+    uint8_t     fsinfo_dirty;
+} fsm;
+
+static int freemap_used(uint32_t cluster) {
+    return (freemap[cluster / 32] >> (cluster % 32)) & 1;
+}
+
+/* Keep the bitmap and count in step with a FAT entry about to change */
+static void freemap_update(uint32_t cluster, uint32_t old_value, uint32_t value) {
+    int was_used = fsm.enabled ? freemap_used(cluster) : (old_value != 0);
+    int used = (value != 0);
+    if (was_used == used) return;
+
+    if (fsm.enabled) {
+        if (used) freemap[cluster / 32] |= 1u << (cluster % 32);
+        else freemap[cluster / 32] &= ~(1u << (cluster % 32));
+    }
+
+    if (used) {
+        fsm.free_count--;
+    } else {
+        fsm.free_count++;
+        if (cluster < fsm.next_free) fsm.next_free = cluster;
+    }
+    fsm.fsinfo_dirty = 1;
+}
+
+/* FSInfo holds hints only; anything out of range is ignored */
+static void fsinfo_read(uint32_t* free_count, uint32_t* next_free) {
+    *free_count = FSINFO_UNKNOWN;
+    *next_free = FSINFO_UNKNOWN;
+    if (!fsm.fsinfo_sector) return;
+    if (read_sector(fsm.fsinfo_sector, fat_state.sector_buf) < 0) return;
+
+    uint32_t* w = (uint32_t*)fat_state.sector_buf;
+    if (w[0] != FSINFO_LEAD_SIG || w[484 / 4] != FSINFO_STRUCT_SIG) return;
+
+    if (w[488 / 4] <= fat_state.total_clusters) *free_count = w[488 / 4];
+    if (w[492 / 4] >= 2 && w[492 / 4] < fat_state.total_clusters + 2) *next_free = w[492 / 4];
+}
+
+static void fsinfo_write(void) {
+    if (!fsm.fsinfo_sector || !fsm.fsinfo_dirty) return;
+    if (read_sector(fsm.fsinfo_sector, fat_state.sector_buf) < 0) return;
+
+    uint32_t* w = (uint32_t*)fat_state.sector_buf;
+    if (w[0] != FSINFO_LEAD_SIG || w[484 / 4] != FSINFO_STRUCT_SIG) return;
+
+    w[488 / 4] = fsm.free_count;
+    w[492 / 4] = fsm.next_free;
+    if (write_sector(fsm.fsinfo_sector, fat_state.sector_buf) == 0) fsm.fsinfo_dirty = 0;
+}
+
+static void freemap_init(uint32_t fsinfo_sector) {
+    uint32_t end = fat_state.total_clusters + 2;
+    uint32_t info_free, info_next;
+
+    memset(&fsm, 0, sizeof(fsm));
+    fsm.fsinfo_sector = fsinfo_sector;
+    fsinfo_read(&info_free, &info_next);
+    fsm.next_free = (info_next != FSINFO_UNKNOWN) ? info_next : 2;
+
+    if (end > FREEMAP_BITS) {
+        /* Too big to map: trust FSInfo if it has a count, otherwise count once */
+        if (info_free != FSINFO_UNKNOWN) {
+            fsm.free_count = info_free;
+            return;
+        }
+        for (uint32_t c = 2; c < end; c++) {
+            if (fat_get_entry(c) == 0) fsm.free_count++;
+        }
+        fsm.fsinfo_dirty = 1;
+        return;
+    }
+
+    fsm.enabled = 1;
+    memset(freemap, 0, ((end + 31) / 32) * 4);
+    freemap[0] |= 0x3;                              /* Clusters 0 and 1 do not exist */
+    for (uint32_t c = 2; c < end; c++) {
+        if (fat_get_entry(c) != 0) freemap[c / 32] |= 1u << (c % 32);
+        else fsm.free_count++;
+    }
+    /* Bits past the last cluster count as used so word scans skip them */
+    for (uint32_t c = end; c < ((end + 31) & ~31u); c++) freemap[c / 32] |= 1u << (c % 32);
+
+    if (fsm.free_count != info_free) fsm.fsinfo_dirty = 1;
+}
+
+/* First free cluster at or after `from`, wrapping once; 0 if the volume is full */
+static uint32_t freemap_find(uint32_t from) {
+    uint32_t end = fat_state.total_clusters + 2;
+    if (fsm.free_count == 0) return 0;
+    if (from < 2 || from >= end) from = 2;
+
+    if (!fsm.enabled) {
+        for (uint32_t n = 0, c = from; n < end - 2; n++) {
+            if (fat_get_entry(c) == 0) return c;
+            if (++c >= end) c = 2;
+        }
+        return 0;
+    }
+
+    uint32_t words = (end + 31) / 32;
+    uint32_t w = from / 32;
+    uint32_t word = freemap[w] | ((1u << (from % 32)) - 1);    /* Ignore bits before `from` */
+
+    for (uint32_t n = 0; n <= words; n++) {
+        if (word != 0xFFFFFFFF) {
+            uint32_t bit = 0;
+            while (word & (1u << bit)) bit++;
+            return w * 32 + bit;
+        }
+        if (++w >= words) w = 0;
+        word = freemap[w];
+    }
+    return 0;
+}
+
+/* Free runs starting in [from, to); records the longest, returns 1 once one reaches want */
+static int freemap_scan_runs(uint32_t from, uint32_t to, uint32_t want,
+                             uint32_t* best, uint32_t* best_len) {
+    uint32_t end = fat_state.total_clusters + 2;
+
+    for (uint32_t c = from; c < to; ) {
+        if ((c % 32) == 0 && freemap[c / 32] == 0xFFFFFFFF) {
+            c += 32;
+            continue;
+        }
+        if (freemap_used(c)) {
+            c++;
+            continue;
+        }
+
+        uint32_t len = 0;
+        while (c + len < end && len < want && !freemap_used(c + len)) len++;
+        if (len > *best_len) {
+            *best = c;
+            *best_len = len;
+        }
+        if (len >= want) return 1;
+        c += len;
+    }
+    return 0;
+}
+
+/*
+ * Find room for `want` clusters: the first free run that long at or after
+ * the hint, else the longest run on the volume so the file gets as few
+ * fragments as possible. Without the bitmap, the run at the first free
+ * cluster is taken as it is.
+ */
+static uint32_t freemap_find_run(uint32_t want, uint32_t* out_len) {
+    uint32_t end = fat_state.total_clusters + 2;
+    uint32_t best = 0, best_len = 0;
+
+    *out_len = 0;
+    uint32_t first = freemap_find(fsm.next_free);
+    if (first == 0) return 0;
+
+    if (!fsm.enabled) {
+        best_len = 1;
+        while (first + best_len < end && best_len < want && fat_get_entry(first + best_len) == 0) {
+            best_len++;
+        }
+        *out_len = best_len;
+        return first;
+    }
+
+    if (!freemap_scan_runs(first, end, want, &best, &best_len)) {
+        freemap_scan_runs(2, first, want, &best, &best_len);
+    }
+
+    *out_len = best_len;
+    return best;
+}
+
+/* Sync point: write back dirty FAT sectors, FSInfo and buffers, then flush the drive */
+static int fat_sync(void) {
+    int result = fatc_flush();
+    fsinfo_write();
+    if (bcache_sync(fat_state.dev) < 0) result = -1;
+    return result;
+}
+
+/* Clusters to KB; 64-bit product, shifted rather than divided */
+static uint32_t clusters_to_kb(uint32_t clusters) {
+    uint64_t bytes = (uint64_t)clusters * fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+    return (uint32_t)(bytes >> 10);
+}
+
+uint32_t fat_free_space(void) {
+    if (!fat_state.mounted) return 0;
+    return clusters_to_kb(fsm.free_count);
+}
+
+uint32_t fat_total_space(void) {
+    if (!fat_state.mounted) return 0;
+    return clusters_to_kb(fat_state.total_clusters);
+}
+
+static void ra_reset(void) {
+    ra.count = 0;
+    ra.next = 0;
+    ra.stats.window = RA_INIT_WINDOW;
+}
+
+/* Fill ra_buf with up to `window` clusters of the chain starting at `cluster` */
+static int ra_fill(uint32_t cluster, uint32_t window) {
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+
+    ra.count = 0;
+    ra.clusters[0] = cluster;
+    uint32_t n = 1;
+    while (n < window) {
+        uint32_t c = fat_get_entry(ra.clusters[n - 1]);
+        if (c < 2 || c >= 0x0FFFFFF8) break;
+        ra.clusters[n++] = c;
+    }
+
+    /* One request per physically contiguous run */
+    for (uint32_t i = 0; i < n; ) {
+        uint32_t j = i + 1;
+        while (j < n && ra.clusters[j] == ra.clusters[j - 1] + 1) j++;
+
+        if (read_sectors(cluster_to_sector(ra.clusters[i]),
+                         (j - i) * fat_state.sectors_per_cluster, ra_buf + i * csize) < 0) {
+            return -1;
+        }
+        ra.stats.requests++;
+        i = j;
+    }
+
+    ra.count = n;
+    ra.stats.prefetched += n - 1;
+    return 0;
+}
+
+/* Return the data of one whole cluster, reading ahead along the chain */
+static const uint8_t* ra_get_cluster(uint32_t cluster) {
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+    int sequential = (cluster == ra.next);
+
+    ra.next = fat_get_entry(cluster);
+
+    for (uint32_t i = 0; i < ra.count; i++) {
+        if (ra.clusters[i] == cluster) {
+            ra.stats.hits++;
+            return ra_buf + i * csize;
+        }
+    }
+
+    uint32_t max_window = RA_BUF_SIZE / csize;
+    if (sequential) {
+        ra.stats.window <<= 1;
+    } else {
+        ra.stats.window = RA_INIT_WINDOW;
+    }
+    if (ra.stats.window > max_window) ra.stats.window = max_window;
+    if (ra.stats.window > ra.stats.max_window) ra.stats.max_window = ra.stats.window;
+
+    if (ra_fill(cluster, ra.stats.window) < 0) {
+        ra.count = 0;
+        return NULL;
+    }
+    return ra_buf;
+}
+
+void fat_get_ra_stats(fat_ra_stats_t* stats) {
+    memcpy(stats, &ra.stats, sizeof(fat_ra_stats_t));
+}
+
+/*
+ * Extent maps: the cluster chains of recently accessed files kept as runs
+ * of consecutive clusters, so a positioned access finds its cluster with a
+ * binary search instead of walking the chain from the start. A map only
+ * covers as much of the chain as accesses have reached and is extended
+ * lazily. It is dropped when the chain is freed (always from its first
+ * cluster) and reopened when something is linked past its end.
+ */
+#define EXT_MAPS            8
+#define EXT_RUNS            128
+
+typedef struct {
+    uint32_t    index;          /* File cluster index of the first cluster in the run */
+    uint32_t    cluster;
+    uint32_t    len;
+} ext_run_t;
+
+static struct {
+    uint32_t    first;          /* First cluster of the chain, 0 if the slot is unused */
+    uint32_t    mapped;         /* File clusters covered by runs */
+    uint32_t    count;          /* Runs in use */
+    uint32_t    used;           /* LRU stamp */
+    uint8_t     complete;       /* Runs reach the end of the chain */
+    ext_run_t   runs[EXT_RUNS];
+} ext[EXT_MAPS];
+
+static uint32_t ext_clock;
+
+static void ext_reset(void) {
+    for (int i = 0; i < EXT_MAPS; i++) ext[i].first = 0;
+}
+
+/* Called for every FAT entry update */
+static void ext_note_entry(uint32_t cluster, uint32_t value) {
+    for (int i = 0; i < EXT_MAPS; i++) {
+        if (ext[i].first == 0) continue;
+        if (ext[i].first == cluster && value == 0) {
+            ext[i].first = 0;
+        } else if (ext[i].complete) {
+            ext_run_t* r = &ext[i].runs[ext[i].count - 1];
+            if (r->cluster + r->len - 1 == cluster) ext[i].complete = 0;
+        }
+    }
+}
+
+/* Map for the chain starting at `first`, taking the least recently used slot if there is none */
+static int ext_get(uint32_t first) {
+    int victim = 0;
+
+    for (int i = 0; i < EXT_MAPS; i++) {
+        if (ext[i].first == first) {
+            ext[i].used = ++ext_clock;
+            return i;
+        }
+        if (ext[victim].first == 0) continue;
+        if (ext[i].first == 0 || ext[i].used < ext[victim].used) victim = i;
+    }
+
+    ext[victim].first = first;
+    ext[victim].mapped = 1;
+    ext[victim].count = 1;
+    ext[victim].complete = 0;
+    ext[victim].used = ++ext_clock;
+    ext[victim].runs[0].index = 0;
+    ext[victim].runs[0].cluster = first;
+    ext[victim].runs[0].len = 1;
+    return victim;
+}
+
+/*
+ * Cluster at file cluster index `index` of the chain starting at `first`,
+ * or 0 past the end of the chain. *out_run (if not NULL) gets how many
+ * clusters from there on are known to be contiguous. Beyond EXT_RUNS
+ * fragments the rest of the chain is walked from the end of the map.
+ */
+static uint32_t ext_cluster_at(uint32_t first, uint32_t index, uint32_t* out_run) {
+    if (first < 2 || first >= 0x0FFFFFF8) return 0;
+
+    int m = ext_get(first);
+    ext_run_t* runs = ext[m].runs;
+
+    while (!ext[m].complete) {
+        ext_run_t* r = &runs[ext[m].count - 1];
+
+        /* Once `index` is mapped, the run holding it is still followed to its end */
+        if (ext[m].mapped > index && r->index > index) break;
+
+        uint32_t tail = r->cluster + r->len - 1;
+        uint32_t next = fat_get_entry(tail);
+
+        if (next < 2 || next >= 0x0FFFFFF8) {
+            ext[m].complete = 1;
+            break;
+        }
+        if (next == tail + 1) {
+            r->len++;
+        } else if (ext[m].count < EXT_RUNS) {
+            r = &runs[ext[m].count++];
+            r->index = ext[m].mapped;
+            r->cluster = next;
+            r->len = 1;
+        } else {
+            break;
+        }
+        ext[m].mapped++;
+    }
+
+    if (index < ext[m].mapped) {
+        uint32_t lo = 0, hi = ext[m].count - 1;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            if (runs[mid].index <= index) lo = mid;
+            else hi = mid - 1;
+        }
+        if (out_run) *out_run = runs[lo].len - (index - runs[lo].index);
+        return runs[lo].cluster + (index - runs[lo].index);
+    }
+    if (ext[m].complete) return 0;
+
+    ext_run_t* r = &runs[ext[m].count - 1];
+    uint32_t c = r->cluster + r->len - 1;
+    for (uint32_t i = ext[m].mapped - 1; i < index; i++) {
+        c = fat_get_entry(c);
+        if (c < 2 || c >= 0x0FFFFFF8) return 0;
+    }
+    if (out_run) *out_run = 1;
+    return c;
+}
+
+/*
+ * Open files. A handle remembers where its directory entry is, so the
+ * size and first cluster are written back without resolving the path
+ * again, and the run of clusters it last touched, so streaming access
+ * rarely needs the extent map. Data moves synchronously, whole sectors
+ * straight between the device and the caller's buffer; the entry and
+ * the FAT go to disk at close.
+ */
+typedef struct {
+    uint8_t     used;
+    uint8_t     flags;
+    uint8_t     dirty;          /* Entry needs first cluster and size written back */
+    uint16_t    dir_index;
+    uint32_t    dir_sector;     /* Directory entry location */
+    uint32_t    first;          /* First cluster, 0 while the file is empty */
+    uint32_t    size;
+    uint32_t    clusters;       /* Clusters in the chain */
+    uint32_t    pos;
+    uint32_t    cur_index;      /* Contiguous run touched last: file cluster index, */
+    uint32_t    cur_cluster;    /* its cluster */
+    uint32_t    cur_run;        /* and length (0 = none) */
+} fat_file_t;
+
+static fat_file_t files[FAT_MAX_OPEN];
+
+static fat_file_t* file_get(int fd) {
+    if (!fat_state.mounted || fd < 0 || fd >= FAT_MAX_OPEN || !files[fd].used) return NULL;
+    return &files[fd];
+}
+
+static uint32_t file_cluster_at(fat_file_t* f, uint32_t index, uint32_t* out_run) {
+    if (f->cur_run && index >= f->cur_index && index - f->cur_index < f->cur_run) {
+        *out_run = f->cur_run - (index - f->cur_index);
+        return f->cur_cluster + (index - f->cur_index);
+    }
+
+    uint32_t run;
+    uint32_t c = ext_cluster_at(f->first, index, &run);
+    if (c == 0) return 0;
+
+    f->cur_index = index;
+    f->cur_cluster = c;
+    f->cur_run = run;
+    *out_run = run;
+    return c;
+}
+
+/* Patch the handle's entry into the held directory sector; the caller commits */
+static int file_store_entry(fat_file_t* f) {
+    fat_dir_entry_t* e = dirtx_entry(f->dir_sector, f->dir_index);
+    if (!e) return -1;
+
+    e->cluster_lo = f->first & 0xFFFF;
+    e->cluster_hi = (f->first >> 16) & 0xFFFF;
+    e->file_size = f->size;
+    f->dirty = 0;
+    return 0;
+}
+
 static int fat_set_entry(uint32_t cluster, uint32_t value) {
-    uint32_t fat_offset;
-    uint32_t fat_sector;
-    uint32_t ent_offset;
-    uint16_t bps = fat_state.bytes_per_sector;
+    uint8_t* p;
+
+    if (cluster >= 2 && cluster < fat_state.total_clusters + 2) {
+        freemap_update(cluster, fsm.enabled ? 0 : fat_get_entry(cluster), value);
+    }
+    ext_note_entry(cluster, value);
 
     switch (fat_state.type) {
-        case FAT_TYPE_12:
-            fat_offset = cluster + (cluster / 2);
-            fat_sector = fat_state.fat_start_sector + (fat_offset / bps);
-            ent_offset = fat_offset % bps;
-
-            if (fat_cache_load(fat_sector) < 0) return -1;
-
-            if (cluster & 1) {
-                fat_state.fat_cache[ent_offset] =
-                    (fat_state.fat_cache[ent_offset] & 0x0F) | ((value & 0x0F) << 4);
-
-                if (ent_offset == (uint32_t)(bps - 1)) {
-                    fat_state.fat_cache_dirty = 1;
-                    write_sector(fat_sector, fat_state.fat_cache);
-                    if (fat_cache_load(fat_sector + 1) < 0) return -1;
-                    fat_state.fat_cache[0] = (value >> 4) & 0xFF;
-                } else {
-                    fat_state.fat_cache[ent_offset + 1] = (value >> 4) & 0xFF;
-                }
-            } else {
-                fat_state.fat_cache[ent_offset] = value & 0xFF;
-
-                if (ent_offset == (uint32_t)(bps - 1)) {
-                    fat_state.fat_cache_dirty = 1;
-                    write_sector(fat_sector, fat_state.fat_cache);
-                    if (fat_cache_load(fat_sector + 1) < 0) return -1;
-                    fat_state.fat_cache[0] =
-                        (fat_state.fat_cache[0] & 0xF0) | ((value >> 8) & 0x0F);
-                } else {
-                    fat_state.fat_cache[ent_offset + 1] =
-                        (fat_state.fat_cache[ent_offset + 1] & 0xF0) | ((value >> 8) & 0x0F);
-                }
-            }
-            fat_state.fat_cache_dirty = 1;
+        case FAT_TYPE_12: {
+            uint32_t fat_offset = cluster + (cluster / 2);
+
+            if (!(p = fatc_ptr(fat_offset, 1))) return -1;
+            if (cluster & 1) *p = (*p & 0x0F) | ((value & 0x0F) << 4);
+            else *p = value & 0xFF;
+
+            if (!(p = fatc_ptr(fat_offset + 1, 1))) return -1;
+            if (cluster & 1) *p = (value >> 4) & 0xFF;
+            else *p = (*p & 0xF0) | ((value >> 8) & 0x0F);
             break;
+        }
 
         case FAT_TYPE_16:
-            fat_offset = cluster * 2;
-            fat_sector = fat_state.fat_start_sector + (fat_offset / bps);
-            ent_offset = fat_offset % bps;
-
-            if (fat_cache_load(fat_sector) < 0) return -1;
-            *(uint16_t*)&fat_state.fat_cache[ent_offset] = (uint16_t)value;
-            fat_state.fat_cache_dirty = 1;
+            if (!(p = fatc_ptr(cluster * 2, 1))) return -1;
+            *(uint16_t*)p = (uint16_t)value;
             break;
 
         case FAT_TYPE_32:
-            fat_offset = cluster * 4;
-            fat_sector = fat_state.fat_start_sector + (fat_offset / bps);
-            ent_offset = fat_offset % bps;
-
-            if (fat_cache_load(fat_sector) < 0) return -1;
-            *(uint32_t*)&fat_state.fat_cache[ent_offset] =
-                (*(uint32_t*)&fat_state.fat_cache[ent_offset] & 0xF0000000) | (value & 0x0FFFFFFF);
-            fat_state.fat_cache_dirty = 1;
+            if (!(p = fatc_ptr(cluster * 4, 1))) return -1;
+            *(uint32_t*)p = (*(uint32_t*)p & 0xF0000000) | (value & 0x0FFFFFFF);
             break;
 
         default:
@@ -298,33 +957,61 @@ static int fat_set_entry(uint32_t cluster, uint32_t value) {
     return 0;
 }
 
-static uint32_t fat_alloc_cluster(void) {
-    for (uint32_t i = 2; i < fat_state.total_clusters + 2; i++) {
-        if (fat_get_entry(i) == 0) {
-            uint32_t eoc;
-            switch (fat_state.type) {
-                case FAT_TYPE_12: eoc = 0x0FFF; break;
-                case FAT_TYPE_16: eoc = 0xFFFF; break;
-                case FAT_TYPE_32: eoc = 0x0FFFFFFF; break;
-                default: return 0;
-            }
-            fat_set_entry(i, eoc);
+/*
+ * Claim up to `want` contiguous clusters and chain them, the last one
+ * marked end of chain. Contents are left as they are. Returns the first
+ * cluster, and the run length in *out_len.
+ */
+static uint32_t fat_claim_extent(uint32_t want, uint32_t* out_len) {
+    uint32_t eoc;
+    switch (fat_state.type) {
+        case FAT_TYPE_12: eoc = 0x0FFF; break;
+        case FAT_TYPE_16: eoc = 0xFFFF; break;
+        case FAT_TYPE_32: eoc = 0x0FFFFFFF; break;
+        default: return 0;
+    }
 
-            if (fat_state.fat_cache_dirty) {
-                write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-                fat_state.fat_cache_dirty = 0;
-            }
+    uint32_t len;
+    uint32_t start = freemap_find_run(want, &len);
+    if (start == 0) return 0;
 
-            memset(fat_state.sector_buf, 0, fat_state.bytes_per_sector);
-            uint32_t sector = cluster_to_sector(i);
-            for (int s = 0; s < fat_state.sectors_per_cluster; s++) {
-                write_sector(sector + s, fat_state.sector_buf);
-            }
+    for (uint32_t i = 0; i < len; i++) {
+        if (fat_set_entry(start + i, (i + 1 < len) ? start + i + 1 : eoc) < 0) return 0;
+    }
+    fsm.next_free = start + len;
 
-            return i;
-        }
+    *out_len = len;
+    return start;
+}
+
+/* Mark a free cluster as end of chain; contents are left as they are */
+static uint32_t fat_claim_cluster(void) {
+    uint32_t len;
+    return fat_claim_extent(1, &len);
+}
+
+/* Claim a cluster and zero it, as directories need */
+static uint32_t fat_alloc_cluster(void) {
+    uint32_t i = fat_claim_cluster();
+    if (i == 0) return 0;
+
+    uint32_t chunk = cluster_chunk_sectors();
+    memset(cluster_buf, 0, chunk * fat_state.bytes_per_sector);
+    uint32_t sector = cluster_to_sector(i);
+    for (uint32_t s = 0; s < fat_state.sectors_per_cluster; s += chunk) {
+        uint32_t n = fat_state.sectors_per_cluster - s;
+        if (n > chunk) n = chunk;
+        write_sectors(sector + s, n, cluster_buf);
+    }
+    return i;
+}
+
+static void fat_free_chain(uint32_t cluster) {
+    while (cluster >= 2 && cluster < 0x0FFFFFF8) {
+        uint32_t next = fat_get_entry(cluster);
+        fat_set_entry(cluster, 0);
+        cluster = next;
     }
-    return 0;
 }
 
 static uint8_t lfn_checksum(const char* short_name) {
@@ -402,145 +1089,760 @@ static void str_to_fat_name(const char* name, char* out) {
     }
 }
 
+/*
+ * Directories are addressed by entry number within them: the FAT12/16 root
+ * is a fixed run of sectors, any other directory is a cluster chain whose
+ * sectors are found through its extent map.
+ */
+static int dir_is_fixed_root(uint32_t dir) {
+    return dir == 0 && fat_state.type != FAT_TYPE_32;
+}
+
+/* Sector holding entry `ord` of a directory and the entry's index in it; 0 past the end */
+static uint32_t dir_ord_sector(uint32_t dir, uint32_t ord, uint16_t* out_index) {
+    uint16_t eps = fat_state.entries_per_sector;
+    uint32_t s = ord / eps;
+
+    if (out_index) *out_index = ord % eps;
+    if (dir_is_fixed_root(dir)) {
+        return (s < fat_state.root_dir_sectors) ? fat_state.root_dir_sector + s : 0;
+    }
+
+    uint32_t c = ext_cluster_at(dir, s / fat_state.sectors_per_cluster, NULL);
+    if (c == 0) return 0;
+    return cluster_to_sector(c) + s % fat_state.sectors_per_cluster;
+}
+
+typedef struct {
+    uint32_t    sector;
+    uint16_t    index;
+    uint32_t    ord;            /* Entry number within the directory */
+    uint8_t     lfn;            /* Long-name entries in front of it */
+} dir_pos_t;
+
+/* Short entry read_dir_entries() is passing to its callback */
+static dir_pos_t dir_pos;
+
+/* Short entry fat_resolve_path() last found; sector 0 if it found none */
+static dir_pos_t found_pos;
+
+/*
+ * Write-back mode. Path calls and fat_close() leave the FAT cache, FSInfo
+ * and dirty directory blocks in memory, and fat_write() of a small file
+ * stages its data in wb_data without claiming clusters: the entry stays
+ * empty on disk until the flush, which allocates every staged file in one
+ * pass, so each lands contiguous and next to the one written before it.
+ * Lookups report the staged size. A flush runs at fat_flush() and
+ * fat_fsync(), from the timer idle hook once the oldest change is
+ * FAT_WB_EXPIRE_MS old, and at unmount.
+ */
+#define FAT_WB_BYTES        (256 * 1024)
+#define FAT_WB_FILES        64
+#define FAT_WB_FILE_MAX     (64 * 1024)     /* Larger files are written at once */
+#define FAT_WB_EXPIRE_MS    5000
+
+typedef struct {
+    uint8_t     used;
+    uint32_t    dir;            /* Parent directory cluster */
+    dir_pos_t   pos;            /* Short entry */
+    uint32_t    offset;         /* Data in wb_data, padded to whole clusters */
+    uint32_t    room;           /* Bytes of wb_data reserved at offset */
+    uint32_t    size;
+} wb_file_t;
+
+static uint8_t wb_data[FAT_WB_BYTES] __attribute__((aligned(4096)));
+
+static struct {
+    uint8_t     enabled;
+    uint8_t     dirty;          /* Changes not yet flushed */
+    uint32_t    since;          /* Tick of the oldest of them */
+    uint32_t    used;           /* Bytes of wb_data taken */
+    uint32_t    count;          /* Staged files */
+    wb_file_t   files[FAT_WB_FILES];
+} wb;
+
+static wb_file_t* wb_find(const dir_pos_t* pos) {
+    if (wb.count == 0) return NULL;
+
+    for (int i = 0; i < FAT_WB_FILES; i++) {
+        wb_file_t* r = &wb.files[i];
+        if (r->used && r->pos.sector == pos->sector && r->pos.index == pos->index) return r;
+    }
+    return NULL;
+}
+
+static void wb_forget(wb_file_t* r) {
+    r->used = 0;
+    wb.count--;
+}
+
+/* Staged files inside a directory that is being removed */
+static void wb_forget_dir(uint32_t dir) {
+    for (int i = 0; i < FAT_WB_FILES && wb.count; i++) {
+        if (wb.files[i].used && wb.files[i].dir == dir) wb_forget(&wb.files[i]);
+    }
+}
+
+/* Show the staged size in an entry read from disk */
+static void wb_overlay(const dir_pos_t* pos, fat_dir_entry_t* e) {
+    wb_file_t* r = wb_find(pos);
+    if (r) e->file_size = r->size;
+}
+
+/* Slide staged data down over the space left by rewritten and removed files */
+static void wb_compact(void) {
+    uint32_t at = 0;
+
+    for (uint32_t n = 0; n < wb.count; n++) {
+        wb_file_t* next = NULL;
+        for (int i = 0; i < FAT_WB_FILES; i++) {
+            wb_file_t* r = &wb.files[i];
+            if (r->used && r->offset >= at && (!next || r->offset < next->offset)) next = r;
+        }
+        if (!next) break;
+
+        if (next->offset != at) {
+            memmove(wb_data + at, wb_data + next->offset, next->room);
+            next->offset = at;
+        }
+        at += next->room;
+    }
+    wb.used = at;
+}
+
+/* Room to stage `size` more bytes without a flush */
+static int wb_has_room(uint32_t size) {
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+    uint32_t need = (size + csize - 1) / csize * csize;
+
+    if (wb.count >= FAT_WB_FILES) return 0;
+    if (wb.used + need > FAT_WB_BYTES) wb_compact();
+    return wb.used + need <= FAT_WB_BYTES;
+}
+
+static void wb_mark(void) {
+    if (!wb.dirty) {
+        wb.dirty = 1;
+        wb.since = get_ticks();
+    }
+}
+
+/* Called where write-through mode syncs */
+static int fat_commit(void) {
+    if (!wb.enabled) return fat_sync();
+    wb_mark();
+    return 0;
+}
+
+/* Claim clusters for every staged file, queue its data and fill in its entry */
+static int wb_allocate(void) {
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+    int result = 0;
+
+    for (int i = 0; i < FAT_WB_FILES && wb.count; i++) {
+        wb_file_t* r = &wb.files[i];
+        if (!r->used) continue;
+
+        uint32_t left = (r->size + csize - 1) / csize;
+        uint32_t first = 0;
+        uint32_t prev = 0;
+        uint32_t done = 0;
+
+        while (left > 0) {
+            uint32_t run;
+            uint32_t cluster = fat_claim_extent(left, &run);
+            if (cluster == 0) break;
+
+            if (first == 0) first = cluster;
+            if (prev != 0) fat_set_entry(prev, cluster);
+            prev = cluster + run - 1;
+
+            /* Staged data is cluster padded, so whole runs go out straight from wb_data */
+            if (queue_sectors(cluster_to_sector(cluster), run * fat_state.sectors_per_cluster,
+                              wb_data + r->offset + done * csize) < 0) {
+                result = -1;
+            }
+            done += run;
+            left -= run;
+        }
+
+        uint32_t size = r->size;
+        if (left > 0) {
+            fat_free_chain(first);
+            first = 0;
+            size = 0;
+            vga_print_color("Disk full\n", LIGHT_RED);
+            result = -1;
+        }
+
+        fat_dir_entry_t* e = dirtx_entry(r->pos.sector, r->pos.index);
+        if (e) {
+            e->cluster_lo = first & 0xFFFF;
+            e->cluster_hi = (first >> 16) & 0xFFFF;
+            e->file_size = size;
+        } else {
+            result = -1;
+        }
+        wb_forget(r);
+    }
+
+    if (dirtx_commit() < 0) result = -1;
+    wb.used = 0;
+    return result;
+}
+
+static int wb_flush(void) {
+    int result = wb_allocate();
+    if (fat_sync() < 0) result = -1;
+    wb.dirty = 0;
+    return result;
+}
+
+static void lfn_copy_part(const fat_lfn_entry_t* lfn, char* buf) {
+    int pos = ((lfn->order & 0x3F) - 1) * 13;
+
+    for (int k = 0; k < 5 && pos < FAT_MAX_NAME - 1; k++, pos++)
+        buf[pos] = (char)lfn->name1[k];
+    for (int k = 0; k < 6 && pos < FAT_MAX_NAME - 1; k++, pos++)
+        buf[pos] = (char)lfn->name2[k];
+    for (int k = 0; k < 2 && pos < FAT_MAX_NAME - 1; k++, pos++)
+        buf[pos] = (char)lfn->name3[k];
+}
+
 static int read_dir_entries(uint32_t start_cluster,
                            int (*callback)(fat_dir_entry_t*, char*, void*),
                            void* ctx) {
-    uint32_t cluster = start_cluster;
     char lfn_buf[FAT_MAX_NAME];
     int has_lfn = 0;
+    uint8_t lfn_count = 0;
     uint16_t entries_per_sec = fat_state.entries_per_sector;
 
     lfn_buf[0] = '\0';
 
-    if (cluster == 0 && fat_state.type != FAT_TYPE_32) {
-        for (uint32_t s = 0; s < fat_state.root_dir_sectors; s++) {
-            if (read_sector(fat_state.root_dir_sector + s, fat_state.sector_buf) < 0)
-                return -1;
-
-            fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-            for (uint16_t i = 0; i < entries_per_sec; i++) {
-                if (entries[i].name[0] == 0x00) return 0;
-                if ((uint8_t)entries[i].name[0] == 0xE5) continue;
-
-                if (entries[i].attr == FAT_ATTR_LFN) {
-                    fat_lfn_entry_t* lfn = (fat_lfn_entry_t*)&entries[i];
-                    int ord = lfn->order & 0x3F;
-                    int pos = (ord - 1) * 13;
-
-                    if (lfn->order & 0x40) {
-                        has_lfn = 1;
-                        memset(lfn_buf, 0, sizeof(lfn_buf));
-                    }
-
-                    for (int k = 0; k < 5 && pos < FAT_MAX_NAME - 1; k++, pos++)
-                        lfn_buf[pos] = (char)lfn->name1[k];
-                    for (int k = 0; k < 6 && pos < FAT_MAX_NAME - 1; k++, pos++)
-                        lfn_buf[pos] = (char)lfn->name2[k];
-                    for (int k = 0; k < 2 && pos < FAT_MAX_NAME - 1; k++, pos++)
-                        lfn_buf[pos] = (char)lfn->name3[k];
-                    continue;
-                }
+    for (uint32_t ord = 0; ; ord += entries_per_sec) {
+        uint32_t sector = dir_ord_sector(start_cluster, ord, NULL);
+        if (sector == 0) return 0;
+        if (read_sector(sector, fat_state.sector_buf) < 0) return -1;
 
-                if (entries[i].attr & FAT_ATTR_VOLUME_ID) continue;
+        fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
 
-                char name[FAT_MAX_NAME];
-                if (has_lfn) {
-                    strcpy(name, lfn_buf);
-                    has_lfn = 0;
-                } else {
-                    fat_name_to_str(&entries[i], name);
+        for (uint16_t i = 0; i < entries_per_sec; i++) {
+            if (entries[i].name[0] == 0x00) return 0;
+            if ((uint8_t)entries[i].name[0] == 0xE5) {
+                has_lfn = 0;
+                continue;
+            }
+
+            if (entries[i].attr == FAT_ATTR_LFN) {
+                fat_lfn_entry_t* lfn = (fat_lfn_entry_t*)&entries[i];
+
+                if (lfn->order & 0x40) {
+                    has_lfn = 1;
+                    lfn_count = 0;
+                    memset(lfn_buf, 0, sizeof(lfn_buf));
                 }
+                lfn_copy_part(lfn, lfn_buf);
+                lfn_count++;
+                continue;
+            }
 
-                if (callback(&entries[i], name, ctx) != 0) return 1;
+            if (entries[i].attr & FAT_ATTR_VOLUME_ID) {
+                has_lfn = 0;
+                continue;
+            }
+
+            dir_pos.sector = sector;
+            dir_pos.index = i;
+            dir_pos.ord = ord + i;
+            dir_pos.lfn = has_lfn ? lfn_count : 0;
+            wb_overlay(&dir_pos, &entries[i]);
+
+            char name[FAT_MAX_NAME];
+            if (has_lfn) {
+                strcpy(name, lfn_buf);
+                has_lfn = 0;
+            } else {
+                fat_name_to_str(&entries[i], name);
             }
+
+            if (callback(&entries[i], name, ctx) != 0) return 1;
         }
-        return 0;
     }
+}
 
-    while (cluster < 0x0FFFFFF8) {
-        uint32_t sector = cluster_to_sector(cluster);
+/* Read back the entry set whose short entry is `ord`, with its name */
+static int dir_read_name(uint32_t dir, uint32_t ord, uint8_t lfn,
+                         char* name, fat_dir_entry_t* out, dir_pos_t* pos) {
+    memset(name, 0, FAT_MAX_NAME);
 
-        for (int s = 0; s < fat_state.sectors_per_cluster; s++) {
-            if (read_sector(sector + s, fat_state.sector_buf) < 0) return -1;
+    for (uint32_t o = ord - lfn; o <= ord; o++) {
+        uint16_t index;
+        uint32_t sector = dir_ord_sector(dir, o, &index);
+        if (sector == 0 || read_sector(sector, fat_state.sector_buf) < 0) return -1;
 
-            fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
+        fat_dir_entry_t* e = &((fat_dir_entry_t*)fat_state.sector_buf)[index];
+        if (o < ord) {
+            if (e->attr != FAT_ATTR_LFN) return -1;
+            lfn_copy_part((fat_lfn_entry_t*)e, name);
+            continue;
+        }
 
-            for (uint16_t i = 0; i < entries_per_sec; i++) {
-                if (entries[i].name[0] == 0x00) return 0;
-                if ((uint8_t)entries[i].name[0] == 0xE5) continue;
+        if (e->name[0] == 0x00 || (uint8_t)e->name[0] == 0xE5) return -1;
+        if (!lfn) fat_name_to_str(e, name);
+        memcpy(out, e, sizeof(fat_dir_entry_t));
+        pos->sector = sector;
+        pos->index = index;
+        pos->ord = ord;
+        pos->lfn = lfn;
+    }
+    return 0;
+}
 
-                if (entries[i].attr == FAT_ATTR_LFN) {
-                    fat_lfn_entry_t* lfn = (fat_lfn_entry_t*)&entries[i];
-                    int ord = lfn->order & 0x3F;
-                    int pos = (ord - 1) * 13;
+static uint32_t name_hash(const char* name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-                    if (lfn->order & 0x40) {
-                        has_lfn = 1;
-                        memset(lfn_buf, 0, sizeof(lfn_buf));
-                    }
+/*
+ * Name index for big directories: hashes of case-folded names mapped to
+ * the entry number of their short entry, so a lookup reads only the
+ * entries whose hash matches. An index is built by the first lookup in a
+ * directory and kept in step by create and remove; it also tracks the
+ * runs of free slots, so creating an entry does not rescan. Nodes come
+ * from one pool: when it runs dry the least recently used other index
+ * is dropped. A directory with more names than the pool holds is
+ * scanned as before.
+ */
+#define DIRIDX_DIRS         8
+#define DIRIDX_NAMES        16384   /* Node pool shared by all indexes */
+#define DIRIDX_BUCKETS      1024    /* Per index, power of two */
+#define DIRIDX_FREE_RUNS    64
+#define DIRIDX_NONE         0xFFFF
 
-                    for (int k = 0; k < 5 && pos < FAT_MAX_NAME - 1; k++, pos++)
-                        lfn_buf[pos] = (char)lfn->name1[k];
-                    for (int k = 0; k < 6 && pos < FAT_MAX_NAME - 1; k++, pos++)
-                        lfn_buf[pos] = (char)lfn->name2[k];
-                    for (int k = 0; k < 2 && pos < FAT_MAX_NAME - 1; k++, pos++)
-                        lfn_buf[pos] = (char)lfn->name3[k];
-                    continue;
-                }
+typedef struct {
+    uint32_t    hash;
+    uint32_t    ord;            /* Entry number of the short entry */
+    uint16_t    next;           /* Next node in the bucket, or on the unused list */
+    uint8_t     lfn;            /* Long-name entries in front of it */
+} diridx_node_t;
 
-                if (entries[i].attr & FAT_ATTR_VOLUME_ID) continue;
+typedef struct {
+    uint32_t    ord;
+    uint32_t    len;
+} diridx_run_t;
 
-                char name[FAT_MAX_NAME];
-                if (has_lfn) {
-                    strcpy(name, lfn_buf);
-                    has_lfn = 0;
-                } else {
-                    fat_name_to_str(&entries[i], name);
-                }
+static struct {
+    uint8_t         valid;
+    uint32_t        dir;
+    uint32_t        used;           /* LRU stamp */
+    uint32_t        capacity;       /* Entries the directory's sectors hold */
+    uint32_t        tail;           /* Entries from here to capacity are all free */
+    uint16_t        runs;           /* Free runs before the tail */
+    uint16_t        buckets[DIRIDX_BUCKETS];
+    diridx_run_t    free[DIRIDX_FREE_RUNS];
+} diridx[DIRIDX_DIRS];
+
+static diridx_node_t diridx_nodes[DIRIDX_NAMES];
+static uint16_t diridx_unused;          /* Head of the unused node list */
+static uint32_t diridx_clock;
+static uint8_t diridx_too_big;          /* The last build ran out of nodes, for this directory: */
+static uint32_t diridx_too_big_dir;
+
+static void diridx_reset(void) {
+    for (int i = 0; i < DIRIDX_DIRS; i++) diridx[i].valid = 0;
+    for (int n = 0; n < DIRIDX_NAMES; n++) {
+        diridx_nodes[n].next = (n + 1 < DIRIDX_NAMES) ? n + 1 : DIRIDX_NONE;
+    }
+    diridx_unused = 0;
+    diridx_too_big = 0;
+}
 
-                if (callback(&entries[i], name, ctx) != 0) return 1;
-            }
+/* Return an index's nodes to the pool */
+static void diridx_release(int x) {
+    for (int b = 0; b < DIRIDX_BUCKETS; b++) {
+        uint16_t n = diridx[x].buckets[b];
+        while (n != DIRIDX_NONE) {
+            uint16_t next = diridx_nodes[n].next;
+            diridx_nodes[n].next = diridx_unused;
+            diridx_unused = n;
+            n = next;
+        }
+        diridx[x].buckets[b] = DIRIDX_NONE;
+    }
+    diridx[x].valid = 0;
+}
+
+static void diridx_drop(uint32_t dir) {
+    for (int i = 0; i < DIRIDX_DIRS; i++) {
+        if (diridx[i].valid && diridx[i].dir == dir) diridx_release(i);
+    }
+    if (diridx_too_big && diridx_too_big_dir == dir) diridx_too_big = 0;
+}
+
+static int diridx_find(uint32_t dir) {
+    for (int i = 0; i < DIRIDX_DIRS; i++) {
+        if (diridx[i].valid && diridx[i].dir == dir) {
+            diridx[i].used = ++diridx_clock;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int diridx_insert(int x, uint32_t hash, uint32_t ord, uint8_t lfn) {
+    while (diridx_unused == DIRIDX_NONE) {
+        int victim = -1;
+        for (int i = 0; i < DIRIDX_DIRS; i++) {
+            if (i == x || !diridx[i].valid) continue;
+            if (victim < 0 || diridx[i].used < diridx[victim].used) victim = i;
+        }
+        if (victim < 0) return -1;
+        diridx_release(victim);
+    }
+
+    uint16_t n = diridx_unused;
+    diridx_unused = diridx_nodes[n].next;
+
+    uint16_t* head = &diridx[x].buckets[hash & (DIRIDX_BUCKETS - 1)];
+    diridx_nodes[n].hash = hash;
+    diridx_nodes[n].ord = ord;
+    diridx_nodes[n].lfn = lfn;
+    diridx_nodes[n].next = *head;
+    *head = n;
+    return 0;
+}
+
+static void diridx_remove(int x, uint32_t hash, uint32_t ord) {
+    uint16_t* link = &diridx[x].buckets[hash & (DIRIDX_BUCKETS - 1)];
+
+    while (*link != DIRIDX_NONE) {
+        uint16_t n = *link;
+        if (diridx_nodes[n].ord == ord) {
+            *link = diridx_nodes[n].next;
+            diridx_nodes[n].next = diridx_unused;
+            diridx_unused = n;
+            return;
+        }
+        link = &diridx_nodes[n].next;
+    }
+}
+
+/* Record free slots [ord, ord + len), merged with the runs next to them */
+static void diridx_free_slots(int x, uint32_t ord, uint32_t len) {
+    diridx_run_t* r = diridx[x].free;
+
+    for (int i = 0; i < diridx[x].runs; ) {
+        if (r[i].ord + r[i].len == ord || ord + len == r[i].ord) {
+            if (r[i].ord < ord) ord = r[i].ord;
+            len += r[i].len;
+            r[i] = r[--diridx[x].runs];
+            i = 0;
+        } else {
+            i++;
         }
+    }
 
-        cluster = fat_get_entry(cluster);
+    if (ord + len == diridx[x].tail) {
+        diridx[x].tail = ord;
+        return;
     }
 
+    int slot = diridx[x].runs;
+    if (slot == DIRIDX_FREE_RUNS) {
+        /* Table full: forget the smallest run until the next rebuild */
+        slot = 0;
+        for (int i = 1; i < DIRIDX_FREE_RUNS; i++) {
+            if (r[i].len < r[slot].len) slot = i;
+        }
+        if (r[slot].len >= len) return;
+    } else {
+        diridx[x].runs++;
+    }
+    r[slot].ord = ord;
+    r[slot].len = len;
+}
+
+/*
+ * Take `count` consecutive free slots: the lowest hole that has them, else
+ * the start of the free tail. The end-of-directory marker is always in
+ * the tail, so no entry ends up behind it.
+ */
+static int diridx_take_slots(int x, uint32_t count, uint32_t* out_ord) {
+    diridx_run_t* r = diridx[x].free;
+    int best = -1;
+
+    for (int i = 0; i < diridx[x].runs; i++) {
+        if (r[i].len < count) continue;
+        if (best < 0 || r[i].ord < r[best].ord) best = i;
+    }
+
+    if (best >= 0) {
+        *out_ord = r[best].ord;
+        r[best].ord += count;
+        r[best].len -= count;
+        if (r[best].len == 0) r[best] = r[--diridx[x].runs];
+        return 0;
+    }
+
+    if (diridx[x].capacity - diridx[x].tail < count) return -1;
+    *out_ord = diridx[x].tail;
+    diridx[x].tail += count;
     return 0;
 }
 
+static int diridx_build_callback(fat_dir_entry_t* entry, char* name, void* ctx) {
+    int x = *(int*)ctx;
+    (void)entry;
+
+    to_upper(name);
+    return diridx_insert(x, name_hash(name), dir_pos.ord, dir_pos.lfn) < 0;
+}
+
+/* Index a directory in a free or the least recently used slot; -1 if it cannot be indexed */
+static int diridx_build(uint32_t dir) {
+    if (diridx_too_big && diridx_too_big_dir == dir) return -1;
+
+    int x = 0;
+    for (int i = 0; i < DIRIDX_DIRS; i++) {
+        if (!diridx[i].valid) {
+            x = i;
+            break;
+        }
+        if (diridx[i].used < diridx[x].used) x = i;
+    }
+    if (diridx[x].valid) diridx_release(x);
+
+    /* Valid while building, so the pool can take nodes from the other indexes */
+    diridx[x].valid = 1;
+    diridx[x].dir = dir;
+    diridx[x].used = ++diridx_clock;
+    diridx[x].runs = 0;
+    for (int b = 0; b < DIRIDX_BUCKETS; b++) diridx[x].buckets[b] = DIRIDX_NONE;
+
+    int result = read_dir_entries(dir, diridx_build_callback, &x);
+    if (result != 0) {
+        if (result > 0) {
+            diridx_too_big = 1;
+            diridx_too_big_dir = dir;
+        }
+        diridx_release(x);
+        return -1;
+    }
+
+    /* Free slots: deleted entries, and everything from the end marker on */
+    uint16_t entries_per_sec = fat_state.entries_per_sector;
+    uint32_t run_start = 0, run_len = 0;
+    uint32_t ord;
+    int at_end = 0;
+
+    diridx[x].tail = 0xFFFFFFFF;
+    for (ord = 0; ; ord += entries_per_sec) {
+        uint32_t sector = dir_ord_sector(dir, ord, NULL);
+        if (sector == 0) break;
+        if (read_sector(sector, fat_state.sector_buf) < 0) {
+            diridx_release(x);
+            return -1;
+        }
+
+        fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
+        for (uint16_t i = 0; i < entries_per_sec; i++) {
+            if (entries[i].name[0] == 0x00) at_end = 1;
+            if (at_end || (uint8_t)entries[i].name[0] == 0xE5) {
+                if (run_len == 0) run_start = ord + i;
+                run_len++;
+            } else if (run_len) {
+                diridx_free_slots(x, run_start, run_len);
+                run_len = 0;
+            }
+        }
+    }
+
+    diridx[x].capacity = ord;
+    diridx[x].tail = run_len ? run_start : ord;
+    return x;
+}
+
+/* 0 with the entry and found_pos set, -1 if the directory has no such name */
+static int diridx_lookup(int x, const char* key, fat_dir_entry_t* out) {
+    uint32_t hash = name_hash(key);
+    char name[FAT_MAX_NAME];
+
+    for (uint16_t n = diridx[x].buckets[hash & (DIRIDX_BUCKETS - 1)]; n != DIRIDX_NONE;
+         n = diridx_nodes[n].next) {
+        diridx_node_t* node = &diridx_nodes[n];
+        if (node->hash != hash) continue;
+
+        dir_pos_t pos;
+        if (dir_read_name(diridx[x].dir, node->ord, node->lfn, name, out, &pos) < 0) continue;
+        to_upper(name);
+        if (strcmp(name, key) == 0) {
+            found_pos = pos;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* A name was created at short entry `ord` */
+static void diridx_add_name(uint32_t dir, const char* name, uint32_t ord, uint8_t lfn) {
+    int x = diridx_find(dir);
+    if (x < 0) return;
+
+    char key[FAT_MAX_NAME];
+    strncpy(key, name, FAT_MAX_NAME - 1);
+    key[FAT_MAX_NAME - 1] = '\0';
+    to_upper(key);
+
+    if (diridx_insert(x, name_hash(key), ord, lfn) < 0) diridx_release(x);
+}
+
+/*
+ * Dentry cache: lookups by (directory cluster, upper-cased name), so
+ * resolving a path again costs a hash probe per component instead of a
+ * directory scan. A hit stores where the entry is, not a copy of it, and
+ * re-reads it through the buffer cache, so size and cluster updates made
+ * in place never leave it stale; names that were not found are cached as
+ * negative entries. Creating or removing a name overwrites its own entry;
+ * removing a directory drops every entry cached under it.
+ */
+#define DCACHE_SETS         64      /* Power of two */
+#define DCACHE_WAYS         4
+#define DCACHE_NAME_MAX     32      /* Longer names are not cached */
+
 typedef struct {
-    const char* target;
+    uint8_t     valid;
+    uint8_t     negative;
+    uint32_t    dir;
+    dir_pos_t   pos;
+    uint32_t    used;
+    char        name[DCACHE_NAME_MAX];
+} dcache_entry_t;
+
+static dcache_entry_t dcache[DCACHE_SETS][DCACHE_WAYS];
+static uint32_t dcache_clock;
+static fat_dcache_stats_t dcache_stats;
+
+static void dcache_reset(void) {
+    memset(dcache, 0, sizeof(dcache));
+}
+
+static void dcache_drop_dir(uint32_t dir) {
+    for (int s = 0; s < DCACHE_SETS; s++) {
+        for (int w = 0; w < DCACHE_WAYS; w++) {
+            if (dcache[s][w].dir == dir) dcache[s][w].valid = 0;
+        }
+    }
+}
+
+static uint32_t dcache_set(uint32_t dir, const char* name) {
+    return (name_hash(name) ^ dir) & (DCACHE_SETS - 1);
+}
+
+static dcache_entry_t* dcache_find(uint32_t dir, const char* name) {
+    dcache_entry_t* set = dcache[dcache_set(dir, name)];
+    for (int w = 0; w < DCACHE_WAYS; w++) {
+        if (set[w].valid && set[w].dir == dir && strcmp(set[w].name, name) == 0) {
+            set[w].used = ++dcache_clock;
+            return &set[w];
+        }
+    }
+    return NULL;
+}
+
+/* `name` is upper-cased; an entry already cached for it is overwritten */
+static void dcache_insert(uint32_t dir, const char* name, int negative, const dir_pos_t* pos) {
+    if (strlen(name) >= DCACHE_NAME_MAX) return;
+
+    dcache_entry_t* e = dcache_find(dir, name);
+    if (!e) {
+        dcache_entry_t* set = dcache[dcache_set(dir, name)];
+        e = &set[0];
+        for (int w = 0; w < DCACHE_WAYS; w++) {
+            if (!set[w].valid) {
+                e = &set[w];
+                break;
+            }
+            if (set[w].used < e->used) e = &set[w];
+        }
+    }
+
+    e->valid = 1;
+    e->negative = negative;
+    e->dir = dir;
+    e->pos = *pos;
+    e->used = ++dcache_clock;
+    strcpy(e->name, name);
+}
+
+void fat_get_dcache_stats(fat_dcache_stats_t* stats) {
+    memcpy(stats, &dcache_stats, sizeof(fat_dcache_stats_t));
+}
+
+typedef struct {
+    const char* target;         /* Upper-cased */
     fat_dir_entry_t* result;
     int found;
 } find_ctx_t;
 
 static int find_callback(fat_dir_entry_t* entry, char* name, void* ctx) {
     find_ctx_t* fctx = (find_ctx_t*)ctx;
+    const char* t = fctx->target;
+
+    while (*name && *t) {
+        char c = *name;
+        if (c >= 'a' && c <= 'z') c -= 32;
+        if (c != *t) return 0;
+        name++;
+        t++;
+    }
+    if (*name || *t) return 0;
 
-    char upper_name[FAT_MAX_NAME];
-    char upper_target[FAT_MAX_NAME];
+    memcpy(fctx->result, entry, sizeof(fat_dir_entry_t));
+    fctx->found = 1;
+    found_pos = dir_pos;
+    return 1;
+}
 
-    strncpy(upper_name, name, FAT_MAX_NAME - 1);
-    strncpy(upper_target, fctx->target, FAT_MAX_NAME - 1);
-    upper_name[FAT_MAX_NAME - 1] = '\0';
-    upper_target[FAT_MAX_NAME - 1] = '\0';
+static int fat_find_in_dir(uint32_t dir_cluster, const char* name, fat_dir_entry_t* out) {
+    char key[FAT_MAX_NAME];
+    strncpy(key, name, FAT_MAX_NAME - 1);
+    key[FAT_MAX_NAME - 1] = '\0';
+    to_upper(key);
+
+    int cacheable = strlen(key) < DCACHE_NAME_MAX;
+    if (cacheable) {
+        dcache_entry_t* e = dcache_find(dir_cluster, key);
+        if (e) {
+            dcache_stats.hits++;
+            if (e->negative) return -1;
+            if (read_sector(e->pos.sector, fat_state.sector_buf) < 0) return -1;
+            memcpy(out, &((fat_dir_entry_t*)fat_state.sector_buf)[e->pos.index], sizeof(fat_dir_entry_t));
+            found_pos = e->pos;
+            wb_overlay(&found_pos, out);
+            return 0;
+        }
+        dcache_stats.misses++;
+    }
 
-    to_upper(upper_name);
-    to_upper(upper_target);
+    int found;
+    int x = diridx_find(dir_cluster);
+    if (x < 0) x = diridx_build(dir_cluster);
 
-    if (strcmp(upper_name, upper_target) == 0) {
-        memcpy(fctx->result, entry, sizeof(fat_dir_entry_t));
-        fctx->found = 1;
-        return 1;
+    if (x >= 0) {
+        found = (diridx_lookup(x, key, out) == 0);
+    } else {
+        find_ctx_t ctx = { key, out, 0 };
+        if (read_dir_entries(dir_cluster, find_callback, &ctx) < 0) return -1;
+        found = ctx.found;
     }
-    return 0;
-}
 
-static int fat_find_in_dir(uint32_t dir_cluster, const char* name, fat_dir_entry_t* out) {
-    find_ctx_t ctx = { name, out, 0 };
-    read_dir_entries(dir_cluster, find_callback, &ctx);
-    return ctx.found ? 0 : -1;
+    if (cacheable) dcache_insert(dir_cluster, key, !found, &found_pos);
+    if (found) wb_overlay(&found_pos, out);
+    return found ? 0 : -1;
 }
 
 static uint32_t get_entry_cluster(fat_dir_entry_t* entry) {
@@ -554,6 +1856,8 @@ static uint32_t get_entry_cluster(fat_dir_entry_t* entry) {
 static int fat_resolve_path(const char* path, uint32_t* out_cluster, fat_dir_entry_t* out_entry) {
     uint32_t cluster;
 
+    found_pos.sector = 0;
+
     if (path[0] == '/') {
         cluster = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
         path++;
@@ -605,25 +1909,63 @@ static int fat_resolve_path(const char* path, uint32_t* out_cluster, fat_dir_ent
     return 0;
 }
 
-int fat_mount(uint8_t drive) {
+/*
+ * Resolve the directory holding `path` and look its last component up, in
+ * one walk. Returns 0 if the component exists (its entry in *out, its
+ * location in found_pos), 1 if only the parent does, -1 if the parent is
+ * missing. The component is copied to `name`.
+ */
+static int lookup_entry(const char* path, uint32_t* parent, char* name, fat_dir_entry_t* out) {
+    char parent_path[FAT_MAX_PATH];
+
+    strncpy(parent_path, path, FAT_MAX_PATH - 1);
+    parent_path[FAT_MAX_PATH - 1] = '\0';
+
+    char* last_slash = strrchr(parent_path, '/');
+    if (last_slash) {
+        strncpy(name, last_slash + 1, FAT_MAX_NAME - 1);
+        if (last_slash == parent_path) parent_path[1] = '\0';
+        else *last_slash = '\0';
+    } else {
+        strncpy(name, path, FAT_MAX_NAME - 1);
+        strcpy(parent_path, ".");
+    }
+    name[FAT_MAX_NAME - 1] = '\0';
+
+    if (strcmp(parent_path, ".") == 0) {
+        *parent = fat_state.current_cluster;
+    } else if (strcmp(parent_path, "/") == 0) {
+        *parent = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
+    } else {
+        fat_dir_entry_t pentry;
+        if (fat_resolve_path(parent_path, parent, &pentry) < 0) return -1;
+    }
+
+    found_pos.sector = 0;
+    return (fat_find_in_dir(*parent, name, out) == 0) ? 0 : 1;
+}
+
+int fat_mount(blkdev_t* dev) {
     if (fat_state.mounted) {
         fat_unmount();
     }
 
-    ata_init();
-
-    if (!ata_drive_exists(drive)) {
+    if (!dev) {
         vga_print_color("Drive not found\n", LIGHT_RED);
         return -1;
     }
 
-    uint8_t boot_sector[512];
-    if (ata_read_sectors(drive, 0, 1, boot_sector) < 0) {
+    if (dev->sector_size > MAX_SECTOR_SIZE) {
+        vga_print_color("Unsupported device sector size\n", LIGHT_RED);
+        return -1;
+    }
+
+    if (blkdev_read(dev, 0, 1, fat_state.sector_buf) < 0) {
         vga_print_color("Failed to read boot sector\n", LIGHT_RED);
         return -1;
     }
 
-    bpb_t* bpb = (bpb_t*)boot_sector;
+    bpb_t* bpb = (bpb_t*)fat_state.sector_buf;
 
     uint16_t bps = bpb->bytes_per_sector;
     if (bps != 512 && bps != 1024 && bps != 2048 && bps != 4096) {
@@ -635,26 +1977,32 @@ int fat_mount(uint8_t drive) {
         return -1;
     }
 
+    if (bps < dev->sector_size) {
+        vga_print_color("FS sector smaller than device sector\n", LIGHT_RED);
+        return -1;
+    }
+
     if (bpb->num_fats == 0 || bpb->sectors_per_cluster == 0) {
         vga_print_color("Invalid BPB\n", LIGHT_RED);
         return -1;
     }
 
-    fat_state.drive = drive;
+    if ((uint32_t)bpb->sectors_per_cluster * bps > MAX_CLUSTER_SIZE) {
+        vga_print_color("Clusters larger than 64 KB are not supported\n", LIGHT_RED);
+        return -1;
+    }
+
+    fat_state.dev = dev;
     fat_state.bytes_per_sector = bps;
     fat_state.sectors_per_cluster = bpb->sectors_per_cluster;
     fat_state.entries_per_sector = bps / DIR_ENTRY_SIZE;
-    fat_state.ata_sectors_per_fs_sector = bps / 512;
-
-    if (bps > 512) {
-        memcpy(fat_state.sector_buf, boot_sector, 512);
-        for (int i = 1; i < fat_state.ata_sectors_per_fs_sector; i++) {
-            if (ata_read_sectors(drive, i, 1, fat_state.sector_buf + (i * 512)) < 0) {
-                vga_print_color("Failed to read full boot sector\n", LIGHT_RED);
-                return -1;
-            }
+    fat_state.dev_sectors_per_fs_sector = bps / dev->sector_size;
+
+    if (fat_state.dev_sectors_per_fs_sector > 1) {
+        if (blkdev_read(dev, 0, fat_state.dev_sectors_per_fs_sector, fat_state.sector_buf) < 0) {
+            vga_print_color("Failed to read full boot sector\n", LIGHT_RED);
+            return -1;
         }
-        bpb = (bpb_t*)fat_state.sector_buf;
     }
 
     fat_state.fat_start_sector = bpb->reserved_sectors;
@@ -663,10 +2011,11 @@ int fat_mount(uint8_t drive) {
     if (bpb->fat_size_16 != 0) {
         fat_size = bpb->fat_size_16;
     } else {
-        fat32_ebpb_t* fat32 = (fat32_ebpb_t*)(bps > 512 ? fat_state.sector_buf : boot_sector);
+        fat32_ebpb_t* fat32 = (fat32_ebpb_t*)fat_state.sector_buf;
         fat_size = fat32->fat_size_32;
     }
     fat_state.fat_size_sectors = fat_size;
+    fat_state.num_fats = bpb->num_fats;
 
     fat_state.root_dir_sector = fat_state.fat_start_sector + (bpb->num_fats * fat_size);
     fat_state.root_dir_sectors = ((bpb->root_entry_count * 32) + (bps - 1)) / bps;
@@ -679,23 +2028,25 @@ int fat_mount(uint8_t drive) {
     uint32_t data_sectors = total_sectors - fat_state.data_start_sector;
     fat_state.total_clusters = data_sectors / bpb->sectors_per_cluster;
 
+    uint32_t fsinfo_sector = 0;
     if (fat_state.total_clusters < 4085) {
         fat_state.type = FAT_TYPE_12;
     } else if (fat_state.total_clusters < 65525) {
         fat_state.type = FAT_TYPE_16;
     } else {
         fat_state.type = FAT_TYPE_32;
-        fat32_ebpb_t* fat32 = (fat32_ebpb_t*)(bps > 512 ? fat_state.sector_buf : boot_sector);
+        fat32_ebpb_t* fat32 = (fat32_ebpb_t*)fat_state.sector_buf;
         fat_state.root_cluster = fat32->root_cluster;
+        if (fat32->fs_info != 0 && fat32->fs_info != 0xFFFF) fsinfo_sector = fat32->fs_info;
         fat_state.root_dir_sectors = 0;
         fat_state.data_start_sector = fat_state.root_dir_sector;
     }
 
     if (fat_state.type == FAT_TYPE_32) {
-        fat32_ebpb_t* fat32 = (fat32_ebpb_t*)(bps > 512 ? fat_state.sector_buf : boot_sector);
+        fat32_ebpb_t* fat32 = (fat32_ebpb_t*)fat_state.sector_buf;
         memcpy(fat_state.volume_label, fat32->volume_label, 11);
     } else {
-        fat16_ebpb_t* fat16 = (fat16_ebpb_t*)(bps > 512 ? fat_state.sector_buf : boot_sector);
+        fat16_ebpb_t* fat16 = (fat16_ebpb_t*)fat_state.sector_buf;
         memcpy(fat_state.volume_label, fat16->volume_label, 11);
     }
     fat_state.volume_label[11] = '\0';
@@ -708,28 +2059,50 @@ int fat_mount(uint8_t drive) {
                                 fat_state.root_cluster : 0;
     strcpy(fat_state.current_path, "/");
 
-    fat_state.fat_cache_sector = 0xFFFFFFFF;
-    fat_state.fat_cache_dirty = 0;
+    ra_reset();
+    ext_reset();
+    dcache_reset();
+    memset(&dirtx, 0, sizeof(dirtx));
+    memset(&wb, 0, sizeof(wb));
+    diridx_reset();
+
+    if (fatc_init() < 0) {
+        vga_print_color("Failed to read FAT\n", LIGHT_RED);
+        return -1;
+    }
+
+    freemap_init(fsinfo_sector);
 
     fat_state.mounted = 1;
 
     return 0;
 }
 
-void fat_unmount(void) {
-    if (!fat_state.mounted) return;
+int fat_unmount(void) {
+    if (!fat_state.mounted) return 0;
 
-    if (fat_state.fat_cache_dirty) {
-        write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
+    int result = 0;
+    for (int fd = 0; fd < FAT_MAX_OPEN; fd++) {
+        if (files[fd].used && files[fd].dirty && file_store_entry(&files[fd]) < 0) result = -1;
+        files[fd].used = 0;
     }
+    if (wb_allocate() < 0) result = -1;
+    if (dirtx_commit() < 0) result = -1;
+    if (fat_sync() < 0) result = -1;
+    memset(&wb, 0, sizeof(wb));
 
     memset(&fat_state, 0, sizeof(fat_state));
+    return result;
 }
 
 int fat_is_mounted(void) {
     return fat_state.mounted;
 }
 
+blkdev_t* fat_get_device(void) {
+    return fat_state.mounted ? fat_state.dev : NULL;
+}
+
 fat_type_t fat_get_type(void) {
     return fat_state.type;
 }
@@ -748,6 +2121,134 @@ const char* fat_get_current_path(void) {
     return fat_state.current_path;
 }
 
+/* Lay down an empty FAT12/FAT16 volume; used to give RAM disks a filesystem */
+int fat_format(blkdev_t* dev, const char* label) {
+    if (!dev) {
+        vga_print_color("Drive not found\n", LIGHT_RED);
+        return -1;
+    }
+
+    if (dev->sector_size != 512) {
+        vga_print_color("mkfs supports 512-byte sectors only\n", LIGHT_RED);
+        return -1;
+    }
+
+    if (dev->sector_count < 128) {
+        vga_print_color("Device too small\n", LIGHT_RED);
+        return -1;
+    }
+
+    if (fat_state.mounted && fat_state.dev == dev) {
+        fat_unmount();
+    }
+    bcache_invalidate(dev);
+
+    const uint16_t reserved = 1;
+    const uint8_t num_fats = 2;
+    const uint16_t root_entries = 512;
+    const uint32_t root_sectors = root_entries * DIR_ENTRY_SIZE / 512;
+
+    uint32_t total = dev->sector_count > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t)dev->sector_count;
+
+    /* Grow clusters until FAT16 can address the whole device */
+    uint8_t spc = 1;
+    while ((total - reserved - root_sectors) / spc > 65524 && spc < 64) {
+        spc <<= 1;
+    }
+
+    uint32_t clusters = (total - reserved - root_sectors) / spc;
+    if (clusters > 65524) {
+        vga_print_color("Device too large for FAT16\n", LIGHT_RED);
+        return -1;
+    }
+
+    fat_type_t type = FAT_TYPE_16;
+    uint32_t fat_size = ((clusters + 2) * 2 + 511) / 512;
+    clusters = (total - reserved - num_fats * fat_size - root_sectors) / spc;
+
+    if (clusters < 4085) {
+        type = FAT_TYPE_12;
+        fat_size = ((clusters + 2) * 3 / 2 + 511) / 512;
+        clusters = (total - reserved - num_fats * fat_size - root_sectors) / spc;
+        if (clusters > 4084) {
+            /* Leave the tail unused rather than tip over into FAT16 */
+            clusters = 4084;
+            total = reserved + num_fats * fat_size + root_sectors + clusters * spc;
+        }
+    }
+
+    uint32_t meta_sectors = reserved + num_fats * fat_size + root_sectors;
+
+    /* FATs and root directory start out zeroed */
+    memset(cluster_buf, 0, MAX_CLUSTER_SIZE);
+    uint32_t chunk = MAX_CLUSTER_SIZE / 512;
+    for (uint32_t s = reserved; s < meta_sectors; s += chunk) {
+        uint32_t n = meta_sectors - s;
+        if (n > chunk) n = chunk;
+        if (blkdev_write(dev, s, n, cluster_buf) < 0) {
+            vga_print_color("Write error\n", LIGHT_RED);
+            return -1;
+        }
+    }
+
+    /* Reserved entries 0 and 1 in every FAT copy */
+    uint8_t* fat = cluster_buf;
+    fat[0] = 0xF8;
+    fat[1] = 0xFF;
+    fat[2] = 0xFF;
+    if (type == FAT_TYPE_16) fat[3] = 0xFF;
+    for (uint8_t i = 0; i < num_fats; i++) {
+        if (blkdev_write(dev, reserved + i * fat_size, 1, fat) < 0) {
+            vga_print_color("Write error\n", LIGHT_RED);
+            return -1;
+        }
+    }
+
+    memset(cluster_buf, 0, 512);
+    fat16_ebpb_t* boot = (fat16_ebpb_t*)cluster_buf;
+    boot->bpb.jmp[0] = 0xEB;
+    boot->bpb.jmp[1] = 0x3C;
+    boot->bpb.jmp[2] = 0x90;
+    memcpy(boot->bpb.oem, "MSWIN4.1", 8);
+    boot->bpb.bytes_per_sector = 512;
+    boot->bpb.sectors_per_cluster = spc;
+    boot->bpb.reserved_sectors = reserved;
+    boot->bpb.num_fats = num_fats;
+    boot->bpb.root_entry_count = root_entries;
+    if (total < 0x10000) {
+        boot->bpb.total_sectors_16 = (uint16_t)total;
+    } else {
+        boot->bpb.total_sectors_32 = total;
+    }
+    boot->bpb.media_type = 0xF8;
+    boot->bpb.fat_size_16 = (uint16_t)fat_size;
+    boot->bpb.sectors_per_track = 63;
+    boot->bpb.num_heads = 16;
+    boot->drive_number = 0x80;
+    boot->boot_sig = 0x29;
+    boot->volume_id = 0x12345678;
+
+    memset(boot->volume_label, ' ', 11);
+    const char* name = (label && label[0]) ? label : "NO NAME";
+    for (int i = 0; i < 11 && name[i]; i++) {
+        char c = name[i];
+        if (c >= 'a' && c <= 'z') c -= 32;
+        boot->volume_label[i] = c;
+    }
+    memcpy(boot->fs_type, type == FAT_TYPE_12 ? "FAT12   " : "FAT16   ", 8);
+
+    cluster_buf[510] = 0x55;
+    cluster_buf[511] = 0xAA;
+
+    if (blkdev_write(dev, 0, 1, cluster_buf) < 0) {
+        vga_print_color("Write error\n", LIGHT_RED);
+        return -1;
+    }
+
+    blkdev_flush(dev);
+    return 0;
+}
+
 int fat_cd(const char* path) {
     if (!fat_state.mounted) {
         vga_print_color("No filesystem mounted\n", LIGHT_RED);
@@ -873,196 +2374,243 @@ int fat_cat(const char* path) {
         return -1;
     }
 
+    wb_file_t* staged = wb_find(&found_pos);
+    if (staged) {
+        const uint8_t* data = wb_data + staged->offset;
+        for (uint32_t i = 0; i < staged->size && data[i] != '\0'; i++) vga_putc(data[i]);
+        vga_putc('\n');
+        return 0;
+    }
+
     uint32_t remaining = entry.file_size;
     cluster = get_entry_cluster(&entry);
-    uint16_t bps = fat_state.bytes_per_sector;
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
 
-    while (cluster < 0x0FFFFFF8 && remaining > 0) {
-        uint32_t sector = cluster_to_sector(cluster);
-
-        for (int s = 0; s < fat_state.sectors_per_cluster && remaining > 0; s++) {
-            if (read_sector(sector + s, fat_state.sector_buf) < 0) {
-                vga_print_color("\nRead error\n", LIGHT_RED);
-                return -1;
-            }
+    while (cluster >= 2 && cluster < 0x0FFFFFF8 && remaining > 0) {
+        const uint8_t* data = ra_get_cluster(cluster);
+        if (!data) {
+            vga_print_color("\nRead error\n", LIGHT_RED);
+            return -1;
+        }
 
-            uint32_t to_print = (remaining < bps) ? remaining : bps;
-            for (uint32_t i = 0; i < to_print; i++) {
-                char c = fat_state.sector_buf[i];
-                if (c == '\0') break;
-                vga_putc(c);
-            }
-            remaining -= to_print;
+        uint32_t to_print = (remaining < csize) ? remaining : csize;
+        for (uint32_t i = 0; i < to_print; i++) {
+            char c = data[i];
+            if (c == '\0') break;
+            vga_putc(c);
         }
+        remaining -= to_print;
 
-        cluster = fat_get_entry(cluster);
+        cluster = ra.next;
     }
 
     vga_putc('\n');
     return 0;
 }
 
+/*
+ * Reads of at least RA_DIRECT_MIN bytes skip read-ahead: whole sectors go
+ * straight into the caller's buffer, one request per contiguous run, and
+ * only a partial head or tail sector is bounced through cluster_buf.
+ * Shorter reads are served from the read-ahead buffer.
+ */
+static int file_read(fat_file_t* f, uint32_t offset, uint8_t* buf, uint32_t size) {
+    if (offset >= f->size) return 0;
+    if (size > f->size - offset) size = f->size - offset;
+
+    uint16_t bps = fat_state.bytes_per_sector;
+    uint32_t csize = fat_state.sectors_per_cluster * bps;
+    int direct = (size >= RA_DIRECT_MIN);
+    uint32_t done = 0;
+
+    while (done < size) {
+        uint32_t pos = offset + done;
+        uint32_t run;
+        uint32_t cluster = file_cluster_at(f, pos / csize, &run);
+        if (cluster == 0) return -1;
+
+        uint32_t in_cluster = pos % csize;
+        uint32_t sector = cluster_to_sector(cluster) + in_cluster / bps;
+        uint32_t bytes;
+
+        if (!direct) {
+            const uint8_t* data = ra_get_cluster(cluster);
+            if (!data) return -1;
+
+            bytes = csize - in_cluster;
+            if (bytes > size - done) bytes = size - done;
+            memcpy(buf + done, data + in_cluster, bytes);
+        } else if (pos % bps == 0 && size - done >= bps) {
+            bytes = size - done;
+            if (run <= (bytes + in_cluster) / csize) bytes = run * csize - in_cluster;
+            bytes -= bytes % bps;
+
+            if (read_sectors(sector, bytes / bps, buf + done) < 0) return -1;
+            ra.stats.requests++;
+            ra.stats.direct += bytes / bps;
+        } else {
+            if (read_sectors(sector, 1, cluster_buf) < 0) return -1;
+            ra.stats.requests++;
+
+            bytes = bps - pos % bps;
+            if (bytes > size - done) bytes = size - done;
+            memcpy(buf + done, cluster_buf + pos % bps, bytes);
+        }
+        done += bytes;
+    }
+
+    return (int)done;
+}
+
 int fat_read(const char* path, void* buffer, uint32_t max_size) {
     if (!fat_state.mounted) return -1;
 
     fat_dir_entry_t entry;
-    uint32_t cluster;
-
-    if (fat_resolve_path(path, &cluster, &entry) < 0) return -1;
+    if (fat_resolve_path(path, NULL, &entry) < 0) return -1;
     if (entry.attr & FAT_ATTR_DIRECTORY) return -1;
 
-    uint32_t to_read = entry.file_size;
-    if (to_read > max_size) to_read = max_size;
-
-    uint32_t read_total = 0;
-    uint8_t* buf = (uint8_t*)buffer;
-    cluster = get_entry_cluster(&entry);
-    uint16_t bps = fat_state.bytes_per_sector;
+    wb_file_t* staged = wb_find(&found_pos);
+    if (staged) {
+        uint32_t n = (staged->size < max_size) ? staged->size : max_size;
+        memcpy(buffer, wb_data + staged->offset, n);
+        return (int)n;
+    }
 
-    while (cluster < 0x0FFFFFF8 && read_total < to_read) {
-        uint32_t sector = cluster_to_sector(cluster);
+    /* An unlisted handle, so the whole-file read takes the same path as fat_read_at() */
+    fat_file_t f;
+    memset(&f, 0, sizeof(fat_file_t));
+    f.first = get_entry_cluster(&entry);
+    f.size = entry.file_size;
 
-        for (int s = 0; s < fat_state.sectors_per_cluster && read_total < to_read; s++) {
-            if (read_sector(sector + s, fat_state.sector_buf) < 0) return -1;
+    return file_read(&f, 0, (uint8_t*)buffer, max_size);
+}
 
-            uint32_t chunk = to_read - read_total;
-            if (chunk > bps) chunk = bps;
+/* Link a zeroed cluster to the end of a directory that holds `capacity` entries */
+static int dir_grow(uint32_t dir, uint32_t capacity) {
+    if (dir_is_fixed_root(dir)) return -1;
 
-            memcpy(buf + read_total, fat_state.sector_buf, chunk);
-            read_total += chunk;
-        }
+    uint32_t per_cluster = fat_state.entries_per_sector * fat_state.sectors_per_cluster;
+    uint32_t tail = ext_cluster_at(dir, capacity / per_cluster - 1, NULL);
+    if (tail == 0) return -1;
 
-        cluster = fat_get_entry(cluster);
-    }
+    uint32_t new_cluster = fat_alloc_cluster();
+    if (new_cluster == 0) return -1;
 
-    return (int)read_total;
+    return fat_set_entry(tail, new_cluster);
 }
 
-static int find_empty_entries(uint32_t dir_cluster, int count, uint32_t* out_sector, int* out_index) {
-    int consecutive = 0;
-    uint32_t first_sector = 0;
-    int first_index = 0;
-    uint16_t entries_per_sec = fat_state.entries_per_sector;
+/* Find `count` consecutive free entries, growing the directory if needed */
+static int find_empty_entries(uint32_t dir_cluster, int count, uint32_t* out_ord) {
+    uint32_t per_cluster = fat_state.entries_per_sector * fat_state.sectors_per_cluster;
+    int x = diridx_find(dir_cluster);
 
-    if (dir_cluster == 0 && fat_state.type != FAT_TYPE_32) {
-        for (uint32_t s = 0; s < fat_state.root_dir_sectors; s++) {
-            if (read_sector(fat_state.root_dir_sector + s, fat_state.sector_buf) < 0)
-                return -1;
-
-            fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-            for (uint16_t i = 0; i < entries_per_sec; i++) {
-                if (entries[i].name[0] == 0x00 || (uint8_t)entries[i].name[0] == 0xE5) {
-                    if (consecutive == 0) {
-                        first_sector = fat_state.root_dir_sector + s;
-                        first_index = i;
-                    }
-                    consecutive++;
-                    if (consecutive >= count) {
-                        *out_sector = first_sector;
-                        *out_index = first_index;
-                        return 0;
-                    }
-                } else {
-                    consecutive = 0;
-                }
-            }
-        }
-        return -1;
-    }
+    if (x >= 0) {
+        if (diridx_take_slots(x, count, out_ord) == 0) return 0;
+        if ((uint32_t)count > per_cluster) return -1;
+        if (dir_grow(dir_cluster, diridx[x].capacity) < 0) return -1;
 
-    uint32_t cluster = dir_cluster;
-    while (cluster < 0x0FFFFFF8) {
-        uint32_t sector = cluster_to_sector(cluster);
+        diridx[x].capacity += per_cluster;
+        return diridx_take_slots(x, count, out_ord);
+    }
 
-        for (int s = 0; s < fat_state.sectors_per_cluster; s++) {
-            if (read_sector(sector + s, fat_state.sector_buf) < 0) return -1;
-
-            fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-            for (uint16_t i = 0; i < entries_per_sec; i++) {
-                if (entries[i].name[0] == 0x00 || (uint8_t)entries[i].name[0] == 0xE5) {
-                    if (consecutive == 0) {
-                        first_sector = sector + s;
-                        first_index = i;
-                    }
-                    consecutive++;
-                    if (consecutive >= count) {
-                        *out_sector = first_sector;
-                        *out_index = first_index;
-                        return 0;
-                    }
-                } else {
-                    consecutive = 0;
+    int consecutive = 0;
+    uint32_t first_ord = 0;
+    uint16_t entries_per_sec = fat_state.entries_per_sector;
+    uint32_t ord;
+
+    for (ord = 0; ; ord += entries_per_sec) {
+        uint32_t sector = dir_ord_sector(dir_cluster, ord, NULL);
+        if (sector == 0) break;
+        if (read_sector(sector, fat_state.sector_buf) < 0) return -1;
+
+        fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
+        for (uint16_t i = 0; i < entries_per_sec; i++) {
+            if (entries[i].name[0] == 0x00 || (uint8_t)entries[i].name[0] == 0xE5) {
+                if (consecutive == 0) first_ord = ord + i;
+                consecutive++;
+                if (consecutive >= count) {
+                    *out_ord = first_ord;
+                    return 0;
                 }
+            } else {
+                consecutive = 0;
             }
         }
-
-        cluster = fat_get_entry(cluster);
     }
 
-    uint32_t new_cluster = fat_alloc_cluster();
-    if (new_cluster == 0) return -1;
-
-    fat_set_entry(cluster, new_cluster);
-    if (fat_state.fat_cache_dirty) {
-        write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-        fat_state.fat_cache_dirty = 0;
-    }
+    if ((uint32_t)count > per_cluster) return -1;
+    if (dir_grow(dir_cluster, ord) < 0) return -1;
 
-    *out_sector = cluster_to_sector(new_cluster);
-    *out_index = 0;
+    /* A free run at the old end carries on into the new cluster */
+    *out_ord = consecutive ? first_ord : ord;
     return 0;
 }
 
-static int create_lfn_entries(uint32_t dir_cluster, const char* name,
-                              const char* short_name, uint32_t* entry_sector, int* entry_index) {
+/*
+ * Add `name` to directory `dir`: its long-name entries and the short entry
+ * go through one directory transaction, so each sector they share is
+ * read and written once. The short entry's location goes to *out.
+ */
+static int create_entry(uint32_t dir, const char* name, uint8_t attr,
+                        uint32_t cluster, uint32_t size, dir_pos_t* out) {
+    char short_name[11];
+    str_to_fat_name(name, short_name);
+
     int name_len = strlen(name);
-    int lfn_entries = (name_len + 12) / 13;
+    uint8_t lfn = needs_lfn(name) ? (name_len + 12) / 13 : 0;
+    uint32_t ord;
 
-    if (find_empty_entries(dir_cluster, lfn_entries + 1, entry_sector, entry_index) < 0) {
-        return -1;
-    }
+    if (find_empty_entries(dir, lfn + 1, &ord) < 0) return -1;
 
     uint8_t checksum = lfn_checksum(short_name);
-
-    uint32_t current_sector = *entry_sector;
-    int current_index = *entry_index;
-    uint16_t entries_per_sec = fat_state.entries_per_sector;
-
-    for (int ord = lfn_entries; ord >= 1; ord--) {
-        if (read_sector(current_sector, fat_state.sector_buf) < 0) return -1;
-
-        fat_lfn_entry_t* lfn = (fat_lfn_entry_t*)&((fat_dir_entry_t*)fat_state.sector_buf)[current_index];
-
-        memset(lfn, 0xFF, sizeof(fat_lfn_entry_t));
-        lfn->order = ord | ((ord == lfn_entries) ? 0x40 : 0);
-        lfn->attr = FAT_ATTR_LFN;
-        lfn->type = 0;
-        lfn->checksum = checksum;
-        lfn->cluster = 0;
-
-        int pos = (ord - 1) * 13;
+    fat_dir_entry_t* e;
+    uint16_t index;
+
+    for (int n = lfn; n >= 1; n--, ord++) {
+        uint32_t sector = dir_ord_sector(dir, ord, &index);
+        if (sector == 0 || !(e = dirtx_entry(sector, index))) return -1;
+
+        fat_lfn_entry_t* l = (fat_lfn_entry_t*)e;
+        memset(l, 0xFF, sizeof(fat_lfn_entry_t));
+        l->order = n | ((n == lfn) ? 0x40 : 0);
+        l->attr = FAT_ATTR_LFN;
+        l->type = 0;
+        l->checksum = checksum;
+        l->cluster = 0;
+
+        int pos = (n - 1) * 13;
         for (int k = 0; k < 5; k++) {
-            lfn->name1[k] = (pos < name_len) ? (uint16_t)(uint8_t)name[pos++] : 0x0000;
+            l->name1[k] = (pos < name_len) ? (uint16_t)(uint8_t)name[pos++] : 0x0000;
         }
         for (int k = 0; k < 6; k++) {
-            lfn->name2[k] = (pos < name_len) ? (uint16_t)(uint8_t)name[pos++] : 0x0000;
+            l->name2[k] = (pos < name_len) ? (uint16_t)(uint8_t)name[pos++] : 0x0000;
         }
         for (int k = 0; k < 2; k++) {
-            lfn->name3[k] = (pos < name_len) ? (uint16_t)(uint8_t)name[pos++] : 0x0000;
+            l->name3[k] = (pos < name_len) ? (uint16_t)(uint8_t)name[pos++] : 0x0000;
         }
+    }
 
-        if (write_sector(current_sector, fat_state.sector_buf) < 0) return -1;
+    uint32_t sector = dir_ord_sector(dir, ord, &index);
+    if (sector == 0 || !(e = dirtx_entry(sector, index))) return -1;
 
-        current_index++;
-        if (current_index >= (int)entries_per_sec) {
-            current_index = 0;
-            current_sector++;
-        }
-    }
+    memset(e, 0, sizeof(fat_dir_entry_t));
+    memcpy(e->name, short_name, 11);
+    e->attr = attr;
+    e->cluster_lo = cluster & 0xFFFF;
+    e->cluster_hi = (cluster >> 16) & 0xFFFF;
+    e->file_size = size;
 
-    *entry_sector = current_sector;
-    *entry_index = current_index;
+    char key[FAT_MAX_NAME];
+    if (lfn) strcpy(key, name);
+    else fat_name_to_str(e, key);
 
+    if (dirtx_commit() < 0) return -1;
+
+    dir_pos_t pos = { sector, index, ord, lfn };
+    diridx_add_name(dir, key, ord, lfn);
+    to_upper(key);
+    dcache_insert(dir, key, 0, &pos);
+    if (out) *out = pos;
     return 0;
 }
 
@@ -1082,29 +2630,27 @@ static int is_valid_name(const char* name) {
     return 1;
 }
 
-int fat_touch(const char* path) {
+static int touch_entry(const char* path) {
     if (!fat_state.mounted) {
         vga_print_color("No filesystem mounted\n", LIGHT_RED);
         return -1;
     }
 
-    char parent_path[FAT_MAX_PATH];
+    uint32_t parent_cluster;
     char filename[FAT_MAX_NAME];
+    fat_dir_entry_t existing;
 
-    strncpy(parent_path, path, FAT_MAX_PATH - 1);
-    parent_path[FAT_MAX_PATH - 1] = '\0';
-
-    char* last_slash = strrchr(parent_path, '/');
-    if (last_slash) {
-        strcpy(filename, last_slash + 1);
-        if (last_slash == parent_path) {
-            parent_path[1] = '\0';
-        } else {
-            *last_slash = '\0';
+    int found = lookup_entry(path, &parent_cluster, filename, &existing);
+    if (found < 0) {
+        vga_print_color("Parent directory not found\n", LIGHT_RED);
+        return -1;
+    }
+    if (found == 0) {
+        if (existing.attr & FAT_ATTR_DIRECTORY) {
+            vga_print_color("A directory with this name exists\n", LIGHT_RED);
+            return -1;
         }
-    } else {
-        strcpy(filename, path);
-        strcpy(parent_path, ".");
+        return 0;
     }
 
     if (!is_valid_name(filename)) {
@@ -1112,336 +2658,539 @@ int fat_touch(const char* path) {
         return -1;
     }
 
-    uint32_t parent_cluster;
-    fat_dir_entry_t parent_entry;
+    if (create_entry(parent_cluster, filename, FAT_ATTR_ARCHIVE, 0, 0, NULL) < 0) {
+        vga_print_color("Directory full or disk full\n", LIGHT_RED);
+        return -1;
+    }
+    return 0;
+}
 
-    if (strcmp(parent_path, ".") == 0) {
-        parent_cluster = fat_state.current_cluster;
-    } else if (strcmp(parent_path, "/") == 0) {
-        parent_cluster = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
-    } else {
-        if (fat_resolve_path(parent_path, &parent_cluster, &parent_entry) < 0) {
-            vga_print_color("Parent directory not found\n", LIGHT_RED);
+int fat_touch(const char* path) {
+    int result = touch_entry(path);
+    if (fat_state.mounted && fat_commit() < 0) result = -1;
+    return result;
+}
+
+/*
+ * Keep a small file's data in wb_data until the next flush. A new name gets
+ * an empty entry now; an existing one whose clusters were just freed is
+ * emptied, so the disk never points at them.
+ */
+static int wb_stage(uint32_t dir, const char* name, const dir_pos_t* existing,
+                    int empty_entry, const void* data, uint32_t size) {
+    dir_pos_t pos;
+
+    if (!existing) {
+        if (create_entry(dir, name, FAT_ATTR_ARCHIVE, 0, 0, &pos) < 0) {
+            vga_print_color("Directory full or disk full\n", LIGHT_RED);
             return -1;
         }
+    } else {
+        pos = *existing;
+        if (empty_entry) {
+            fat_dir_entry_t* e = dirtx_entry(pos.sector, pos.index);
+            if (!e) return -1;
+            e->cluster_lo = 0;
+            e->cluster_hi = 0;
+            e->file_size = 0;
+            if (dirtx_commit() < 0) return -1;
+        }
+    }
+
+    wb_file_t* r = wb_find(&pos);
+    if (size == 0) {
+        if (r) wb_forget(r);
+        return 0;
+    }
+
+    if (!r) {
+        r = &wb.files[0];
+        while (r->used) r++;
+        r->used = 1;
+        r->room = 0;
+        wb.count++;
+    }
+
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+    uint32_t need = (size + csize - 1) / csize * csize;
+
+    /* A rewrite that still fits keeps its slot; otherwise the old one is left for wb_compact() */
+    if (need > r->room) {
+        r->offset = wb.used;
+        r->room = need;
+        wb.used += need;
+    }
+    r->dir = dir;
+    r->pos = pos;
+    r->size = size;
+    memcpy(wb_data + r->offset, data, size);
+    memset(wb_data + r->offset + size, 0, need - size);
+    return 0;
+}
+
+/*
+ * The path is looked up once: an existing entry is patched in place at
+ * the location the lookup returned, a new one is created only after its
+ * data is out, with cluster and size already filled in.
+ */
+static int write_file(const char* path, const void* data, uint32_t size) {
+    if (!fat_state.mounted) {
+        vga_print_color("No filesystem mounted\n", LIGHT_RED);
+        return -1;
+    }
+
+    int stage = wb.enabled && size <= FAT_WB_FILE_MAX;
+    if (stage && !wb_has_room(size)) wb_flush();
+
+    uint32_t parent_cluster;
+    char filename[FAT_MAX_NAME];
+    fat_dir_entry_t entry;
+
+    int found = lookup_entry(path, &parent_cluster, filename, &entry);
+    if (found < 0) {
+        vga_print_color("Parent directory not found\n", LIGHT_RED);
+        return -1;
+    }
+    int file_exists = (found == 0);
+    dir_pos_t pos = found_pos;
+
+    if (file_exists && (entry.attr & FAT_ATTR_DIRECTORY)) {
+        vga_print_color("Cannot write to directory\n", LIGHT_RED);
+        return -1;
+    }
+    if (!file_exists && !is_valid_name(filename)) {
+        vga_print_color("Invalid filename\n", LIGHT_RED);
+        return -1;
+    }
+
+    uint32_t old_cluster = file_exists ? get_entry_cluster(&entry) : 0;
+    wb_file_t* staged = file_exists ? wb_find(&pos) : NULL;
+    fat_free_chain(old_cluster);
+
+    if (stage) {
+        return wb_stage(parent_cluster, filename, file_exists ? &pos : NULL,
+                        staged == NULL && old_cluster != 0, data, size);
+    }
+    if (staged) wb_forget(staged);
+
+    uint32_t first_cluster = 0;
+    uint32_t prev_cluster = 0;
+    uint32_t bytes_written = 0;
+    const uint8_t* src = (const uint8_t*)data;
+    uint16_t bps = fat_state.bytes_per_sector;
+    uint32_t cluster_bytes = fat_state.sectors_per_cluster * bps;
+
+    uint32_t clusters_left = (size + cluster_bytes - 1) / cluster_bytes;
+    int result = 0;
+
+    while (bytes_written < size) {
+        /*
+         * Reserve a contiguous run for what is left; every byte of it that
+         * matters is about to be written, so nothing is zero-filled.
+         */
+        uint32_t run;
+        uint32_t cluster = fat_claim_extent(clusters_left, &run);
+        if (cluster == 0) {
+            vga_print_color("Disk full\n", LIGHT_RED);
+            result = -1;
+            break;
+        }
+
+        if (first_cluster == 0) first_cluster = cluster;
+        if (prev_cluster != 0) {
+            fat_set_entry(prev_cluster, cluster);
+        }
+        prev_cluster = cluster + run - 1;
+        clusters_left -= run;
+
+        /* The whole extent goes out as one request straight from the caller's buffer */
+        uint32_t sector = cluster_to_sector(cluster);
+        uint32_t bytes = size - bytes_written;
+        if (bytes > run * cluster_bytes) bytes = run * cluster_bytes;
+
+        uint32_t full = bytes / bps;
+        if (full > 0 && queue_sectors(sector, full, src + bytes_written) < 0) result = -1;
+
+        uint32_t tail = bytes % bps;
+        if (tail && result == 0) {
+            memset(tail_buf, 0, bps);
+            memcpy(tail_buf, src + bytes_written + full * bps, tail);
+            if (queue_sectors(sector + full, 1, tail_buf) < 0) result = -1;
+        }
+        if (result < 0) {
+            vga_print_color("Write error\n", LIGHT_RED);
+            break;
+        }
+
+        bytes_written += bytes;
+    }
+
+    /* Whatever was claimed for a failed write goes back; the file ends up empty */
+    if (result < 0) {
+        fat_free_chain(first_cluster);
+        first_cluster = 0;
+        size = 0;
     }
 
-    fat_dir_entry_t existing;
-    if (fat_find_in_dir(parent_cluster, filename, &existing) == 0) {
-        if (existing.attr & FAT_ATTR_DIRECTORY) {
-            vga_print_color("A directory with this name exists\n", LIGHT_RED);
+    if (!file_exists) {
+        if (result < 0) return -1;
+        if (create_entry(parent_cluster, filename, FAT_ATTR_ARCHIVE, first_cluster, size, NULL) < 0) {
+            fat_free_chain(first_cluster);
+            vga_print_color("Directory full or disk full\n", LIGHT_RED);
             return -1;
         }
         return 0;
     }
 
-    char short_name[11];
-    str_to_fat_name(filename, short_name);
+    /* The old chain is gone either way, so the entry is patched even on failure */
+    fat_dir_entry_t* e = dirtx_entry(pos.sector, pos.index);
+    if (!e) return -1;
+    e->cluster_lo = first_cluster & 0xFFFF;
+    e->cluster_hi = (first_cluster >> 16) & 0xFFFF;
+    e->file_size = size;
+    if (dirtx_commit() < 0) return -1;
 
-    uint32_t entry_sector;
-    int entry_index;
+    return result;
+}
 
-    if (needs_lfn(filename)) {
-        if (create_lfn_entries(parent_cluster, filename, short_name, &entry_sector, &entry_index) < 0) {
-            vga_print_color("Directory full or disk full\n", LIGHT_RED);
+/* The sync also issues data write_file() queued from the caller's buffer; staged data needs none */
+int fat_write(const char* path, const void* data, uint32_t size) {
+    int staged = wb.enabled && size <= FAT_WB_FILE_MAX;
+    int result = write_file(path, data, size);
+    if (fat_state.mounted) {
+        if (staged) wb_mark();
+        else if (fat_sync() < 0) result = -1;
+    }
+    return result;
+}
+
+/* Grow the chain to `clusters`; on a full volume what was claimed stays in the chain */
+static int file_extend(fat_file_t* f, uint32_t clusters) {
+    while (f->clusters < clusters) {
+        uint32_t tail = 0;
+        if (f->first != 0) {
+            tail = ext_cluster_at(f->first, f->clusters - 1, NULL);
+            if (tail == 0) return -1;
+        }
+
+        uint32_t run;
+        uint32_t start = fat_claim_extent(clusters - f->clusters, &run);
+        if (start == 0) return -1;
+
+        if (tail == 0) {
+            f->first = start;
+        } else if (fat_set_entry(tail, start) < 0) {
             return -1;
         }
+        f->clusters += run;
+        f->dirty = 1;
+    }
+    return 0;
+}
+
+/* Write n bytes at byte `skip` of a data sector; keep = preserve the rest of the sector */
+static int file_patch_sector(uint32_t sector, uint32_t skip, const uint8_t* src, uint32_t n, int keep) {
+    if (keep) {
+        if (read_sectors(sector, 1, tail_buf) < 0) return -1;
     } else {
-        if (find_empty_entries(parent_cluster, 1, &entry_sector, &entry_index) < 0) {
-            vga_print_color("Directory full or disk full\n", LIGHT_RED);
-            return -1;
+        memset(tail_buf, 0, fat_state.bytes_per_sector);
+    }
+
+    if (src) memcpy(tail_buf + skip, src, n);
+    else memset(tail_buf + skip, 0, n);
+
+    return write_sectors(sector, 1, tail_buf);
+}
+
+/* src NULL writes zeros. Returns bytes written, short if the volume fills up */
+static int file_write(fat_file_t* f, uint32_t offset, const uint8_t* src, uint32_t size) {
+    uint16_t bps = fat_state.bytes_per_sector;
+    uint32_t csize = fat_state.sectors_per_cluster * bps;
+
+    if (size > 0xFFFFFFFF - offset) size = 0xFFFFFFFF - offset;
+    uint32_t end = offset + size;
+    uint32_t need = end / csize + (end % csize != 0);
+
+    if (file_extend(f, need) < 0) {
+        vga_print_color("Disk full\n", LIGHT_RED);
+        uint64_t cap = (uint64_t)f->clusters * csize;
+        if (cap <= offset) return -1;
+        if (cap < end) {
+            end = (uint32_t)cap;
+            size = end - offset;
         }
     }
 
-    if (read_sector(entry_sector, fat_state.sector_buf) < 0) return -1;
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t pos = offset + done;
+        uint32_t run;
+        uint32_t cluster = file_cluster_at(f, pos / csize, &run);
+        if (cluster == 0) return -1;
+
+        /* As much as the contiguous run takes */
+        uint32_t in_cluster = pos % csize;
+        uint32_t bytes = size - done;
+        if ((uint64_t)run * csize - in_cluster < bytes) bytes = run * csize - in_cluster;
+
+        uint32_t sector = cluster_to_sector(cluster) + in_cluster / bps;
+        uint32_t skip = in_cluster % bps;
+        const uint8_t* from = src ? src + done : NULL;
+
+        if (skip || bytes < bps) {
+            uint32_t n = bps - skip;
+            if (n > bytes) n = bytes;
+            if (file_patch_sector(sector, skip, from, n, pos - skip < f->size) < 0) return -1;
+            sector++;
+            if (from) from += n;
+            bytes -= n;
+            done += n;
+            pos += n;
+        }
 
-    fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-    fat_dir_entry_t* new_entry = &entries[entry_index];
+        uint32_t full = bytes / bps;
+        if (full > 0) {
+            if (from) {
+                if (write_sectors(sector, full, from) < 0) return -1;
+                from += full * bps;
+            } else {
+                uint32_t chunk = MAX_CLUSTER_SIZE / bps;
+                memset(cluster_buf, 0, MAX_CLUSTER_SIZE);
+                for (uint32_t s = 0; s < full; s += chunk) {
+                    uint32_t n = full - s;
+                    if (n > chunk) n = chunk;
+                    if (write_sectors(sector + s, n, cluster_buf) < 0) return -1;
+                }
+            }
+            sector += full;
+            done += full * bps;
+            pos += full * bps;
+        }
 
-    memset(new_entry, 0, sizeof(fat_dir_entry_t));
-    memcpy(new_entry->name, short_name, 11);
-    new_entry->attr = FAT_ATTR_ARCHIVE;
-    new_entry->file_size = 0;
-    new_entry->cluster_lo = 0;
-    new_entry->cluster_hi = 0;
+        uint32_t tail = bytes % bps;
+        if (tail) {
+            if (file_patch_sector(sector, 0, from, tail, pos < f->size) < 0) return -1;
+            done += tail;
+        }
 
-    if (write_sector(entry_sector, fat_state.sector_buf) < 0) return -1;
+        if (offset + done > f->size) {
+            f->size = offset + done;
+            f->dirty = 1;
+        }
+    }
 
-    return 0;
+    return (int)done;
 }
 
-int fat_write(const char* path, const void* data, uint32_t size) {
+int fat_open(const char* path, int flags) {
     if (!fat_state.mounted) {
         vga_print_color("No filesystem mounted\n", LIGHT_RED);
         return -1;
     }
 
-    fat_dir_entry_t entry;
-    uint32_t dummy;
-    int file_exists = (fat_resolve_path(path, &dummy, &entry) == 0);
-
-    if (file_exists && (entry.attr & FAT_ATTR_DIRECTORY)) {
-        vga_print_color("Cannot write to directory\n", LIGHT_RED);
+    int fd = 0;
+    while (fd < FAT_MAX_OPEN && files[fd].used) fd++;
+    if (fd == FAT_MAX_OPEN) {
+        vga_print_color("Too many open files\n", LIGHT_RED);
         return -1;
     }
 
-    if (!file_exists) {
-        if (fat_touch(path) < 0) {
+    uint32_t parent_cluster;
+    char name[FAT_MAX_NAME];
+    fat_dir_entry_t entry;
+
+    int found = lookup_entry(path, &parent_cluster, name, &entry);
+    if (found == 0 && wb_find(&found_pos)) {
+        /* Staged data gets its clusters before a handle can address them */
+        wb_flush();
+        found = lookup_entry(path, &parent_cluster, name, &entry);
+    }
+    if (found != 0) {
+        if (found < 0 || !(flags & FAT_O_CREATE)) {
+            vga_print_color("File not found\n", LIGHT_RED);
             return -1;
         }
-        if (fat_resolve_path(path, &dummy, &entry) < 0) {
-            vga_print_color("Failed to create file\n", LIGHT_RED);
+        if (!is_valid_name(name)) {
+            vga_print_color("Invalid filename\n", LIGHT_RED);
             return -1;
         }
+        if (create_entry(parent_cluster, name, FAT_ATTR_ARCHIVE, 0, 0, &found_pos) < 0) {
+            vga_print_color("Directory full or disk full\n", LIGHT_RED);
+            return -1;
+        }
+        memset(&entry, 0, sizeof(fat_dir_entry_t));
+        entry.attr = FAT_ATTR_ARCHIVE;
     }
 
-    uint32_t old_cluster = get_entry_cluster(&entry);
-    while (old_cluster >= 2 && old_cluster < 0x0FFFFFF8) {
-        uint32_t next = fat_get_entry(old_cluster);
-        fat_set_entry(old_cluster, 0);
-        old_cluster = next;
+    if (found_pos.sector == 0 || (entry.attr & FAT_ATTR_DIRECTORY)) {
+        vga_print_color("Is a directory\n", LIGHT_RED);
+        return -1;
     }
 
-    if (fat_state.fat_cache_dirty) {
-        write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-        fat_state.fat_cache_dirty = 0;
-    }
+    uint32_t csize = fat_state.sectors_per_cluster * fat_state.bytes_per_sector;
+    fat_file_t* f = &files[fd];
 
-    if (size == 0) {
-        char parent_path[FAT_MAX_PATH];
-        char filename[FAT_MAX_NAME];
-
-        strncpy(parent_path, path, FAT_MAX_PATH - 1);
-        char* last_slash = strrchr(parent_path, '/');
-        if (last_slash) {
-            strcpy(filename, last_slash + 1);
-            if (last_slash == parent_path) parent_path[1] = '\0';
-            else *last_slash = '\0';
-        } else {
-            strcpy(filename, path);
-            strcpy(parent_path, ".");
-        }
+    memset(f, 0, sizeof(fat_file_t));
+    f->used = 1;
+    f->flags = flags;
+    f->dir_sector = found_pos.sector;
+    f->dir_index = found_pos.index;
+    f->first = get_entry_cluster(&entry);
+    f->size = entry.file_size;
+    f->clusters = f->size / csize + (f->size % csize != 0);
 
-        uint32_t parent_cluster;
-        if (strcmp(parent_path, ".") == 0) {
-            parent_cluster = fat_state.current_cluster;
-        } else if (strcmp(parent_path, "/") == 0) {
-            parent_cluster = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
-        } else {
-            fat_dir_entry_t pentry;
-            fat_resolve_path(parent_path, &parent_cluster, &pentry);
-        }
-
-        char fat_name[11];
-        str_to_fat_name(filename, fat_name);
-        uint16_t entries_per_sec = fat_state.entries_per_sector;
-
-        if (parent_cluster == 0 && fat_state.type != FAT_TYPE_32) {
-            for (uint32_t s = 0; s < fat_state.root_dir_sectors; s++) {
-                read_sector(fat_state.root_dir_sector + s, fat_state.sector_buf);
-                fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-                for (uint16_t i = 0; i < entries_per_sec; i++) {
-                    if (memcmp(entries[i].name, fat_name, 11) == 0) {
-                        entries[i].cluster_lo = 0;
-                        entries[i].cluster_hi = 0;
-                        entries[i].file_size = 0;
-                        write_sector(fat_state.root_dir_sector + s, fat_state.sector_buf);
-                        return 0;
-                    }
-                }
-            }
-        } else {
-            uint32_t cluster = parent_cluster;
-            while (cluster < 0x0FFFFFF8) {
-                uint32_t sector = cluster_to_sector(cluster);
-
-                for (int s = 0; s < fat_state.sectors_per_cluster; s++) {
-                    read_sector(sector + s, fat_state.sector_buf);
-                    fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-                    for (uint16_t i = 0; i < entries_per_sec; i++) {
-                        if (memcmp(entries[i].name, fat_name, 11) == 0) {
-                            entries[i].cluster_lo = 0;
-                            entries[i].cluster_hi = 0;
-                            entries[i].file_size = 0;
-                            write_sector(sector + s, fat_state.sector_buf);
-                            return 0;
-                        }
-                    }
-                }
-                cluster = fat_get_entry(cluster);
-            }
-        }
-        return 0;
+    if ((flags & FAT_O_TRUNC) && (flags & FAT_O_WRITE) && f->first != 0) {
+        fat_free_chain(f->first);
+        f->first = 0;
+        f->size = 0;
+        f->clusters = 0;
+        f->dirty = 1;
     }
 
-    uint32_t first_cluster = 0;
-    uint32_t prev_cluster = 0;
-    uint32_t bytes_written = 0;
-    const uint8_t* src = (const uint8_t*)data;
-    uint16_t bps = fat_state.bytes_per_sector;
+    return fd;
+}
 
-    while (bytes_written < size) {
-        uint32_t cluster = fat_alloc_cluster();
-        if (cluster == 0) {
-            if (first_cluster != 0) {
-                uint32_t c = first_cluster;
-                while (c >= 2 && c < 0x0FFFFFF8) {
-                    uint32_t next = fat_get_entry(c);
-                    fat_set_entry(c, 0);
-                    c = next;
-                }
-                if (fat_state.fat_cache_dirty) {
-                    write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-                    fat_state.fat_cache_dirty = 0;
-                }
-            }
-            if (!file_exists) {
-                fat_rm(path);
-            }
-            vga_print_color("Disk full\n", LIGHT_RED);
-            return -1;
-        }
+int fat_close(int fd) {
+    fat_file_t* f = file_get(fd);
+    if (!f) return -1;
 
-        if (first_cluster == 0) first_cluster = cluster;
-        if (prev_cluster != 0) {
-            fat_set_entry(prev_cluster, cluster);
-        }
-        prev_cluster = cluster;
+    int result = 0;
+    if (f->dirty && (file_store_entry(f) < 0 || dirtx_commit() < 0)) {
+        vga_print_color("Write error\n", LIGHT_RED);
+        result = -1;
+    }
+    if ((f->flags & FAT_O_WRITE) && fat_commit() < 0) {
+        vga_print_color("Write error\n", LIGHT_RED);
+        result = -1;
+    }
 
-        uint32_t sector = cluster_to_sector(cluster);
-        for (int s = 0; s < fat_state.sectors_per_cluster && bytes_written < size; s++) {
-            uint32_t chunk = size - bytes_written;
-            if (chunk > bps) chunk = bps;
+    f->used = 0;
+    return result;
+}
 
-            memset(fat_state.sector_buf, 0, bps);
-            memcpy(fat_state.sector_buf, src + bytes_written, chunk);
+int fat_seek(int fd, int32_t offset, int whence) {
+    fat_file_t* f = file_get(fd);
+    if (!f) return -1;
 
-            if (write_sector(sector + s, fat_state.sector_buf) < 0) return -1;
-            bytes_written += bps;
-        }
+    uint32_t base;
+    switch (whence) {
+        case FAT_SEEK_SET: base = 0; break;
+        case FAT_SEEK_CUR: base = f->pos; break;
+        case FAT_SEEK_END: base = f->size; break;
+        default: return -1;
     }
 
-    if (fat_state.fat_cache_dirty) {
-        write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-        fat_state.fat_cache_dirty = 0;
-    }
+    if (offset < 0 && (uint32_t)-(int64_t)offset > base) return -1;
+    f->pos = base + (uint32_t)offset;
+    return (int)f->pos;
+}
 
-    char parent_path[FAT_MAX_PATH];
-    char filename[FAT_MAX_NAME];
+int fat_read_at(int fd, uint32_t offset, void* buffer, uint32_t size) {
+    fat_file_t* f = file_get(fd);
+    if (!f || !(f->flags & FAT_O_READ)) return -1;
+    return file_read(f, offset, (uint8_t*)buffer, size);
+}
 
-    strncpy(parent_path, path, FAT_MAX_PATH - 1);
-    char* last_slash = strrchr(parent_path, '/');
-    if (last_slash) {
-        strcpy(filename, last_slash + 1);
-        if (last_slash == parent_path) parent_path[1] = '\0';
-        else *last_slash = '\0';
-    } else {
-        strcpy(filename, path);
-        strcpy(parent_path, ".");
-    }
+int fat_write_at(int fd, uint32_t offset, const void* data, uint32_t size) {
+    fat_file_t* f = file_get(fd);
+    if (!f || !(f->flags & FAT_O_WRITE)) return -1;
+    if (size == 0) return 0;
 
-    uint32_t parent_cluster;
-    if (strcmp(parent_path, ".") == 0) {
-        parent_cluster = fat_state.current_cluster;
-    } else if (strcmp(parent_path, "/") == 0) {
-        parent_cluster = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
-    } else {
-        fat_dir_entry_t pentry;
-        fat_resolve_path(parent_path, &parent_cluster, &pentry);
+    /* Writing past the end leaves a hole that reads as zeros */
+    if (offset > f->size) {
+        uint32_t gap = offset - f->size;
+        if (file_write(f, f->size, NULL, gap) != (int)gap) return -1;
     }
+    return file_write(f, offset, (const uint8_t*)data, size);
+}
 
-    char fat_name[11];
-    str_to_fat_name(filename, fat_name);
-    uint16_t entries_per_sec = fat_state.entries_per_sector;
+int fat_fread(int fd, void* buffer, uint32_t size) {
+    fat_file_t* f = file_get(fd);
+    if (!f) return -1;
 
-    if (parent_cluster == 0 && fat_state.type != FAT_TYPE_32) {
-        for (uint32_t s = 0; s < fat_state.root_dir_sectors; s++) {
-            read_sector(fat_state.root_dir_sector + s, fat_state.sector_buf);
-            fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-            for (uint16_t i = 0; i < entries_per_sec; i++) {
-                if (memcmp(entries[i].name, fat_name, 11) == 0) {
-                    entries[i].cluster_lo = first_cluster & 0xFFFF;
-                    entries[i].cluster_hi = (first_cluster >> 16) & 0xFFFF;
-                    entries[i].file_size = size;
-                    write_sector(fat_state.root_dir_sector + s, fat_state.sector_buf);
-                    return 0;
-                }
-            }
-        }
-    } else {
-        uint32_t cluster = parent_cluster;
-        while (cluster < 0x0FFFFFF8) {
-            uint32_t sector = cluster_to_sector(cluster);
-
-            for (int s = 0; s < fat_state.sectors_per_cluster; s++) {
-                read_sector(sector + s, fat_state.sector_buf);
-                fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-                for (uint16_t i = 0; i < entries_per_sec; i++) {
-                    if (memcmp(entries[i].name, fat_name, 11) == 0) {
-                        entries[i].cluster_lo = first_cluster & 0xFFFF;
-                        entries[i].cluster_hi = (first_cluster >> 16) & 0xFFFF;
-                        entries[i].file_size = size;
-                        write_sector(sector + s, fat_state.sector_buf);
-                        return 0;
-                    }
-                }
-            }
-            cluster = fat_get_entry(cluster);
-        }
-    }
+    int n = fat_read_at(fd, f->pos, buffer, size);
+    if (n > 0) f->pos += n;
+    return n;
+}
 
-    return 0;
+int fat_fwrite(int fd, const void* data, uint32_t size) {
+    fat_file_t* f = file_get(fd);
+    if (!f) return -1;
+
+    int n = fat_write_at(fd, f->pos, data, size);
+    if (n > 0) f->pos += n;
+    return n;
 }
 
-int fat_mkdir(const char* path) {
-    if (!fat_state.mounted) {
-        vga_print_color("No filesystem mounted\n", LIGHT_RED);
-        return -1;
-    }
+/*
+ * Grow a file in place: the tail cluster comes from the file's extent map,
+ * which stays cached between calls, the partial last sector is filled and
+ * new clusters are only claimed once it and the tail cluster are full.
+ */
+int fat_append(const char* path, const void* data, uint32_t size) {
+    int fd = fat_open(path, FAT_O_WRITE | FAT_O_CREATE);
+    if (fd < 0) return -1;
+
+    int n = fat_write_at(fd, files[fd].size, data, size);
+    if (fat_close(fd) < 0) return -1;
+    return (n == (int)size) ? 0 : -1;
+}
 
-    char parent_path[FAT_MAX_PATH];
-    char dirname[FAT_MAX_NAME];
+int fat_set_writeback(int enable) {
+    if (!fat_state.mounted) return -1;
 
-    strncpy(parent_path, path, FAT_MAX_PATH - 1);
-    parent_path[FAT_MAX_PATH - 1] = '\0';
+    int result = 0;
+    if (!enable && wb.enabled) result = wb_flush();
+    wb.enabled = enable ? 1 : 0;
+    if (enable) timer_set_idle_hook(fat_writeback_tick);
+    return result;
+}
 
-    char* last_slash = strrchr(parent_path, '/');
-    if (last_slash) {
-        strcpy(dirname, last_slash + 1);
-        if (last_slash == parent_path) parent_path[1] = '\0';
-        else *last_slash = '\0';
-    } else {
-        strcpy(dirname, path);
-        strcpy(parent_path, ".");
-    }
+int fat_flush(void) {
+    if (!fat_state.mounted) return -1;
+    return wb_flush();
+}
 
-    if (!is_valid_name(dirname)) {
-        vga_print_color("Invalid directory name\n", LIGHT_RED);
+int fat_fsync(int fd) {
+    fat_file_t* f = file_get(fd);
+    if (!f) return -1;
+
+    if (f->dirty && (file_store_entry(f) < 0 || dirtx_commit() < 0)) return -1;
+    return wb_flush();
+}
+
+void fat_writeback_tick(void) {
+    if (!fat_state.mounted || !wb.enabled || !wb.dirty) return;
+
+    uint32_t hz = get_timer_frequency();
+    if (hz && get_ticks() - wb.since < FAT_WB_EXPIRE_MS * hz / 1000) return;
+
+    wb_flush();
+}
+
+static int mkdir_entry(const char* path) {
+    if (!fat_state.mounted) {
+        vga_print_color("No filesystem mounted\n", LIGHT_RED);
         return -1;
     }
 
     uint32_t parent_cluster;
-    if (strcmp(parent_path, ".") == 0) {
-        parent_cluster = fat_state.current_cluster;
-    } else if (strcmp(parent_path, "/") == 0) {
-        parent_cluster = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
-    } else {
-        fat_dir_entry_t pentry;
-        if (fat_resolve_path(parent_path, &parent_cluster, &pentry) < 0) {
-            vga_print_color("Parent not found\n", LIGHT_RED);
-            return -1;
-        }
-    }
-
+    char dirname[FAT_MAX_NAME];
     fat_dir_entry_t existing;
-    if (fat_find_in_dir(parent_cluster, dirname, &existing) == 0) {
+
+    int found = lookup_entry(path, &parent_cluster, dirname, &existing);
+    if (found < 0) {
+        vga_print_color("Parent not found\n", LIGHT_RED);
+        return -1;
+    }
+    if (found == 0) {
         vga_print_color("Already exists\n", LIGHT_RED);
         return -1;
     }
+    if (!is_valid_name(dirname)) {
+        vga_print_color("Invalid directory name\n", LIGHT_RED);
+        return -1;
+    }
 
     uint32_t new_cluster = fat_alloc_cluster();
     if (new_cluster == 0) {
@@ -1449,6 +3198,7 @@ int fat_mkdir(const char* path) {
         return -1;
     }
 
+    /* The cluster is already zeroed; only "." and ".." need writing */
     memset(fat_state.sector_buf, 0, fat_state.bytes_per_sector);
     fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
 
@@ -1467,145 +3217,81 @@ int fat_mkdir(const char* path) {
 
     write_sector(cluster_to_sector(new_cluster), fat_state.sector_buf);
 
-    memset(fat_state.sector_buf, 0, fat_state.bytes_per_sector);
-    for (int s = 1; s < fat_state.sectors_per_cluster; s++) {
-        write_sector(cluster_to_sector(new_cluster) + s, fat_state.sector_buf);
-    }
-
-    char short_name[11];
-    str_to_fat_name(dirname, short_name);
-
-    uint32_t entry_sector;
-    int entry_index;
-
-    if (needs_lfn(dirname)) {
-        if (create_lfn_entries(parent_cluster, dirname, short_name, &entry_sector, &entry_index) < 0) {
-            fat_set_entry(new_cluster, 0);
-            if (fat_state.fat_cache_dirty) {
-                write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-                fat_state.fat_cache_dirty = 0;
-            }
-            vga_print_color("Directory full or disk full\n", LIGHT_RED);
-            return -1;
-        }
-    } else {
-        if (find_empty_entries(parent_cluster, 1, &entry_sector, &entry_index) < 0) {
-            fat_set_entry(new_cluster, 0);
-            if (fat_state.fat_cache_dirty) {
-                write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-                fat_state.fat_cache_dirty = 0;
-            }
-            vga_print_color("Directory full or disk full\n", LIGHT_RED);
-            return -1;
-        }
+    if (create_entry(parent_cluster, dirname, FAT_ATTR_DIRECTORY, new_cluster, 0, NULL) < 0) {
+        fat_set_entry(new_cluster, 0);
+        vga_print_color("Directory full or disk full\n", LIGHT_RED);
+        return -1;
     }
-
-    read_sector(entry_sector, fat_state.sector_buf);
-    entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-    memset(&entries[entry_index], 0, sizeof(fat_dir_entry_t));
-    memcpy(entries[entry_index].name, short_name, 11);
-    entries[entry_index].attr = FAT_ATTR_DIRECTORY;
-    entries[entry_index].cluster_lo = new_cluster & 0xFFFF;
-    entries[entry_index].cluster_hi = (new_cluster >> 16) & 0xFFFF;
-
-    write_sector(entry_sector, fat_state.sector_buf);
-
     return 0;
 }
 
-int fat_rm(const char* path) {
+int fat_mkdir(const char* path) {
+    int result = mkdir_entry(path);
+    if (fat_state.mounted && fat_commit() < 0) result = -1;
+    return result;
+}
+
+static int remove_entry(const char* path) {
     if (!fat_state.mounted) {
         vga_print_color("No filesystem mounted\n", LIGHT_RED);
         return -1;
     }
 
-    char parent_path[FAT_MAX_PATH];
+    uint32_t parent_cluster;
     char name[FAT_MAX_NAME];
+    fat_dir_entry_t entry;
 
-    strncpy(parent_path, path, FAT_MAX_PATH - 1);
-    char* last_slash = strrchr(parent_path, '/');
-    if (last_slash) {
-        strcpy(name, last_slash + 1);
-        if (last_slash == parent_path) parent_path[1] = '\0';
-        else *last_slash = '\0';
-    } else {
-        strcpy(name, path);
-        strcpy(parent_path, ".");
-    }
-
-    uint32_t parent_cluster;
-    if (strcmp(parent_path, ".") == 0) {
-        parent_cluster = fat_state.current_cluster;
-    } else if (strcmp(parent_path, "/") == 0) {
-        parent_cluster = (fat_state.type == FAT_TYPE_32) ? fat_state.root_cluster : 0;
-    } else {
-        fat_dir_entry_t pentry;
-        if (fat_resolve_path(parent_path, &parent_cluster, &pentry) < 0) {
-            vga_print_color("Parent not found\n", LIGHT_RED);
-            return -1;
-        }
+    int found = lookup_entry(path, &parent_cluster, name, &entry);
+    if (found < 0) {
+        vga_print_color("Parent not found\n", LIGHT_RED);
+        return -1;
     }
-
-    fat_dir_entry_t entry;
-    if (fat_find_in_dir(parent_cluster, name, &entry) < 0) {
+    if (found > 0) {
         vga_print_color("Not found\n", LIGHT_RED);
         return -1;
     }
 
+    dir_pos_t pos = found_pos;
     uint32_t cluster = get_entry_cluster(&entry);
-    while (cluster >= 2 && cluster < 0x0FFFFFF8) {
-        uint32_t next = fat_get_entry(cluster);
-        fat_set_entry(cluster, 0);
-        cluster = next;
+    wb_file_t* staged = wb_find(&pos);
+    if (staged) wb_forget(staged);
+    if (entry.attr & FAT_ATTR_DIRECTORY) {
+        dcache_drop_dir(cluster);
+        diridx_drop(cluster);
+        wb_forget_dir(cluster);
     }
+    fat_free_chain(cluster);
 
-    if (fat_state.fat_cache_dirty) {
-        write_sector(fat_state.fat_cache_sector, fat_state.fat_cache);
-        fat_state.fat_cache_dirty = 0;
+    /* The short entry and the long-name entries in front of it, one write per sector */
+    for (uint32_t o = pos.ord - pos.lfn; o <= pos.ord; o++) {
+        uint16_t index;
+        uint32_t sector = dir_ord_sector(parent_cluster, o, &index);
+        fat_dir_entry_t* e = sector ? dirtx_entry(sector, index) : NULL;
+        if (!e) return -1;
+        e->name[0] = 0xE5;
     }
+    if (dirtx_commit() < 0) return -1;
 
-    char fat_name[11];
-    str_to_fat_name(name, fat_name);
-    uint16_t entries_per_sec = fat_state.entries_per_sector;
-
-    if (parent_cluster == 0 && fat_state.type != FAT_TYPE_32) {
-        for (uint32_t s = 0; s < fat_state.root_dir_sectors; s++) {
-            read_sector(fat_state.root_dir_sector + s, fat_state.sector_buf);
-            fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
+    to_upper(name);
+    dcache_insert(parent_cluster, name, 1, &pos);
 
-            for (uint16_t i = 0; i < entries_per_sec; i++) {
-                if (memcmp(entries[i].name, fat_name, 11) == 0) {
-                    entries[i].name[0] = 0xE5;
-                    write_sector(fat_state.root_dir_sector + s, fat_state.sector_buf);
-                    return 0;
-                }
-            }
-        }
+    int x = diridx_find(parent_cluster);
+    if (x >= 0) {
+        diridx_remove(x, name_hash(name), pos.ord);
+        diridx_free_slots(x, pos.ord - pos.lfn, pos.lfn + 1);
     } else {
-        cluster = parent_cluster;
-        while (cluster < 0x0FFFFFF8) {
-            uint32_t sector = cluster_to_sector(cluster);
-
-            for (int s = 0; s < fat_state.sectors_per_cluster; s++) {
-                read_sector(sector + s, fat_state.sector_buf);
-                fat_dir_entry_t* entries = (fat_dir_entry_t*)fat_state.sector_buf;
-
-                for (uint16_t i = 0; i < entries_per_sec; i++) {
-                    if (memcmp(entries[i].name, fat_name, 11) == 0) {
-                        entries[i].name[0] = 0xE5;
-                        write_sector(sector + s, fat_state.sector_buf);
-                        return 0;
-                    }
-                }
-            }
-            cluster = fat_get_entry(cluster);
-        }
+        diridx_drop(parent_cluster);    /* It may fit in an index now */
     }
 
     return 0;
 }
 
+int fat_rm(const char* path) {
+    int result = remove_entry(path);
+    if (fat_state.mounted && fat_commit() < 0) result = -1;
+    return result;
+}
+
 void fat_info(void) {
     if (!fat_state.mounted) {
         vga_print_color("No filesystem mounted\n", LIGHT_RED);
@@ -1645,6 +3331,57 @@ void fat_info(void) {
     itoa(total_mb, buf, 10);
     vga_print(buf);
     vga_print_color(" MB\n", 0x0F);
+
+    vga_print_color("FAT cache: ", 0x0F);
+    if (fatc.resident) {
+        itoa((fat_state.fat_size_sectors * fat_state.bytes_per_sector) / 1024, buf, 10);
+        vga_print(buf);
+        vga_print_color(" KB resident\n", 0x0F);
+    } else {
+        itoa(FATC_SLOTS, buf, 10);
+        vga_print(buf);
+        vga_print_color(" x 4 KB LRU\n", 0x0F);
+    }
+
+    vga_print_color("Dentry cache: ", 0x0F);
+    itoa(dcache_stats.hits, buf, 10);
+    vga_print(buf);
+    vga_print_color(" hits, ", 0x0F);
+    itoa(dcache_stats.misses, buf, 10);
+    vga_print(buf);
+    vga_print_color(" misses\n", 0x0F);
+
+    vga_print_color("Write-back: ", 0x0F);
+    if (wb.enabled) {
+        itoa(wb.count, buf, 10);
+        vga_print(buf);
+        vga_print_color(" files staged, ", 0x0F);
+        itoa(wb.used / 1024, buf, 10);
+        vga_print(buf);
+        vga_print_color(" KB\n", 0x0F);
+    } else {
+        vga_print_color("off\n", 0x0F);
+    }
+
+    vga_print_color("Read-ahead: ", 0x0F);
+    itoa(ra.stats.requests, buf, 10);
+    vga_print(buf);
+    vga_print_color(" reads, ", 0x0F);
+    itoa(ra.stats.hits, buf, 10);
+    vga_print(buf);
+    vga_print_color(" hits, ", 0x0F);
+    itoa(ra.stats.prefetched, buf, 10);
+    vga_print(buf);
+    vga_print_color(" prefetched, ", 0x0F);
+    itoa(ra.stats.direct, buf, 10);
+    vga_print(buf);
+    vga_print_color(" sectors direct, window ", 0x0F);
+    itoa(ra.stats.window, buf, 10);
+    vga_print(buf);
+    vga_print_color(" (max ", 0x0F);
+    itoa(ra.stats.max_window, buf, 10);
+    vga_print(buf);
+    vga_print_color(")\n", 0x0F);
 }
 
 int fat_exists(const char* path) {
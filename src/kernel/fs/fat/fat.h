@@ -2,6 +2,7 @@
 #define FAT_H
 
 #include <stdint.h>
+#include "../../drivers/block/blkdev.h"
 
 typedef enum {
     FAT_TYPE_NONE = 0,
@@ -22,6 +23,17 @@ typedef enum {
 #define FAT32_EOC   0x0FFFFFF8
 #define FAT_MAX_PATH    256
 #define FAT_MAX_NAME    256
+#define FAT_MAX_OPEN    8
+
+/* fat_open() flags */
+#define FAT_O_READ      0x01
+#define FAT_O_WRITE     0x02
+#define FAT_O_CREATE    0x04    /* Create the file if it does not exist */
+#define FAT_O_TRUNC     0x08    /* Cut the file to zero length */
+
+#define FAT_SEEK_SET    0
+#define FAT_SEEK_CUR    1
+#define FAT_SEEK_END    2
 
 typedef struct {
     char        name[FAT_MAX_NAME];
@@ -32,9 +44,27 @@ typedef struct {
     uint16_t    time;
 } fat_file_info_t;
 
-int fat_mount(uint8_t drive);
-void fat_unmount(void);
+/* Sequential read-ahead counters; windows are in clusters */
+typedef struct {
+    uint32_t    requests;       /* Disk reads issued for file data */
+    uint32_t    hits;           /* Clusters served from the read-ahead buffer */
+    uint32_t    prefetched;     /* Clusters read ahead of the reader */
+    uint32_t    direct;         /* Sectors read straight into the caller's buffer */
+    uint32_t    window;         /* Current window */
+    uint32_t    max_window;     /* Largest window reached */
+} fat_ra_stats_t;
+
+/* Directory lookups answered by the dentry cache, negative entries included */
+typedef struct {
+    uint32_t    hits;
+    uint32_t    misses;
+} fat_dcache_stats_t;
+
+int fat_mount(blkdev_t* dev);
+int fat_format(blkdev_t* dev, const char* label);
+int fat_unmount(void);
 int fat_is_mounted(void);
+blkdev_t* fat_get_device(void);
 
 fat_type_t fat_get_type(void);
 const char* fat_get_type_str(void);
@@ -55,9 +85,40 @@ int fat_stat(const char* path, fat_file_info_t* info);
 int fat_exists(const char* path);
 int fat_is_dir(const char* path);
 
+/*
+ * Open files. Returns a descriptor, or -1. The *_at calls leave the
+ * position alone; fat_fread/fat_fwrite use and advance it. A write past
+ * the end leaves a zero-filled hole. Size and FAT changes reach the disk
+ * at fat_close(). Do not mix with path calls on the same file while it
+ * is open.
+ */
+int fat_open(const char* path, int flags);
+int fat_close(int fd);
+int fat_seek(int fd, int32_t offset, int whence);
+int fat_read_at(int fd, uint32_t offset, void* buffer, uint32_t size);
+int fat_write_at(int fd, uint32_t offset, const void* data, uint32_t size);
+int fat_fread(int fd, void* buffer, uint32_t size);
+int fat_fwrite(int fd, const void* data, uint32_t size);
+
+/*
+ * Write-back mode, off at mount. Changes stay in memory and small files
+ * written with fat_write() get their clusters only when flushed: by
+ * fat_flush(), fat_fsync(), unmount, or a few seconds after the first
+ * unflushed change, from the timer idle hook. That hook runs only while
+ * waiting for a key or in sleep(), so a busy loop postpones the flush.
+ * fat_fsync() also writes the handle's entry.
+ */
+int fat_set_writeback(int enable);
+int fat_flush(void);
+int fat_fsync(int fd);
+void fat_writeback_tick(void);
+
+/* In KB, so multi-GB FAT32 volumes fit; free space is O(1) */
 uint32_t fat_free_space(void);
 uint32_t fat_total_space(void);
 
 void fat_info(void);
+void fat_get_ra_stats(fat_ra_stats_t* stats);
+void fat_get_dcache_stats(fat_dcache_stats_t* stats);
 
 #endif
\ No newline at end of file
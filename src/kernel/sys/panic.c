@@ -13,6 +13,10 @@ void panic(const char *module, const char *reason, const char *function) {
     // 1. Выключаем прерывания на время отрисовки интерфейса
     asm volatile("cli");
 
+    // Ниже sleep() ждёт с включёнными прерываниями: отложенная работа (сброс
+    // write-back кэша FAT) после паники выполняться не должна
+    timer_set_idle_hook(0);
+
     fill_screen_with_color(BLUE_BG_WHITE);
 
     vga_print_centered("KERNEL PANIC", 6, BLUE_BG_RED);
@@ -33,4 +33,21 @@ static inline uint32_t inl(uint16_t port) {
     return val;
 }
 
+/* String I/O: move count words/dwords between a port and memory in one rep */
+static inline void insw(uint16_t port, void* addr, uint32_t count) {
+    __asm__ volatile ("cld; rep insw" : "+D"(addr), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* addr, uint32_t count) {
+    __asm__ volatile ("cld; rep outsw" : "+S"(addr), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void insl(uint16_t port, void* addr, uint32_t count) {
+    __asm__ volatile ("cld; rep insl" : "+D"(addr), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsl(uint16_t port, const void* addr, uint32_t count) {
+    __asm__ volatile ("cld; rep outsl" : "+S"(addr), "+c"(count) : "d"(port) : "memory");
+}
+
 #endif